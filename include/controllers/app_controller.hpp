@@ -62,6 +62,7 @@ class AppController
      */
     void key_event(EventMgr::KeyEvent key);
 
+    void going_to_light_sleep();
     void going_to_deep_sleep();
     void launch();
 
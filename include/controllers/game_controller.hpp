@@ -9,6 +9,8 @@
 
 #include "chess_engine.hpp"
 
+#include <thread>
+
 class GameController
 {
   public:
@@ -19,20 +21,37 @@ class GameController
                   game_board(nullptr),
                    game_over(false  ),
           complete_user_move(false  ),
+          tablebases_checked(false  ),
+                 puzzle_mode(false  ),
+                review_count(0      ),
+                  hint_valid(false  ),
+                   pondering(false  ),
+                ponder_found(false  ),
          promotion_move_type(MoveType::UNKNOWN) { }
     
     void           key_event(EventMgr::KeyEvent key);
     void               enter();
     void               leave(bool going_to_deep_sleep = false);
     void            new_game(bool user_play_white);
+    bool          new_puzzle();
+    void         resume_game();
+    bool         review_game();
+    bool                hint();
     void    set_promotion_to(MoveType move_type) { promotion_move_type = move_type; }
     MoveType   get_promotion() { return promotion_move_type; }
     bool  is_game_play_white() { return game_play_white;     }
     void                save();
 
+    // Ends the search started on the expected user move, if any. The engine
+    // root position is back to the one of the game.
+    void      stop_pondering();
+
   private:
     static constexpr char const * TAG = "GameController";
     static constexpr uint8_t      SAVED_GAME_FILE_VERSION = 1;
+    static constexpr int          REVIEW_NODES            = 50000; // Search budget per position, as a Club level move
+    static constexpr int          HINT_NODES              = 3000; // Search budget of a hint
+    static constexpr int          PONDER_STACK_SIZE       = 40000; // As the main task, for the search
 
     std::string  msg;                // Message to show on top of the board
 
@@ -47,10 +66,37 @@ class GameController
     Board      * game_board;
     bool         game_over;
     bool         complete_user_move;
+    bool         tablebases_checked; // The SD card endgame folders were looked at
+
+    bool         puzzle_mode;        // A puzzle is shown instead of the saved game
+    Puzzle       puzzle;
+    uint32_t     puzzle_index;       // Record of the puzzle in the puzzles file
+    uint8_t      puzzle_step;        // Next move of the puzzle solution
+
+    GameReview::Class review_classes[1000]; // Classes of the reviewed moves
+    int16_t           review_count;
+
+    bool         hint_valid;         // hint_step is the hint of the position of key hint_key
+    uint64_t     hint_key;
+    Step         hint_step;
+
+    bool         pondering;          // The engine is searching the position after ponder_step
+    Step         ponder_step;        // Expected user move
+    bool         ponder_found;       // ponder_best was found while pondering on the move played
+    Step         ponder_best;
+    Board        shown_board;        // Game position, shown while pondering
+    Board        ponder_board;       // Position after ponder_step
+    std::thread  ponder_thread;
 
     MoveType     promotion_move_type;
 
     void   engine_play();
+    void start_pondering(const Step & expected);
+    void   end_pondering(bool async);
+    void   puzzle_play();
+    void     play_best();
+    bool   puzzle_move(const Step & step);
+    void restore_limits();
     void          play(Pos from_pos, Pos to_pos);
     void        replay();
     bool          load();
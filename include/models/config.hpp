@@ -9,10 +9,11 @@
 
 enum class ConfigIdent { 
   VERSION, SSID, PWD, PORT, BATTERY, TIMEOUT, 
-  DEFAULT_FONT, PIXEL_RESOLUTION, SHOW_HEAP, ENGINE_TIME
+  DEFAULT_FONT, PIXEL_RESOLUTION, SHOW_HEAP, ENGINE_TIME, SKILL_LEVEL,
+  PUZZLE_RATING, PONDER
 };
 
-typedef ConfigBase<ConfigIdent, 10> Config;
+typedef ConfigBase<ConfigIdent, 13> Config;
 
 #if __CONFIG__
   #include <string>
@@ -30,6 +31,9 @@ typedef ConfigBase<ConfigIdent, 10> Config;
   static int8_t   default_font;
   static int8_t   resolution;
   static int8_t   show_heap;
+  static int8_t   skill_level;
+  static int8_t   puzzle_rating;
+  static int8_t   ponder;
 
   static int32_t  default_port               = 80;
   static int8_t   default_engine_time        =  4;  // in multiple of 15 seconds
@@ -38,6 +42,9 @@ typedef ConfigBase<ConfigIdent, 10> Config;
   static int8_t   default_default_font       =  1;  // 0 = CALADEA, 1 = CRIMSON, 2 = RED HAT, 3 = ASAP
   static int8_t   default_resolution         =  0;  // 0 = 1bit, 1 = 3bits
   static int8_t   default_show_heap          =  0;  // 0 = NO, 1 = YES
+  static int8_t   default_skill_level        =  4;  // 0 = BEGINNER ... 4 = FULL STRENGTH
+  static int8_t   default_puzzle_rating      = 12;  // Puzzles rating bucket, in hundreds
+  static int8_t   default_ponder             =  0;  // 0 = NO, 1 = YES (search on the user's time)
   static int8_t   the_version                =  1;
 
   // static Config::CfgType conf = {{
@@ -54,6 +61,9 @@ typedef ConfigBase<ConfigIdent, 10> Config;
     { Config::Ident::PIXEL_RESOLUTION,   Config::EntryType::BYTE,   "resolution",         &resolution,         &default_resolution,         0 },
     { Config::Ident::SHOW_HEAP,          Config::EntryType::BYTE,   "show_heap",          &show_heap,          &default_show_heap,          0 },
     { Config::Ident::ENGINE_TIME,        Config::EntryType::BYTE,   "engine_time",        &engine_time,        &default_engine_time,        0 },
+    { Config::Ident::SKILL_LEVEL,        Config::EntryType::BYTE,   "skill_level",        &skill_level,        &default_skill_level,        0 },
+    { Config::Ident::PUZZLE_RATING,      Config::EntryType::BYTE,   "puzzle_rating",      &puzzle_rating,      &default_puzzle_rating,      0 },
+    { Config::Ident::PONDER,             Config::EntryType::BYTE,   "ponder",             &ponder,             &default_ponder,             0 },
   }};
 
   // Config config(conf, CONFIG_FILE);
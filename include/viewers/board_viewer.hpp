@@ -19,6 +19,8 @@
 #include "viewers/page.hpp"
 #include "models/fonts.hpp"
 
+#include "chess_engine_review.hpp"
+
 class BoardViewer
 {
   private:
@@ -36,7 +38,7 @@ class BoardViewer
 
   public:
 
-    BoardViewer() { }
+    BoardViewer() : annotations(nullptr), annotation_count(0), hint_from(-1, -1), hint_to(-1, -1), shown_board(nullptr) { }
    ~BoardViewer() { }
 
     /**
@@ -52,6 +54,37 @@ class BoardViewer
 
     void show_cursor(bool play_white, Dim dim, Pos pos, Page::Format & fmt, bool bold);
 
+    /**
+     * @brief Review classes of the first count steps, shown as ?!, ? and ??
+     * after the moves. The array must stay valid until the next call.
+     */
+    void set_annotations(const GameReview::Class * classes, int count) {
+      annotations      = classes;
+      annotation_count = (classes == nullptr) ? 0 : count;
+    }
+
+    /**
+     * @brief Squares of a suggested move, shown with an inner frame until
+     * cleared with clear_hint().
+     */
+    void set_hint(Pos from, Pos to) { hint_from = from; hint_to = to; }
+    void clear_hint() { hint_from = hint_to = Pos(-1, -1); }
+
+    /**
+     * @brief Board shown in place of the chess engine one, while the engine
+     * is searching on another position (pondering). nullptr for the engine
+     * board.
+     */
+    void set_board(const Board * board) { shown_board = board; }
+
+  private:
+    const GameReview::Class * annotations;
+    int                       annotation_count;
+    Pos                       hint_from, hint_to;
+    const Board             * shown_board;
+
+    void show_hint(bool play_white, Dim dim, Pos pos, Page::Format & fmt);
+
 };
 
 #if __BOARD_VIEWER__
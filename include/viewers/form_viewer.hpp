@@ -77,6 +77,22 @@ class FormViewer
       { "5m",  20 }
     };
 
+    static constexpr Choice skill_level_choices[5] = {
+      { "Beginner", 0 },
+      { "Casual",   1 },
+      { "Club",     2 },
+      { "Expert",   3 },
+      { "Full",     4 }
+    };
+
+    static constexpr Choice puzzle_rating_choices[5] = {
+      { "800",   8 },
+      { "1200", 12 },
+      { "1600", 16 },
+      { "2000", 20 },
+      { "2400", 24 }
+    };
+
   private:
     static constexpr uint8_t MAX_FORM_ENTRY   =  10;
     static constexpr uint8_t MAX_CHOICE_ENTRY =  30;
@@ -9,7 +9,7 @@
 class MenuViewer
 {
   public:
-    static constexpr uint8_t MAX_MENU_ENTRY = 10;
+    static constexpr uint8_t MAX_MENU_ENTRY = 12;
 
     enum class Icon { RETURN, REVERT, REFRESH, BOOK, BOOK_LIST, MAIN_PARAMS, 
                       FONT_PARAMS, POWEROFF, WIFI, INFO,
@@ -16,6 +16,16 @@
 #define _WEIGHTS_ 1
 #include "chess_engine_weights.hpp"
 
+#include "chess_engine_trace.hpp"
+#include "chess_engine_zobrist.hpp"
+#include "chess_engine_book.hpp"
+#include "chess_engine_syzygy.hpp"
+#include "chess_engine_bitbase.hpp"
+#include "chess_engine_endgame.hpp"
+#include "chess_engine_pawns.hpp"
+#include "chess_engine_evalcache.hpp"
+#include "chess_engine_nnue.hpp"
+
 #include <cinttypes>
 #include <string>
 #include <iostream>
@@ -26,6 +36,7 @@
 #include <thread>
 #include <chrono>
 #include <cstring>
+#include <climits>
 
 #include <cassert>
 
@@ -39,6 +50,75 @@ static bool          endgame = false;
 
 static Position pos[MAXDEPTH + 1];
 
+// Triangular principal variation table: pv[i][i..pv_length[i] - 1] is the
+// best line found from position i.
+static Step pv[MAXDEPTH + 1][MAXDEPTH + 1];
+static int  pv_length[MAXDEPTH + 1];
+
+// Piece-square score of a piece, from the point of view of white, in the
+// middle game and in the endgame. Only the king tables differ.
+static inline int
+pst_mg(int f, int board_idx)
+{
+  return (f > 0) ? stat_weight_white[f - 1][board_idx] : -stat_weight_black[-f - 1][board_idx];
+}
+
+static inline int
+pst_eg(int f, int board_idx)
+{
+  if (f ==  KING) return  stat_weight_white[KING][board_idx];
+  if (f == -KING) return -stat_weight_black[KING][board_idx];
+  return pst_mg(f, board_idx);
+}
+
+// King safety, middle game only. The pieces reaching the squares around
+// the enemy king (the king zone) are counted by generate_steps(), each
+// square weighted by the kind of the piece. The danger grows as the square
+// of the weighted count and with the number of attacking pieces, a lone
+// attacker being seldom dangerous.
+static const int king_attack_weight[] = { 0, 0, 2, 2, 3, 5, 0 };
+static const int attackers_percent[]  = { 0, 20, 50, 75, 90, 100, 100, 100 };
+static const int KING_DANGER_MAX      = 500;
+static const int SHIELD_NEAR          =  12; // Pawn in front of the king
+static const int SHIELD_FAR           =   6; // Pawn two rows in front
+static const int KING_SEMI_OPEN_FILE  = -15; // No pawn of the king side on a file next to the king
+static const int KING_OPEN_FILE       = -10; // ... and no enemy pawn either
+
+// Piece activity, from the steps counted by generate_steps(): mobility
+// (steps above the base count of the kind of piece), the steps reaching the
+// center squares and the knights and bishops on outposts (see
+// PawnTable::Scores).
+static const int mobility_base[]      = { 0, 0, 4, 6, 6, 12, 0 };
+static const int mobility_mg[]        = { 0, 0, 4, 5, 2,  1, 0 };
+static const int mobility_eg[]        = { 0, 0, 4, 5, 4,  2, 0 };
+static const int CENTER_MG            =   3;
+static const int KNIGHT_OUTPOST_MG    =  20, KNIGHT_OUTPOST_EG = 10;
+static const int BISHOP_OUTPOST_MG    =  10, BISHOP_OUTPOST_EG =  5;
+
+// True if board_idx is next to (or is) the king square king_idx.
+static inline bool
+in_king_zone(int board_idx, int king_idx)
+{
+  return (abs(ChessEngine::row[board_idx]    - ChessEngine::row[king_idx])    <= 1) &&
+         (abs(ChessEngine::column[board_idx] - ChessEngine::column[king_idx]) <= 1);
+}
+
+// Search limits of each skill level. A zero value means no limit. The noise
+// is the maximum random offset (centipawns) added to the root move scores.
+struct SkillLimits {
+  unsigned long nodes;
+  int           depth;
+  int           noise;
+};
+
+static const SkillLimits skill_limits[ChessEngine::SKILL_LEVEL_COUNT] = {
+  {   2000, 2, 150 },  // Beginner
+  {  10000, 3,  80 },  // Casual
+  {  50000, 4,  40 },  // Club
+  { 300000, 6,  15 },  // Expert
+  {      0, 0,   0 }   // Full strength
+};
+
 enum class TaskReq    : int8_t { EXEC, STOP };
 enum class EngineReq  : int8_t { COMPLETED  };
 
@@ -51,6 +131,8 @@ struct EngineQueueData {
 };
 
 #if CHESS_LINUX_BUILD  
+  #include <unistd.h>
+
   static mqd_t   task_queue;
   static mqd_t   engine_queue;
 
@@ -204,9 +286,6 @@ ChessEngine::check_on_black_king()
 // moves related to pawns and kings.
 void ChessTask::exec()
 {
-  int    pos_idx;
-  int8_t f;
-  //unsigned long task_tik;
   //unsigned long task_count = 0;
 
   TaskQueueData task_queue_data;
@@ -214,143 +293,8 @@ void ChessTask::exec()
   for (;;) {
     QUEUE_RECEIVE(task_queue, task_queue_data, 5000 / portTICK_PERIOD_MS);
     if (task_queue_data.req == TaskReq::EXEC) {
-      // task_tik=micros();
-      pos_idx = task_pos_idx;
-      assert((pos_idx >= 0) && (pos_idx < MAXDEPTH));
-      if (board[idx_white_king] != KING) {
-        for (int board_idx = 0; board_idx < 64; board_idx++) {
-          if (board[board_idx] == KING) {
-            idx_white_king = board_idx;
-            break;
-          }
-        }
-      }
-      if (board[idx_black_king] != -KING) {
-        for (int board_idx = 0; board_idx < 64; board_idx++) {
-          if (board[board_idx] == -KING) {
-            idx_black_king = board_idx;
-            break;
-          }
-        }
-      }
-      assert((pos_idx >= 0) && (pos_idx < MAXDEPTH));
-      if (pos_idx > 0) {
-        if (pos[pos_idx - 1].steps[pos[pos_idx - 1].cur_step].check == CheckType::NONE) {
-          if (pos[pos_idx].white_move) 
-            pos[pos_idx].check_on_table = chess_engine.check_on_white_king();
-          else 
-            pos[pos_idx].check_on_table = chess_engine.check_on_black_king();
-          pos[pos_idx - 1].steps[pos[pos_idx - 1].cur_step].check = 
-            pos[pos_idx].check_on_table ? CheckType::CHECK : CheckType::NONE;
-        } 
-        else pos[pos_idx].check_on_table = true;
-      } 
-      else if (pos[0].white_move) pos[0].check_on_table = chess_engine.check_on_white_king();
-      else pos[0].check_on_table = chess_engine.check_on_black_king();
-
-      steps_count = 0;
-
-      for (int ii = 0; ii < 64; ii++) {
-        int board_idx = (pos[pos_idx].white_move)  ? ii : 63 - ii;
-
-        f = board[board_idx];
-
-        if ((f == NO_FIG) || 
-            (chess_engine.is_black_fig(f) &&  pos[pos_idx].white_move) || 
-            (chess_engine.is_white_fig(f) && !pos[pos_idx].white_move)) continue;
-
-        if (f == PAWN) {
-          if ((ChessEngine::row[board_idx] < 7) && (board[board_idx - 8] == NO_FIG)) add_one_step(board_idx, board_idx - 8);
-          if ((ChessEngine::row[board_idx] == 2) && (board[board_idx - 8] == NO_FIG) && (board[board_idx - 16] == NO_FIG)) add_one_step(board_idx, board_idx - 16);
-          if (ChessEngine::row[board_idx] == 7) {
-            if (board[board_idx - 8] == NO_FIG) { // No piece on front on last row
-              add_one_step(board_idx, board_idx - 8); steps[steps_count - 1].type = MoveType::PROMOTE_TO_KNIGHT;
-              add_one_step(board_idx, board_idx - 8); steps[steps_count - 1].type = MoveType::PROMOTE_TO_BISHOP;
-              add_one_step(board_idx, board_idx - 8); steps[steps_count - 1].type = MoveType::PROMOTE_TO_ROOK;
-              add_one_step(board_idx, board_idx - 8); steps[steps_count - 1].type = MoveType::PROMOTE_TO_QUEEN;
-            }
-            if ((ChessEngine::column[board_idx] > 1) && chess_engine.is_black_fig(board[board_idx - 9])) { // A piece can be taken on last row to the left
-              add_one_step(board_idx, board_idx - 9); steps[steps_count - 1].type = MoveType::PROMOTE_TO_KNIGHT;
-              add_one_step(board_idx, board_idx - 9); steps[steps_count - 1].type = MoveType::PROMOTE_TO_BISHOP;
-              add_one_step(board_idx, board_idx - 9); steps[steps_count - 1].type = MoveType::PROMOTE_TO_ROOK;
-              add_one_step(board_idx, board_idx - 9); steps[steps_count - 1].type = MoveType::PROMOTE_TO_QUEEN;
-            }
-            if ((ChessEngine::column[board_idx] < 8) && chess_engine.is_black_fig(board[board_idx - 7])) { // A piece can be taken on last row to the right
-              add_one_step(board_idx, board_idx - 7); steps[steps_count - 1].type = MoveType::PROMOTE_TO_KNIGHT;
-              add_one_step(board_idx, board_idx - 7); steps[steps_count - 1].type = MoveType::PROMOTE_TO_BISHOP;
-              add_one_step(board_idx, board_idx - 7); steps[steps_count - 1].type = MoveType::PROMOTE_TO_ROOK;
-              add_one_step(board_idx, board_idx - 7); steps[steps_count - 1].type = MoveType::PROMOTE_TO_QUEEN;
-            }
-          } 
-          else {
-            if ((ChessEngine::column[board_idx] > 1) && chess_engine.is_black_fig(board[board_idx - 9])) add_one_step(board_idx, board_idx - 9);
-            if ((ChessEngine::column[board_idx] < 8) && chess_engine.is_black_fig(board[board_idx - 7])) add_one_step(board_idx, board_idx - 7);
-          }
-        } 
-        else if (f == -PAWN) {
-
-          if ((ChessEngine::row[board_idx] > 2) && (board[board_idx + 8] == NO_FIG)) add_one_step(board_idx, board_idx + 8);
-          if ((ChessEngine::row[board_idx] == 7) && (board[board_idx + 8] == NO_FIG) && (board[board_idx + 16] == NO_FIG)) add_one_step(board_idx, board_idx + 16);
-          if (ChessEngine::row[board_idx] == 2) {
-            if (board[board_idx + 8] == NO_FIG) {
-              add_one_step(board_idx, board_idx + 8); steps[steps_count - 1].type = MoveType::PROMOTE_TO_KNIGHT;
-              add_one_step(board_idx, board_idx + 8); steps[steps_count - 1].type = MoveType::PROMOTE_TO_BISHOP;
-              add_one_step(board_idx, board_idx + 8); steps[steps_count - 1].type = MoveType::PROMOTE_TO_ROOK;
-              add_one_step(board_idx, board_idx + 8); steps[steps_count - 1].type = MoveType::PROMOTE_TO_QUEEN;
-            }
-            if ((ChessEngine::column[board_idx] > 1) && chess_engine.is_white_fig(board[board_idx + 7])) {
-              add_one_step(board_idx, board_idx + 7); steps[steps_count - 1].type = MoveType::PROMOTE_TO_KNIGHT;
-              add_one_step(board_idx, board_idx + 7); steps[steps_count - 1].type = MoveType::PROMOTE_TO_BISHOP;
-              add_one_step(board_idx, board_idx + 7); steps[steps_count - 1].type = MoveType::PROMOTE_TO_ROOK;
-              add_one_step(board_idx, board_idx + 7); steps[steps_count - 1].type = MoveType::PROMOTE_TO_QUEEN;
-            }
-            if ((ChessEngine::column[board_idx] < 8) && chess_engine.is_white_fig(board[board_idx + 9])) {
-              add_one_step(board_idx, board_idx + 9); steps[steps_count - 1].type = MoveType::PROMOTE_TO_KNIGHT;
-              add_one_step(board_idx, board_idx + 9); steps[steps_count - 1].type = MoveType::PROMOTE_TO_BISHOP;
-              add_one_step(board_idx, board_idx + 9); steps[steps_count - 1].type = MoveType::PROMOTE_TO_ROOK;
-              add_one_step(board_idx, board_idx + 9); steps[steps_count - 1].type = MoveType::PROMOTE_TO_QUEEN;
-            }
-          } 
-          else {
-            if ((ChessEngine::column[board_idx] > 1) && chess_engine.is_white_fig(board[board_idx + 7])) add_one_step(board_idx, board_idx + 7);
-            if ((ChessEngine::column[board_idx] < 8) && chess_engine.is_white_fig(board[board_idx + 9])) add_one_step(board_idx, board_idx + 9);
-          }
-        } 
-        else if (!endgame && (abs(f) == KING)) add_king_step(board_idx);
-      }
+      generate();
 
-      if ((pos[pos_idx].en_passant_pp != 0) && 
-          (board[pos[pos_idx].en_passant_pp] == NO_FIG)) {
-        if (pos[pos_idx].white_move) {
-          if ((ChessEngine::column[pos[pos_idx].en_passant_pp] > 1) && 
-              (board[pos[pos_idx].en_passant_pp + 7] == PAWN)) {
-            add_one_step(pos[pos_idx].en_passant_pp + 7, pos[pos_idx].en_passant_pp);
-            steps[steps_count - 1].type = MoveType::EN_PASSANT;
-            steps[steps_count - 1].f2   = -PAWN;
-          }
-          if ((ChessEngine::column[pos[pos_idx].en_passant_pp] < 8) && 
-              (board[pos[pos_idx].en_passant_pp + 9] == PAWN)) {
-            add_one_step(pos[pos_idx].en_passant_pp + 9, pos[pos_idx].en_passant_pp);
-            steps[steps_count - 1].type = MoveType::EN_PASSANT;
-            steps[steps_count - 1].f2   = -PAWN;
-          }
-        } 
-        else {
-          if ((ChessEngine::column[pos[pos_idx].en_passant_pp] > 1) && 
-              (board[pos[pos_idx].en_passant_pp - 9] == -PAWN)) {
-            add_one_step(pos[pos_idx].en_passant_pp - 9, pos[pos_idx].en_passant_pp);
-            steps[steps_count - 1].type = MoveType::EN_PASSANT;
-            steps[steps_count - 1].f2   = PAWN;
-          }
-          if ((ChessEngine::column[pos[pos_idx].en_passant_pp] < 8) && 
-              (board[pos[pos_idx].en_passant_pp - 7] == -PAWN)) {
-            add_one_step(pos[pos_idx].en_passant_pp - 7, pos[pos_idx].en_passant_pp);
-            steps[steps_count - 1].type = MoveType::EN_PASSANT;
-            steps[steps_count - 1].f2   = PAWN;
-          }
-        }
-      }
-      //   task_execute+=micros()-task_tik;
       EngineQueueData engine_queue_data;
       engine_queue_data.req = EngineReq::COMPLETED;
       QUEUE_SEND(engine_queue, engine_queue_data, 0);
@@ -378,6 +322,153 @@ void ChessTask::exec()
   }
 }
 
+// Pawn and king moves of position task_pos_idx. Called by the task, or
+// directly by the engine in deterministic mode.
+void ChessTask::generate()
+{
+  int    pos_idx;
+  int8_t f;
+  //unsigned long task_tik;
+
+  // task_tik=micros();
+  pos_idx = task_pos_idx;
+  assert((pos_idx >= 0) && (pos_idx < MAXDEPTH));
+  if (board[idx_white_king] != KING) {
+    for (int board_idx = 0; board_idx < 64; board_idx++) {
+      if (board[board_idx] == KING) {
+        idx_white_king = board_idx;
+        break;
+      }
+    }
+  }
+  if (board[idx_black_king] != -KING) {
+    for (int board_idx = 0; board_idx < 64; board_idx++) {
+      if (board[board_idx] == -KING) {
+        idx_black_king = board_idx;
+        break;
+      }
+    }
+  }
+  assert((pos_idx >= 0) && (pos_idx < MAXDEPTH));
+  if (pos_idx > 0) {
+    if (pos[pos_idx - 1].steps[pos[pos_idx - 1].cur_step].check == CheckType::NONE) {
+      if (pos[pos_idx].white_move) 
+        pos[pos_idx].check_on_table = chess_engine.check_on_white_king();
+      else 
+        pos[pos_idx].check_on_table = chess_engine.check_on_black_king();
+      pos[pos_idx - 1].steps[pos[pos_idx - 1].cur_step].check = 
+        pos[pos_idx].check_on_table ? CheckType::CHECK : CheckType::NONE;
+    } 
+    else pos[pos_idx].check_on_table = true;
+  } 
+  else if (pos[0].white_move) pos[0].check_on_table = chess_engine.check_on_white_king();
+  else pos[0].check_on_table = chess_engine.check_on_black_king();
+
+  steps_count = 0;
+
+  for (int ii = 0; ii < 64; ii++) {
+    int board_idx = (pos[pos_idx].white_move)  ? ii : 63 - ii;
+
+    f = board[board_idx];
+
+    if ((f == NO_FIG) || 
+        (chess_engine.is_black_fig(f) &&  pos[pos_idx].white_move) || 
+        (chess_engine.is_white_fig(f) && !pos[pos_idx].white_move)) continue;
+
+    if (f == PAWN) {
+      if ((ChessEngine::row[board_idx] < 7) && (board[board_idx - 8] == NO_FIG)) add_one_step(board_idx, board_idx - 8);
+      if ((ChessEngine::row[board_idx] == 2) && (board[board_idx - 8] == NO_FIG) && (board[board_idx - 16] == NO_FIG)) add_one_step(board_idx, board_idx - 16);
+      if (ChessEngine::row[board_idx] == 7) {
+        if (board[board_idx - 8] == NO_FIG) { // No piece on front on last row
+          add_one_step(board_idx, board_idx - 8); steps[steps_count - 1].type = MoveType::PROMOTE_TO_KNIGHT;
+          add_one_step(board_idx, board_idx - 8); steps[steps_count - 1].type = MoveType::PROMOTE_TO_BISHOP;
+          add_one_step(board_idx, board_idx - 8); steps[steps_count - 1].type = MoveType::PROMOTE_TO_ROOK;
+          add_one_step(board_idx, board_idx - 8); steps[steps_count - 1].type = MoveType::PROMOTE_TO_QUEEN;
+        }
+        if ((ChessEngine::column[board_idx] > 1) && chess_engine.is_black_fig(board[board_idx - 9])) { // A piece can be taken on last row to the left
+          add_one_step(board_idx, board_idx - 9); steps[steps_count - 1].type = MoveType::PROMOTE_TO_KNIGHT;
+          add_one_step(board_idx, board_idx - 9); steps[steps_count - 1].type = MoveType::PROMOTE_TO_BISHOP;
+          add_one_step(board_idx, board_idx - 9); steps[steps_count - 1].type = MoveType::PROMOTE_TO_ROOK;
+          add_one_step(board_idx, board_idx - 9); steps[steps_count - 1].type = MoveType::PROMOTE_TO_QUEEN;
+        }
+        if ((ChessEngine::column[board_idx] < 8) && chess_engine.is_black_fig(board[board_idx - 7])) { // A piece can be taken on last row to the right
+          add_one_step(board_idx, board_idx - 7); steps[steps_count - 1].type = MoveType::PROMOTE_TO_KNIGHT;
+          add_one_step(board_idx, board_idx - 7); steps[steps_count - 1].type = MoveType::PROMOTE_TO_BISHOP;
+          add_one_step(board_idx, board_idx - 7); steps[steps_count - 1].type = MoveType::PROMOTE_TO_ROOK;
+          add_one_step(board_idx, board_idx - 7); steps[steps_count - 1].type = MoveType::PROMOTE_TO_QUEEN;
+        }
+      } 
+      else {
+        if ((ChessEngine::column[board_idx] > 1) && chess_engine.is_black_fig(board[board_idx - 9])) add_one_step(board_idx, board_idx - 9);
+        if ((ChessEngine::column[board_idx] < 8) && chess_engine.is_black_fig(board[board_idx - 7])) add_one_step(board_idx, board_idx - 7);
+      }
+    } 
+    else if (f == -PAWN) {
+
+      if ((ChessEngine::row[board_idx] > 2) && (board[board_idx + 8] == NO_FIG)) add_one_step(board_idx, board_idx + 8);
+      if ((ChessEngine::row[board_idx] == 7) && (board[board_idx + 8] == NO_FIG) && (board[board_idx + 16] == NO_FIG)) add_one_step(board_idx, board_idx + 16);
+      if (ChessEngine::row[board_idx] == 2) {
+        if (board[board_idx + 8] == NO_FIG) {
+          add_one_step(board_idx, board_idx + 8); steps[steps_count - 1].type = MoveType::PROMOTE_TO_KNIGHT;
+          add_one_step(board_idx, board_idx + 8); steps[steps_count - 1].type = MoveType::PROMOTE_TO_BISHOP;
+          add_one_step(board_idx, board_idx + 8); steps[steps_count - 1].type = MoveType::PROMOTE_TO_ROOK;
+          add_one_step(board_idx, board_idx + 8); steps[steps_count - 1].type = MoveType::PROMOTE_TO_QUEEN;
+        }
+        if ((ChessEngine::column[board_idx] > 1) && chess_engine.is_white_fig(board[board_idx + 7])) {
+          add_one_step(board_idx, board_idx + 7); steps[steps_count - 1].type = MoveType::PROMOTE_TO_KNIGHT;
+          add_one_step(board_idx, board_idx + 7); steps[steps_count - 1].type = MoveType::PROMOTE_TO_BISHOP;
+          add_one_step(board_idx, board_idx + 7); steps[steps_count - 1].type = MoveType::PROMOTE_TO_ROOK;
+          add_one_step(board_idx, board_idx + 7); steps[steps_count - 1].type = MoveType::PROMOTE_TO_QUEEN;
+        }
+        if ((ChessEngine::column[board_idx] < 8) && chess_engine.is_white_fig(board[board_idx + 9])) {
+          add_one_step(board_idx, board_idx + 9); steps[steps_count - 1].type = MoveType::PROMOTE_TO_KNIGHT;
+          add_one_step(board_idx, board_idx + 9); steps[steps_count - 1].type = MoveType::PROMOTE_TO_BISHOP;
+          add_one_step(board_idx, board_idx + 9); steps[steps_count - 1].type = MoveType::PROMOTE_TO_ROOK;
+          add_one_step(board_idx, board_idx + 9); steps[steps_count - 1].type = MoveType::PROMOTE_TO_QUEEN;
+        }
+      } 
+      else {
+        if ((ChessEngine::column[board_idx] > 1) && chess_engine.is_white_fig(board[board_idx + 7])) add_one_step(board_idx, board_idx + 7);
+        if ((ChessEngine::column[board_idx] < 8) && chess_engine.is_white_fig(board[board_idx + 9])) add_one_step(board_idx, board_idx + 9);
+      }
+    } 
+    else if (!endgame && (abs(f) == KING)) add_king_step(board_idx);
+  }
+
+  if ((pos[pos_idx].en_passant_pp != 0) && 
+      (board[pos[pos_idx].en_passant_pp] == NO_FIG)) {
+    if (pos[pos_idx].white_move) {
+      if ((ChessEngine::column[pos[pos_idx].en_passant_pp] > 1) && 
+          (board[pos[pos_idx].en_passant_pp + 7] == PAWN)) {
+        add_one_step(pos[pos_idx].en_passant_pp + 7, pos[pos_idx].en_passant_pp);
+        steps[steps_count - 1].type = MoveType::EN_PASSANT;
+        steps[steps_count - 1].f2   = -PAWN;
+      }
+      if ((ChessEngine::column[pos[pos_idx].en_passant_pp] < 8) && 
+          (board[pos[pos_idx].en_passant_pp + 9] == PAWN)) {
+        add_one_step(pos[pos_idx].en_passant_pp + 9, pos[pos_idx].en_passant_pp);
+        steps[steps_count - 1].type = MoveType::EN_PASSANT;
+        steps[steps_count - 1].f2   = -PAWN;
+      }
+    } 
+    else {
+      if ((ChessEngine::column[pos[pos_idx].en_passant_pp] > 1) && 
+          (board[pos[pos_idx].en_passant_pp - 9] == -PAWN)) {
+        add_one_step(pos[pos_idx].en_passant_pp - 9, pos[pos_idx].en_passant_pp);
+        steps[steps_count - 1].type = MoveType::EN_PASSANT;
+        steps[steps_count - 1].f2   = PAWN;
+      }
+      if ((ChessEngine::column[pos[pos_idx].en_passant_pp] < 8) && 
+          (board[pos[pos_idx].en_passant_pp - 7] == -PAWN)) {
+        add_one_step(pos[pos_idx].en_passant_pp - 7, pos[pos_idx].en_passant_pp);
+        steps[steps_count - 1].type = MoveType::EN_PASSANT;
+        steps[steps_count - 1].f2   = PAWN;
+      }
+    }
+  }
+  //   task_execute+=micros()-task_tik;
+}
+
 void 
 ChessTask::add_one_step(int c1, int c2)
 {
@@ -436,6 +527,7 @@ ChessEngine::move_pos(int pos_idx, Step & step)
   pos[pos_idx + 1].black_castle_kingside_ok  = pos[pos_idx].black_castle_kingside_ok;
   pos[pos_idx + 1].black_castle_queenside_ok = pos[pos_idx].black_castle_queenside_ok;
   pos[pos_idx + 1].en_passant_pp = 0;
+  pos[pos_idx + 1].attacks_known = false;
 
   if (pos[pos_idx].white_move) { //
     if (pos[pos_idx].white_castle_kingside_ok || pos[pos_idx].white_castle_queenside_ok) {
@@ -460,20 +552,6 @@ ChessEngine::move_pos(int pos_idx, Step & step)
     if (step.type > MoveType::CASTLE_QUEENSIDE) {
       pos[pos_idx + 1].weight_white += fig_weight[(int)(step.type) - 2] - 100;
     }
-    
-    if (stats) {
-      if ((step.f1 == KING) && endgame) {
-        pos[pos_idx + 1].weight_both = pos[pos_idx].weight_both + 
-                                       stat_weight_white[KING][step.c2] - 
-                                       stat_weight_white[KING][step.c1];
-      }
-      else {
-        pos[pos_idx + 1].weight_both = pos[pos_idx].weight_both + 
-                                       stat_weight_white[step.f1 - 1][step.c2] - 
-                                       stat_weight_white[step.f1 - 1][step.c1];
-      }
-      if (step.f2 != NO_FIG) pos[pos_idx + 1].weight_both += stat_weight_black[-step.f2 - 1][step.c2];
-    }
   } 
   else { //
     if (pos[pos_idx].black_castle_kingside_ok || pos[pos_idx].black_castle_queenside_ok) {
@@ -496,25 +574,147 @@ ChessEngine::move_pos(int pos_idx, Step & step)
     if (step.type > MoveType::CASTLE_QUEENSIDE) {
       pos[pos_idx + 1].weight_black += fig_weight[(int)(step.type) - 2] - 100;
     }
-    
-    if (stats) {
-      if ((step.f1 == -KING) && endgame)
-        pos[pos_idx + 1].weight_both = pos[pos_idx].weight_both - 
-                                       stat_weight_black[KING][step.c2] + 
-                                       stat_weight_black[KING][step.c1];
-      else
-        pos[pos_idx + 1].weight_both = pos[pos_idx].weight_both - 
-                                       stat_weight_black[-step.f1 - 1][step.c2] + 
-                                       stat_weight_black[-step.f1 - 1][step.c1];
-      if (step.f2 != NO_FIG) {
-        pos[pos_idx + 1].weight_both -= stat_weight_white[step.f2 - 1][step.c2];
-      }
+  }
+
+  // Tapered evaluation terms. The board is already showing the new
+  // position: board[step.c2] is the promoted piece, if any.
+  if (stats) {
+    int8_t   moved    = board[step.c2];
+    int      mg       = pos[pos_idx].score_mg + pst_mg(moved, step.c2) - pst_mg(step.f1, step.c1);
+    int      eg       = pos[pos_idx].score_eg + pst_eg(moved, step.c2) - pst_eg(step.f1, step.c1);
+    int      phase    = pos[pos_idx].phase;
+    uint64_t pawn_key = pos[pos_idx].pawn_key;
+
+    if (abs(step.f1) == PAWN) {
+      pawn_key ^= zobrist_piece(step.f1, step.c1);
+      if (moved == step.f1) pawn_key ^= zobrist_piece(moved, step.c2);
+    }
+
+    // The pawn taken en passant (step.f2) is not on the destination square.
+    if (step.f2 != NO_FIG) {
+      int taken_idx = (step.type != MoveType::EN_PASSANT) ? step.c2 :
+                      (step.f1 > 0) ? step.c2 + 8 : step.c2 - 8;
+      mg    -= pst_mg(step.f2, taken_idx);
+      eg    -= pst_eg(step.f2, taken_idx);
+      phase -= phase_weight[abs(step.f2)];
+      if (abs(step.f2) == PAWN) pawn_key ^= zobrist_piece(step.f2, taken_idx);
+    }
+
+    switch (step.type) {
+      case MoveType::SIMPLE:
+      case MoveType::EN_PASSANT:
+        break;
+
+      case MoveType::CASTLE_KINGSIDE:
+      case MoveType::CASTLE_QUEENSIDE: {
+          int8_t rook = (step.f1 > 0) ? ROOK : -ROOK;
+          int    from = (step.type == MoveType::CASTLE_KINGSIDE) ? step.c1 + 3 : step.c1 - 4;
+          int    to   = (step.type == MoveType::CASTLE_KINGSIDE) ? step.c1 + 1 : step.c1 - 1;
+          mg += pst_mg(rook, to) - pst_mg(rook, from);
+          eg += pst_eg(rook, to) - pst_eg(rook, from);
+        }
+        break;
+
+      default: // Promotion
+        phase += phase_weight[abs(moved)];
+        break;
+    }
+
+    pos[pos_idx + 1].score_mg = mg;
+    pos[pos_idx + 1].score_eg = eg;
+    pos[pos_idx + 1].phase    = phase;
+    pos[pos_idx + 1].pawn_key = pawn_key;
+  }
+
+  // Network inputs changed by the step.
+  if (nnue_on) {
+    Nnue::Change added[2], removed[3];
+    int          added_count = 1, removed_count = 1;
+
+    added[0]   = { board[step.c2], step.c2 };
+    removed[0] = { step.f1,        step.c1 };
+
+    if (step.f2 != NO_FIG) {
+      int8_t taken_idx = (step.type != MoveType::EN_PASSANT) ? step.c2 :
+                         (step.f1 > 0) ? step.c2 + 8 : step.c2 - 8;
+      removed[removed_count++] = { step.f2, taken_idx };
+    }
+    if ((step.type == MoveType::CASTLE_KINGSIDE) || (step.type == MoveType::CASTLE_QUEENSIDE)) {
+      int8_t rook = (step.f1 > 0) ? ROOK : -ROOK;
+      bool   king = step.type == MoveType::CASTLE_KINGSIDE;
+      added[added_count++]     = { rook, (int8_t)(king ? step.c1 + 1 : step.c1 - 1) };
+      removed[removed_count++] = { rook, (int8_t)(king ? step.c1 + 3 : step.c1 - 4) };
     }
+
+    nnue.update(pos[pos_idx].accumulator, pos[pos_idx + 1].accumulator, added, added_count, removed, removed_count);
+  }
+
+  pos[pos_idx + 1].material = pos[pos_idx].material;
+  if (step.f2 != NO_FIG) pos[pos_idx + 1].material -= Endgames::piece_signature(step.f2, step.c2);
+  if (step.type > MoveType::CASTLE_QUEENSIDE) {
+    pos[pos_idx + 1].material += Endgames::piece_signature(board[step.c2], step.c2) - 
+                                 Endgames::piece_signature(step.f1, step.c1);
+  }
+
+  // Position key update. The board is already showing the new position:
+  // board[step.c2] is the promoted piece, if any.
+  uint64_t key = pos[pos_idx].key ^ zobrist_keys[ZOBRIST_TURN] ^ castle_key(pos_idx) ^ castle_key(pos_idx + 1);
+
+  if (pos[pos_idx    ].en_passant_pp != 0) key ^= zobrist_keys[ZOBRIST_EP + column[pos[pos_idx    ].en_passant_pp] - 1];
+  if (pos[pos_idx + 1].en_passant_pp != 0) key ^= zobrist_keys[ZOBRIST_EP + column[pos[pos_idx + 1].en_passant_pp] - 1];
+
+  key ^= zobrist_piece(step.f1, step.c1) ^ zobrist_piece(board[step.c2], step.c2);
+
+  switch (step.type) {
+    case MoveType::EN_PASSANT:
+      key ^= zobrist_piece(step.f2, pos[pos_idx].white_move ? step.c2 + 8 : step.c2 - 8);
+      break;
+    case MoveType::CASTLE_KINGSIDE:
+      key ^= pos[pos_idx].white_move ? (zobrist_piece( ROOK, 63) ^ zobrist_piece( ROOK, 61))
+                                     : (zobrist_piece(-ROOK,  7) ^ zobrist_piece(-ROOK,  5));
+      break;
+    case MoveType::CASTLE_QUEENSIDE:
+      key ^= pos[pos_idx].white_move ? (zobrist_piece( ROOK, 56) ^ zobrist_piece( ROOK, 59))
+                                     : (zobrist_piece(-ROOK,  0) ^ zobrist_piece(-ROOK,  3));
+      break;
+    default:
+      if (step.f2 != NO_FIG) key ^= zobrist_piece(step.f2, step.c2);
+      break;
   }
 
+  pos[pos_idx + 1].key      = key;
+  pos[pos_idx + 1].halfmove = ((abs(step.f1) == PAWN) || (step.f2 != NO_FIG)) ? 0 : pos[pos_idx].halfmove + 1;
+
   move_count++;
 }
 
+uint64_t
+ChessEngine::castle_key(int pos_idx)
+{
+  uint64_t key = 0;
+
+  if (pos[pos_idx].white_castle_kingside_ok ) key ^= zobrist_keys[ZOBRIST_CASTLE    ];
+  if (pos[pos_idx].white_castle_queenside_ok) key ^= zobrist_keys[ZOBRIST_CASTLE + 1];
+  if (pos[pos_idx].black_castle_kingside_ok ) key ^= zobrist_keys[ZOBRIST_CASTLE + 2];
+  if (pos[pos_idx].black_castle_queenside_ok) key ^= zobrist_keys[ZOBRIST_CASTLE + 3];
+
+  return key;
+}
+
+uint64_t
+ChessEngine::compute_key(int pos_idx)
+{
+  uint64_t key = castle_key(pos_idx);
+
+  for (int i = 0; i < 64; i++) {
+    if (board[i] != NO_FIG) key ^= zobrist_piece(board[i], i);
+  }
+  if (pos[pos_idx].en_passant_pp != 0) key ^= zobrist_keys[ZOBRIST_EP + column[pos[pos_idx].en_passant_pp] - 1];
+  if (pos[pos_idx].white_move) key ^= zobrist_keys[ZOBRIST_TURN];
+
+  return key;
+}
+
 void 
 ChessEngine::move_step(int pos_idx, Step & step)
 {
@@ -781,79 +981,111 @@ ChessEngine::add_diag_step(int pos_idx, int board_idx)
   }
 }
 
-#if 0
-void 
-ChessEngine::getbm(int move_idx, const Step & ep)
+static int 
+str_to_board_idx(const std::string & str, int idx)
 {
-  if (ep.type == MoveType::CASTLE_KINGSIDE) {
-    for (int i = 0; i < pos[0].steps_count; i++)
-      if (pos[0].steps[i].type == MoveType::CASTLE_KINGSIDE)   { //
-        best_move[move_idx] = pos[0].steps[i];
-        return;
-      }
-  } 
-  else if (ep.type == MoveType::CASTLE_QUEENSIDE) {
-    for (int i = 0; i < pos[0].steps_count; i++)
-      if (pos[0].steps[i].type == MoveType::CASTLE_QUEENSIDE)   { //
-        best_move[move_idx] = pos[0].steps[i];
-        return;
-      }
-  } 
-  else if (ep.find("=") != std::string::npos) { //
-    char fi = ep.at(ep.length() - 1);
-    MoveType type = MoveType::PROMOTE_TO_QUEEN;
-    if      (fi == 'N') type = MoveType::PROMOTE_TO_KNIGHT;
-    else if (fi == 'B') type = MoveType::PROMOTE_TO_BISHOP;
-    else if (fi == 'R') type = MoveType::PROMOTE_TO_ROOK;
-    for (int i = 0; i < pos[0].steps_count; i++) {
-      if (pos[0].steps[i].type == type) { //
-        best_move[move_idx] = pos[0].steps[i];
-        return;
-      }
-    }
-  } 
+  char col = str[idx];
+  char row = str[idx + 1];
+
+  if ((col < 'a') || (col > 'h') || (row < '1') || (row > '8')) return -1;
+  return (8 * (7 - (row - '1'))) + (col - 'a');
+}
+
+bool 
+ChessEngine::san_to_step(std::string san, Step & step)
+{
+  // Check, mate and annotation symbols are not needed to identify the move
+  while (!san.empty() && (std::strchr("+#!? ", san.back()) != nullptr)) san.pop_back();
+  if (san.empty()) return false;
+
+  MoveType type     = MoveType::SIMPLE;
+  int8_t   fig      = PAWN;
+  int      c2       = -1;
+  int      from_col = -1;
+  int      from_row = -1;
+
+  if ((san == "O-O") || (san == "0-0")) {
+    type = MoveType::CASTLE_KINGSIDE;
+  }
+  else if ((san == "O-O-O") || (san == "0-0-0")) {
+    type = MoveType::CASTLE_QUEENSIDE;
+  }
   else {
-    auto posp1 = ep.find("+");
-    auto posp2 = ep.find("#");
-    if ((posp1 != std::string::npos) || (posp2 != std::string::npos)) {
-      ep = ep.substr(0, ep.length() - 1);
-    }
-    char co = ep.at(ep.length() - 2);
-    char ro = ep.at(ep.length() - 1);
-    int  c2 = (8 * (7 - (ro - '1'))) + (co - 'a');
-    char fi = ep.at(0);
-    // int found=0;
-    for (int i = 0; i < pos[0].steps_count; i++) {
-      if (pos[0].steps[i].c2 == c2) {
-        if (fig_symb1[abs(pos[0].steps[i].f1)] == fi) {
-          if ((ep.length() == 3 ) || ((ep.length() == 4) && (ep.at(1) == 'x'))) {
-            best_move[move_idx] = pos[0].steps[i];
-            return;
-          } 
-          else if (int(ep.at(1)) - int('a') == column[pos[0].steps[i].c1] - 1) {
-            best_move[move_idx] = pos[0].steps[i];
-            return;
-          }
-        } 
-        else if (ep.length() == 2 && abs(pos[0].steps[i].f1) == PAWN) {
-          best_move[move_idx] = pos[0].steps[i];
-          return;
-        }
-        if (step_to_str(pos[0].steps[i]) == ep) {
-          best_move[move_idx] = pos[0].steps[i];
-        }
-        else {
-          std::string st = step_to_str(pos[0].steps[i]);
-          st = st.substr(0, 1) + st.substr(2);
-          if ((pos[0].steps[i].f2 != NO_FIG) && (ep.at(1) == 'x') && (st == ep)) {
-            best_move[move_idx] = pos[0].steps[i];
-          }
-        }
+    auto eq = san.find('=');
+    char pr = 0;
+    if (eq != std::string::npos) {
+      if (eq + 1 < san.length()) pr = san[eq + 1];
+      san = san.substr(0, eq);
+    }
+    else if ((san.length() > 2) && (std::strchr("NBRQ", san.back()) != nullptr) && 
+             ((san[san.length() - 2] == '8') || (san[san.length() - 2] == '1'))) {
+      pr = san.back();
+      san.pop_back();
+    }
+    switch (pr) {
+      case 'N': type = MoveType::PROMOTE_TO_KNIGHT; break;
+      case 'B': type = MoveType::PROMOTE_TO_BISHOP; break;
+      case 'R': type = MoveType::PROMOTE_TO_ROOK;   break;
+      case 'Q': type = MoveType::PROMOTE_TO_QUEEN;  break;
+      default:                                      break;
+    }
+
+    const char * p = std::strchr(fig_symb, san[0]);
+    if ((p != nullptr) && (san[0] != ' ')) {
+      fig = p - fig_symb;
+      san = san.substr(1);
+    }
+
+    std::string rest;
+    for (char ch : san) if ((ch != 'x') && (ch != '-') && (ch != ':')) rest += ch;
+    if (rest.length() < 2) return false;
+
+    c2 = str_to_board_idx(rest, rest.length() - 2);
+    if (c2 < 0) return false;
+
+    for (std::size_t i = 0; i < rest.length() - 2; i++) {
+      if      ((rest[i] >= 'a') && (rest[i] <= 'h')) from_col = rest[i] - 'a' + 1;
+      else if ((rest[i] >= '1') && (rest[i] <= '8')) from_row = rest[i] - '0';
+    }
+  }
+
+  generate_steps(0);
+
+  for (int i = 0; i < pos[0].steps_count; i++) {
+    Step & s = pos[0].steps[i];
+
+    if ((type == MoveType::CASTLE_KINGSIDE) || (type == MoveType::CASTLE_QUEENSIDE)) {
+      if (s.type != type) continue;
+    }
+    else {
+      if ((abs(s.f1) != fig) || (s.c2 != c2) || (s.type != type)) {
+        // En passant captures are written as simple pawn captures
+        if (!((s.type == MoveType::EN_PASSANT) && (type == MoveType::SIMPLE) && 
+              (abs(s.f1) == fig) && (s.c2 == c2))) continue;
       }
+      if ((from_col != -1) && (column[s.c1] != from_col)) continue;
+      if ((from_row != -1) && (   row[s.c1] != from_row)) continue;
+    }
+
+    move_step(0, s);
+    bool check = (pos[0].white_move) ? check_on_white_king() : check_on_black_king();
+    back_step(0, s);
+
+    if (!check) {
+      step = s;
+      return true;
     }
   }
+
+  return false;
+}
+
+bool 
+ChessEngine::getbm(int move_idx, const std::string & san)
+{
+  if ((move_idx < 0) || (move_idx >= MAXEPD)) return false;
+  return san_to_step(san, best_move[move_idx]);
 }
-#endif
 
 bool 
 ChessEngine::checkd_w()
@@ -958,9 +1190,22 @@ ChessEngine::generate_steps(int pos_idx)
   int8_t f;
 
   chess_engine_task.set_pos_idx(pos_idx);
-  TaskQueueData task_queue_data;
-  task_queue_data.req = TaskReq::EXEC;
-  QUEUE_SEND(task_queue, task_queue_data, 0);
+  if (!deterministic) {
+    TaskQueueData task_queue_data;
+    task_queue_data.req = TaskReq::EXEC;
+    QUEUE_SEND(task_queue, task_queue_data, 0);
+  }
+
+  // The steps of the pieces are counted for the evaluation: mobility,
+  // center, and the ones reaching the enemy king zone for the king safety.
+  int      king_idx  = (pos[pos_idx].white_move) ? idx_black_king : idx_white_king;
+  int      attackers = 0;
+  int      attack    = 0;
+  int      mob_mg    = 0;
+  int      mob_eg    = 0;
+  int      center    = 0;
+  uint32_t knights   = 0;
+  uint32_t bishops   = 0;
 
   for (int ii = 0; ii < 64; ii++) {
     int target_idx = (pos[pos_idx].white_move) ? ii : 63 - ii;
@@ -968,19 +1213,61 @@ ChessEngine::generate_steps(int pos_idx)
     if ((f == NO_FIG) || 
         (is_black_fig(f) &&  pos[pos_idx].white_move) || 
         (is_white_fig(f) && !pos[pos_idx].white_move)) continue;
+
+    int first = pos[pos_idx].steps_count;
+
     switch (abs(f)) {
       case KNIGHT:  add_knight_step(pos_idx, target_idx); break;
       case BISHOP:    add_diag_step(pos_idx, target_idx); break;
       case ROOK:      add_stra_step(pos_idx, target_idx); break;
       case QUEEN:     add_stra_step(pos_idx, target_idx); 
                       add_diag_step(pos_idx, target_idx); break;
-      case KING: if (endgame) add_king_step(pos_idx, target_idx); break;
+      case KING: if (endgame) add_king_step(pos_idx, target_idx); continue;
+      default:   continue;
+    }
+
+    if (stats) {
+      int fig  = abs(f);
+      int hits = 0;
+      int mob  = pos[pos_idx].steps_count - first - mobility_base[fig];
+
+      for (int i = first; i < pos[pos_idx].steps_count; i++) {
+        int c2 = pos[pos_idx].steps[i].c2;
+        if (in_king_zone(c2, king_idx)) hits++;
+        if ((c2 == 27) || (c2 == 28) || (c2 == 35) || (c2 == 36)) center++;
+      }
+      if (hits > 0) {
+        attackers++;
+        attack += hits * king_attack_weight[fig];
+      }
+      mob_mg += mob * mobility_mg[fig];
+      mob_eg += mob * mobility_eg[fig];
+
+      if (fig <= BISHOP) {
+        int bit = PawnTable::outpost_bit(target_idx, pos[pos_idx].white_move);
+        if (bit >= 0) {
+          if (fig == KNIGHT) knights |= 1UL << bit;
+          else               bishops |= 1UL << bit;
+        }
+      }
     }
   } //
+
+  pos[pos_idx].attacks_known  = stats;
+  pos[pos_idx].king_attackers = attackers;
+  pos[pos_idx].king_attack    = attack;
+  pos[pos_idx].mobility_mg    = mob_mg;
+  pos[pos_idx].mobility_eg    = mob_eg;
+  pos[pos_idx].center         = center;
+  pos[pos_idx].knight_squares = knights;
+  pos[pos_idx].bishop_squares = bishops;
   //int in=0;
 
-  EngineQueueData engine_queue_data;
-  QUEUE_RECEIVE(engine_queue, engine_queue_data, 5000 / portTICK_PERIOD_MS);
+  if (deterministic) chess_engine_task.generate();
+  else {
+    EngineQueueData engine_queue_data;
+    QUEUE_RECEIVE(engine_queue, engine_queue_data, 5000 / portTICK_PERIOD_MS);
+  }
 
   //if (in) count_in++;
   //count_all++;
@@ -1136,83 +1423,586 @@ ChessEngine::generate_steps(int pos_idx)
 int 
 ChessEngine::evaluate(int pos_idx)
 {
+  const Endgames::Entry & entry = endgames.probe(pos[pos_idx].material);
+
+  switch (entry.kind) {
+    case Endgames::Kind::NONE:      break;
+    case Endgames::Kind::DEAD_DRAW:
+    case Endgames::Kind::DRAW:      return 0;
+    case Endgames::Kind::KPK:       return evaluate_kpk(pos_idx);
+    case Endgames::Kind::MOP_UP:
+    case Endgames::Kind::KBNK:      return evaluate_mop_up(pos_idx, entry);
+  }
+
+  if (nnue_on) return nnue.evaluate(pos[pos_idx].accumulator, pos[pos_idx].white_move);
+
   if (!stats) {
     if (pos[pos_idx].white_move) return pos[pos_idx].weight_white - pos[pos_idx].weight_black;
     else return pos[pos_idx].weight_black - pos[pos_idx].weight_white;
   } 
   else {
-    if (pos[pos_idx].white_move) return 5000 * (pos[pos_idx].weight_white - pos[pos_idx].weight_black + pos[pos_idx].weight_both) / (pos[pos_idx].weight_white + pos[pos_idx].weight_black + 2000);
-    else return 5000 * (pos[pos_idx].weight_black - pos[pos_idx].weight_white - pos[pos_idx].weight_both) / (pos[pos_idx].weight_white + pos[pos_idx].weight_black + 2000);
+    // Middle game and endgame scores blended by the game phase. The scale
+    // goes from MG_SCALE to EG_SCALE as the pieces are traded, for the side
+    // ahead in material to trade down.
+    PawnTable::Scores pawns;
+    bool              pawns_known = false;
+    int               mg, eg;
+
+    if (!eval_cache.probe(pos[pos_idx].key, mg, eg)) {
+      pawn_table.probe(pos[pos_idx].pawn_key, board, pawns);
+      pawns_known = true;
+
+      int material = pos[pos_idx].weight_white - pos[pos_idx].weight_black;
+      mg = material + pos[pos_idx].score_mg + pawns.mg + evaluate_king_shelter(pawns);
+      eg = material + pos[pos_idx].score_eg + pawns.eg;
+      eval_cache.store(pos[pos_idx].key, mg, eg);
+    }
+
+    const Position * white_info;
+    const Position * black_info;
+
+    if (steps_terms(pos_idx, white_info, black_info)) {
+      if (!pawns_known) pawn_table.probe(pos[pos_idx].pawn_key, board, pawns);
+      evaluate_activity(pawns, *white_info, *black_info, mg, eg);
+    }
+
+    int phase = std::min((int) pos[pos_idx].phase, PHASE_MAX);
+    int score = (mg * phase * MG_SCALE + eg * (PHASE_MAX - phase) * EG_SCALE) >> (PHASE_SHIFT + SCALE_SHIFT);
+
+    return pos[pos_idx].white_move ? score : -score;
   }
 }
 
-void 
-ChessEngine::kingpositions()
+// The positions holding the step counts of generate_steps() for each side.
+// The steps of the side to move are those of this position when generated,
+// or else of two plies before; the steps of the other side are those of the
+// previous ply. Returns false if the counts of a side are not known: the
+// terms using them are then left out for both sides.
+bool
+ChessEngine::steps_terms(int pos_idx, const Position * & white_info, const Position * & black_info)
 {
-  for (int i = 0; i < 64; i++) {
-    if (board[i] ==  KING) idx_white_king = i;
-    if (board[i] == -KING) idx_black_king = i;
+  white_info = black_info = nullptr;
+
+  for (int i = pos_idx; (i >= 0) && (i >= pos_idx - 2); i--) {
+    if (!pos[i].attacks_known) continue;
+    if (pos[i].white_move) { if (white_info == nullptr) white_info = &pos[i]; }
+    else if (black_info == nullptr) black_info = &pos[i];
   }
+
+  return (white_info != nullptr) && (black_info != nullptr);
 }
 
-std::string 
-ChessEngine::get_time(long time)
+// Piece activity, white minus black: mobility, center control, outposts
+// and the danger from the pieces reaching the enemy king zone (middle game).
+void
+ChessEngine::evaluate_activity(const PawnTable::Scores & pawns, const Position & white_info, 
+                               const Position & black_info, int & mg, int & eg)
 {
-  std::ostringstream stream;
+  int on_black = std::min(white_info.king_attack * white_info.king_attack / 4, KING_DANGER_MAX);
+  int on_white = std::min(black_info.king_attack * black_info.king_attack / 4, KING_DANGER_MAX);
+
+  mg += on_black * attackers_percent[std::min<int>(white_info.king_attackers, 7)] / 100 -
+        on_white * attackers_percent[std::min<int>(black_info.king_attackers, 7)] / 100;
+
+  int white_knights = __builtin_popcount(white_info.knight_squares & pawns.white_outposts);
+  int black_knights = __builtin_popcount(black_info.knight_squares & pawns.black_outposts);
+  int white_bishops = __builtin_popcount(white_info.bishop_squares & pawns.white_outposts);
+  int black_bishops = __builtin_popcount(black_info.bishop_squares & pawns.black_outposts);
+
+  mg += white_info.mobility_mg - black_info.mobility_mg + 
+        (white_info.center - black_info.center) * CENTER_MG +
+        (white_knights - black_knights) * KNIGHT_OUTPOST_MG +
+        (white_bishops - black_bishops) * BISHOP_OUTPOST_MG;
+  eg += white_info.mobility_eg - black_info.mobility_eg + 
+        (white_knights - black_knights) * KNIGHT_OUTPOST_EG +
+        (white_bishops - black_bishops) * BISHOP_OUTPOST_EG;
+}
 
-  stream.fill('0'); stream.width(2);
+// Middle game king shelter, white minus black: the pawn shield and the
+// open files around each king. The attacks on the king zone are part of
+// evaluate_activity().
+int
+ChessEngine::evaluate_king_shelter(const PawnTable::Scores & pawns)
+{
+  if ((board[idx_white_king] != KING) || (board[idx_black_king] != -KING)) return 0;
 
-  if (time > 360000) time = 0;
-  stream <<  time / 3600        << ':' 
-         << (time % 3600) / 60 << ':' 
-         <<  time % 60;
+  int score = 0;
 
-  return stream.str();
-}
+  for (int side = 0; side < 2; side++) {
+    int     king_idx = (side == 0) ? idx_white_king : idx_black_king;
+    int8_t  pawn     = (side == 0) ? PAWN : -PAWN;
+    int     ahead    = (side == 0) ? -8 : 8;
+    uint8_t own      = (side == 0) ? pawns.white_files : pawns.black_files;
+    uint8_t enemy    = (side == 0) ? pawns.black_files : pawns.white_files;
+    bool    home     = (side == 0) ? (row[king_idx] <= 2) : (row[king_idx] >= 7);
+    int     safety   = 0;
 
-bool 
-ChessEngine::draw_repeat(int pos_idx)
-{
-  if (pos_idx <= 12 || zero) return 0;
-  for (int i = 0; i < 4; i++) {
-    int li = pos_idx - i;
-    if (pos[li].steps[pos[li].cur_step].c1 != pos[li - 4].steps[pos[li - 4].cur_step].c1 ||
-        pos[li].steps[pos[li].cur_step].c1 != pos[li - 8].steps[pos[li - 8].cur_step].c1 ||
-        pos[li].steps[pos[li].cur_step].c2 != pos[li - 4].steps[pos[li - 4].cur_step].c2 ||
-        pos[li].steps[pos[li].cur_step].c2 != pos[li - 8].steps[pos[li - 8].cur_step].c2) return false;
+    for (int f = std::max(1, column[king_idx] - 1); f <= std::min(8, column[king_idx] + 1); f++) {
+      int idx = king_idx + (f - column[king_idx]);
+
+      if (home) {
+        if      (board[idx + ahead]     == pawn) safety += SHIELD_NEAR;
+        else if (board[idx + 2 * ahead] == pawn) safety += SHIELD_FAR;
+      }
+      if ((own & (1 << (f - 1))) == 0) {
+        safety += KING_SEMI_OPEN_FILE;
+        if ((enemy & (1 << (f - 1))) == 0) safety += KING_OPEN_FILE;
+      }
+    }
+
+    score += (side == 0) ? safety : -safety;
   }
-  if (TRACE > 0) std::cout << "repeat!" << std::endl;
-  return true;
+
+  return score;
 }
 
-bool 
-ChessEngine::is_draw()
+// King and pawn against king, from the KPK bitbase: a draw, or a win
+// getting better as the pawn advances.
+int
+ChessEngine::evaluate_kpk(int pos_idx)
 {
-  bool draw = false;
-  int cn = 0, cbw = 0, cbb = 0, co = 0, cb = 0, cw = 0;
-  
-  for (int board_idx = 0; board_idx < 64; board_idx++) {
+  int wk = 0, bk = 0, pawn = 0;
 
-    if (abs(board[board_idx]) == PAWN) co++;
-    if (abs(board[board_idx]) > BISHOP && abs(board[board_idx]) < KING) co++;
-    if (abs(board[board_idx]) == KING) continue;
-    if (abs(board[board_idx]) == KNIGHT) cn++;
-    if (abs(board[board_idx]) == BISHOP && (column[board_idx] + row[board_idx]) % 2 == 0) cbb++;
-    if (abs(board[board_idx]) == BISHOP && (column[board_idx] + row[board_idx]) % 2 == 1) cbw++;
-
-    if (board[board_idx] ==  BISHOP) cw++;
-    if (board[board_idx] == -BISHOP) cb++;
+  for (int i = 0; i < 64; i++) {
+    if      (board[i] ==  KING) wk   = i;
+    else if (board[i] == -KING) bk   = i;
+    else if (board[i] != NO_FIG) pawn = i;
   }
 
-  if (cn == 1 && co + cbb + cbw == 0) draw = true;
-  if (cbb + cbw == 1 && co + cn == 0) draw = true;
-  if (co + cn + cbb == 0 || co + cn + cbw == 0) draw = true;
-  if (co + cn == 0 && cb == 1 && cw == 1) draw = true;
+  // The bitbase squares are numbered from a1, with the pawn side as white.
+  bool white_pawn  = board[pawn] > 0;
+  bool strong_move = (pos[pos_idx].white_move == white_pawn);
+  int  score;
+
+  if (white_pawn) {
+    score = kpk_bitbase.probe(wk ^ 56, pawn ^ 56, bk ^ 56, strong_move) ? KPK_WIN_SCORE + 10 * (row[pawn] - 2) : 0;
+  }
+  else {
+    score = kpk_bitbase.probe(bk, pawn, wk, strong_move) ? KPK_WIN_SCORE + 10 * (7 - row[pawn]) : 0;
+  }
 
-  return draw;
+  return strong_move ? score : -score;
 }
 
-int 
+// A lone king to be mated: the material, plus the weak king pushed to the
+// edge (to a corner of the bishop color in KBNK) and the kings brought
+// closer together.
+int
+ChessEngine::evaluate_mop_up(int pos_idx, const Endgames::Entry & entry)
+{
+  int strong_king = entry.white_strong ? idx_white_king : idx_black_king;
+  int weak_king   = entry.white_strong ? idx_black_king : idx_white_king;
+  int score       = MOP_UP_SCORE + abs(pos[pos_idx].weight_white - pos[pos_idx].weight_black);
+
+  int distance = std::max(abs(column[strong_king] - column[weak_king]), abs(row[strong_king] - row[weak_king]));
+  score += 10 * (7 - distance);
+
+  if (entry.kind == Endgames::Kind::KBNK) {
+    // a8 and h1 are light squares, h8 and a1 dark ones
+    bool light = Endgames::count(pos[pos_idx].material, entry.white_strong ? BISHOP : -BISHOP, 0) > 0;
+    int  c1    = light ? 0 : 7, c2 = light ? 63 : 56;
+    int  d1    = abs(column[weak_king] - column[c1]) + abs(row[weak_king] - row[c1]);
+    int  d2    = abs(column[weak_king] - column[c2]) + abs(row[weak_king] - row[c2]);
+    score += 20 * (14 - std::min(d1, d2));
+  }
+  else {
+    int col = column[weak_king], rw = row[weak_king];
+    score += 15 * (std::max(4 - col, col - 5) + std::max(4 - rw, rw - 5));
+  }
+
+  return (pos[pos_idx].white_move == entry.white_strong) ? score : -score;
+}
+
+void 
+ChessEngine::kingpositions()
+{
+  for (int i = 0; i < 64; i++) {
+    if (board[i] ==  KING) idx_white_king = i;
+    if (board[i] == -KING) idx_black_king = i;
+  }
+}
+
+std::string 
+ChessEngine::get_time(long time)
+{
+  std::ostringstream stream;
+
+  stream.fill('0'); stream.width(2);
+
+  if (time > 360000) time = 0;
+  stream <<  time / 3600        << ':' 
+         << (time % 3600) / 60 << ':' 
+         <<  time % 60;
+
+  return stream.str();
+}
+
+// Random offset of a root move, stable for the whole search.
+int
+ChessEngine::root_noise(const Step & step)
+{
+  uint32_t h = (noise_seed ^ ((step.c1 << 8) | step.c2)) * 2654435761U;
+  h ^= h >> 16;
+  return (int)(h % (2 * skill_noise + 1)) - skill_noise;
+}
+
+// A position is a draw when it already occurred after the root position, or
+// twice in the game. Only the positions since the last capture or pawn move
+// (halfmove clock) are looked at, every two plies. Negative indexes are the
+// game positions preceding the root, kept in the history.
+bool 
+ChessEngine::is_repetition(int pos_idx)
+{
+  uint64_t key   = pos[pos_idx].key;
+  int      first = pos_idx - pos[pos_idx].halfmove;
+  int      count = 0;
+
+  int oldest = -((history_count < HISTORY_SIZE) ? history_count : HISTORY_SIZE);
+  if (first < oldest) first = oldest;
+
+  for (int i = pos_idx - 4; i >= first; i -= 2) {
+    if (i > 0) {
+      if (pos[i].key == key) return true;
+    }
+    else {
+      uint64_t k = (i == 0) ? pos[0].key : history[(history_count + i) & (HISTORY_SIZE - 1)];
+      if ((k == key) && (++count >= 2)) return true;
+    }
+  }
+
+  return false;
+}
+
+// The fifty-move rule does not apply when the move reaching the hundredth
+// ply mates.
+bool
+ChessEngine::is_draw_by_rule()
+{
+  if (pos[0].halfmove >= 100) {
+    bool check = (pos[0].white_move) ? check_on_white_king() : check_on_black_king();
+    return !check || !is_checkmate();
+  }
+
+  uint64_t key   = pos[0].key;
+  int      count = 0;
+  int      first = -pos[0].halfmove;
+
+  int oldest = -((history_count < HISTORY_SIZE) ? history_count : HISTORY_SIZE);
+  if (first < oldest) first = oldest;
+
+  for (int i = -2; i >= first; i -= 2) {
+    if ((history[(history_count + i) & (HISTORY_SIZE - 1)] == key) && (++count >= 2)) return true;
+  }
+
+  return false;
+}
+
+// No checkmate is possible with the material of the root position (see
+// endgames).
+bool 
+ChessEngine::is_draw()
+{
+  return endgames.probe(pos[0].material).kind == Endgames::Kind::DEAD_DRAW;
+}
+
+int
+ChessEngine::piece_count()
+{
+  int count = 0;
+  for (int i = 0; i < 64; i++) if (board[i] != NO_FIG) count++;
+  return count;
+}
+
+// The castling flags are only cleared when the king or the rook moves: a
+// captured rook leaves its flag set.
+bool
+ChessEngine::castling_possible(int pos_idx)
+{
+  return (pos[pos_idx].white_castle_kingside_ok  && (board[60] ==  KING) && (board[63] ==  ROOK)) ||
+         (pos[pos_idx].white_castle_queenside_ok && (board[60] ==  KING) && (board[56] ==  ROOK)) ||
+         (pos[pos_idx].black_castle_kingside_ok  && (board[ 4] == -KING) && (board[ 7] == -ROOK)) ||
+         (pos[pos_idx].black_castle_queenside_ok && (board[ 4] == -KING) && (board[ 0] == -ROOK));
+}
+
+// The steps of the position must be generated.
+bool
+ChessEngine::has_legal_step(int pos_idx)
+{
+  for (int i = 0; i < pos[pos_idx].steps_count; i++) {
+    move_step(pos_idx, pos[pos_idx].steps[i]);
+    bool check = (pos[pos_idx].white_move) ? check_on_white_king() : check_on_black_king();
+    back_step(pos_idx, pos[pos_idx].steps[i]);
+    if (!check) return true;
+  }
+  return false;
+}
+
+static inline int
+dtz_before_zeroing(int wdl)
+{
+  return (wdl == 2) ? 1 : (wdl == 1) ? 101 : (wdl == -1) ? -101 : (wdl == -2) ? -1 : 0;
+}
+
+// WDL value (-2 .. 2) of the position at pos_idx, the steps of which must be
+// generated. The tables do not hold the right value when the best move is a
+// capture (en passant positions are not in the tables at all): the captures
+// are searched first, and the pawn moves too if check_zeroing is set. The
+// result is ZEROING_BEST_MOVE when one of them is the best move.
+int
+ChessEngine::tb_search(int pos_idx, bool check_zeroing, SyzygyTB::Probe & result)
+{
+  int best_value  = -2;
+  int value;
+  int legal_count = 0;
+  int step_count  = 0;
+
+  for (int i = 0; i < pos[pos_idx].steps_count; i++) {
+    Step & step = pos[pos_idx].steps[i];
+
+    move_step(pos_idx, step);
+    bool check = (pos[pos_idx].white_move) ? check_on_white_king() : check_on_black_king();
+    if (check) {
+      back_step(pos_idx, step);
+      continue;
+    }
+    legal_count++;
+
+    if ((step.f2 == NO_FIG) && (!check_zeroing || (abs(step.f1) != PAWN))) {
+      back_step(pos_idx, step);
+      continue;
+    }
+    step_count++;
+
+    pos[pos_idx].cur_step = i;
+    move_pos(pos_idx, step);
+    generate_steps(pos_idx + 1);
+    value = -tb_search(pos_idx + 1, false, result);
+    back_step(pos_idx, step);
+
+    if (result == SyzygyTB::Probe::FAIL) return 0;
+
+    if (value > best_value) {
+      best_value = value;
+      if (value >= 2) {
+        result = SyzygyTB::Probe::ZEROING_BEST_MOVE;
+        return value;
+      }
+    }
+  }
+
+  // When all the legal moves were searched, the table value is of no use.
+  // It could even be wrong, for positions with en passant.
+  bool no_more_moves = (step_count > 0) && (step_count == legal_count);
+
+  if (no_more_moves) value = best_value;
+  else {
+    value = syzygy.probe_wdl(board, pos[pos_idx].white_move, result);
+    if (result == SyzygyTB::Probe::FAIL) return 0;
+  }
+
+  if (best_value >= value) {
+    result = ((best_value > 0) || no_more_moves) ? SyzygyTB::Probe::ZEROING_BEST_MOVE : SyzygyTB::Probe::OK;
+    return best_value;
+  }
+
+  result = SyzygyTB::Probe::OK;
+  return value;
+}
+
+// Distance to zeroing (plies) of the position at pos_idx, the steps of which
+// must be generated. Positive when winning, above 100 for a cursed win.
+int
+ChessEngine::tb_probe_dtz(int pos_idx, SyzygyTB::Probe & result)
+{
+  int wdl = tb_search(pos_idx, true, result);
+
+  if ((result == SyzygyTB::Probe::FAIL) || (wdl == 0)) return 0;
+  if (result == SyzygyTB::Probe::ZEROING_BEST_MOVE) return dtz_before_zeroing(wdl);
+
+  int dtz = syzygy.probe_dtz(board, pos[pos_idx].white_move, wdl, result);
+  if (result == SyzygyTB::Probe::FAIL) return 0;
+
+  if (result != SyzygyTB::Probe::CHANGE_STM) {
+    return (dtz + (((wdl == 1) || (wdl == -1)) ? 100 : 0)) * ((wdl > 0) ? 1 : -1);
+  }
+
+  // The table holds the other side to move: one more ply is searched, for
+  // the winning move with the smallest distance.
+  int min_dtz = 0xFFFF;
+
+  for (int i = 0; i < pos[pos_idx].steps_count; i++) {
+    Step & step = pos[pos_idx].steps[i];
+
+    move_step(pos_idx, step);
+    bool check = (pos[pos_idx].white_move) ? check_on_white_king() : check_on_black_king();
+    if (check) {
+      back_step(pos_idx, step);
+      continue;
+    }
+
+    bool zeroing = (step.f2 != NO_FIG) || (abs(step.f1) == PAWN);
+
+    pos[pos_idx].cur_step = i;
+    move_pos(pos_idx, step);
+    generate_steps(pos_idx + 1);
+
+    // For zeroing moves, the distance is the one of the move itself.
+    dtz = zeroing ? -dtz_before_zeroing(tb_search(pos_idx + 1, false, result))
+                  : -tb_probe_dtz(pos_idx + 1, result);
+
+    if ((dtz == 1) && pos[pos_idx + 1].check_on_table && !has_legal_step(pos_idx + 1)) min_dtz = 1;
+    if (!zeroing) dtz += (dtz > 0) ? 1 : ((dtz < 0) ? -1 : 0);
+    if ((dtz < min_dtz) && (dtz != 0) && ((dtz > 0) == (wdl > 0))) min_dtz = dtz;
+
+    back_step(pos_idx, step);
+
+    if (result == SyzygyTB::Probe::FAIL) return 0;
+  }
+
+  return (min_dtz == 0xFFFF) ? -1 : min_dtz;
+}
+
+// Score of the position at pos_idx, the steps of which are generated, from
+// the tablebases or the bitbases. Only done after a capture or a pawn move:
+// in between, the search has to make progress by itself.
+bool
+ChessEngine::probe_endgame(int pos_idx, int & score)
+{
+  if (((tb_pieces == 0) && (bitbases.size() == 0)) || 
+      (pos_idx >= MAXDEPTH - SyzygyTB::MAX_PIECES - 2) || 
+      castling_possible(pos_idx)) return false;
+
+  int count = piece_count();
+  int wdl;
+
+  if (count <= tb_pieces) {
+    SyzygyTB::Probe result = SyzygyTB::Probe::OK;
+    wdl = tb_search(pos_idx, false, result);
+    if (result != SyzygyTB::Probe::FAIL) {
+      tb_hits++;
+      score = (wdl > 1) ? (TB_WIN_SCORE - pos_idx) : ((wdl < -1) ? (-TB_WIN_SCORE + pos_idx) : wdl);
+      return true;
+    }
+  }
+
+  if ((count <= Bitbases::MAX_PIECES) && 
+      (pos[pos_idx].en_passant_pp == 0) && 
+      bitbases.probe(board, pos[pos_idx].white_move, wdl)) {
+    tb_hits++;
+    score = (wdl > 0) ? (TB_WIN_SCORE - pos_idx) : ((wdl < 0) ? (-TB_WIN_SCORE + pos_idx) : 0);
+    return true;
+  }
+
+  return false;
+}
+
+// Keeps the root steps with the best bitbase result. The search then picks
+// the one making progress.
+void
+ChessEngine::bb_root_filter()
+{
+  if ((bitbases.size() == 0) || (piece_count() > Bitbases::MAX_PIECES) || castling_possible(0)) return;
+
+  int wdl[MAXSTEPS];
+  int best = -2;
+
+  for (int i = 0; i < pos[0].steps_count; i++) {
+    Step & step = pos[0].steps[i];
+
+    move_step(0, step);
+    move_pos(0, step);
+    bool found = (pos[1].en_passant_pp == 0) && bitbases.probe(board, pos[1].white_move, wdl[i]);
+    back_step(0, step);
+
+    if (!found) return;
+
+    wdl[i] = -wdl[i];
+    if (wdl[i] > best) best = wdl[i];
+  }
+
+  tb_hits++;
+
+  int count = 0;
+  for (int i = 0; i < pos[0].steps_count; i++) {
+    if (wdl[i] == best) pos[0].steps[count++] = pos[0].steps[i];
+  }
+  pos[0].steps_count = count;
+}
+
+// Ranks the legal root steps with the DTZ tables. A won position is played
+// with the step that zeroes the fifty moves counter the soonest, a lost one
+// with the step that delays it the most: true is returned with the step in
+// pos[0].best. Otherwise, only the steps keeping the best result are left
+// to the search.
+bool
+ChessEngine::tb_root_probe()
+{
+  if ((tb_pieces == 0) || castling_possible(0) || (piece_count() > tb_pieces)) return false;
+
+  SyzygyTB::Probe result = SyzygyTB::Probe::OK;
+
+  int dtz[MAXSTEPS];
+  int rank[MAXSTEPS];
+  int best_rank = -3;
+  int halfmove  = pos[0].halfmove;
+
+  for (int i = 0; i < pos[0].steps_count; i++) {
+    Step & step = pos[0].steps[i];
+
+    pos[0].cur_step = i;
+    move_step(0, step);
+    move_pos(0, step);
+    generate_steps(1);
+
+    if (pos[1].halfmove == 0) dtz[i] = dtz_before_zeroing(-tb_search(1, false, result));
+    else if (is_repetition(1)) dtz[i] = 0;
+    else {
+      dtz[i] = -tb_probe_dtz(1, result);
+      dtz[i] += (dtz[i] > 0) ? 1 : ((dtz[i] < 0) ? -1 : 0);
+    }
+
+    if (pos[1].check_on_table && (dtz[i] == 2) && !has_legal_step(1)) dtz[i] = 1;
+
+    back_step(0, step);
+
+    if (result == SyzygyTB::Probe::FAIL) return false;
+
+    // Wins and losses beyond the fifty moves rule are cursed and blessed.
+    if      (dtz[i] > 0) rank[i] = (dtz[i] + halfmove <= 99) ?  2 :  1;
+    else if (dtz[i] < 0) rank[i] = (halfmove - dtz[i] <= 99) ? -2 : -1;
+    else                 rank[i] = 0;
+
+    if (rank[i] > best_rank) best_rank = rank[i];
+  }
+
+  tb_hits++;
+
+  if ((best_rank == 2) || (best_rank == -2)) {
+    int best = -1;
+    for (int i = 0; i < pos[0].steps_count; i++) {
+      if (rank[i] != best_rank) continue;
+      if ((best == -1) || (dtz[i] < dtz[best])) best = i;
+    }
+
+    pos[0].best        = pos[0].steps[best];
+    pos[0].best.weight = (best_rank > 0) ? TB_WIN_SCORE : -TB_WIN_SCORE;
+    pv[0][0]           = pos[0].best;
+    pv_length[0]       = 1;
+    depth              = 0;
+    print_best(1);
+    return true;
+  }
+
+  int count = 0;
+  for (int i = 0; i < pos[0].steps_count; i++) {
+    if (rank[i] == best_rank) pos[0].steps[count++] = pos[0].steps[i];
+  }
+  pos[0].steps_count = count;
+
+  return false;
+}
+
+int 
 ChessEngine::active(Step & step)
 {
   int j;
@@ -1278,6 +2068,8 @@ ChessEngine::active(Step & step)
 int 
 ChessEngine::quiescence(int pos_idx, int alpha, int beta, int depth_left)
 {
+  pv_length[pos_idx] = pos_idx;
+
   if (depth_left <= 0) {
     if (pos_idx > depth) depth = pos_idx;
     return evaluate(pos_idx);
@@ -1326,7 +2118,6 @@ ChessEngine::quiescence(int pos_idx, int alpha, int beta, int depth_left)
     move_pos(pos_idx, pos[pos_idx].steps[i]);
     int tmp = -quiescence(pos_idx + 1, -beta, -alpha, depth_left - 1);
     back_step(pos_idx, pos[pos_idx].steps[i]);
-    if (draw_repeat(pos_idx)) tmp = 0;
     if (tmp > score) score = tmp;
     if (score > alpha) {
       alpha = score;
@@ -1349,12 +2140,33 @@ int
 ChessEngine::alpha_beta(int pos_idx, int alpha, int beta, int depth_left)
 {
   int score = -20000, check, ext, tmp;
+  pv_length[pos_idx] = pos_idx;
+  if ((pos_idx > 0) && (pos[pos_idx].halfmove >= 4) && is_repetition(pos_idx)) {
+    TRACE_EVENT(PRUNE, pos_idx, -1, -1, 0, depth_left, REPETITION);
+    return 0;
+  }
+  if ((pos_idx > 0) && (pos[pos_idx].halfmove >= 100)) {
+    // Fifty-move rule, unless the last move mates
+    generate_steps(pos_idx);
+    if (pos[pos_idx].check_on_table && !has_legal_step(pos_idx)) {
+      pos[pos_idx - 1].steps[pos[pos_idx - 1].cur_step].check = CheckType::CHECKMATE;
+      return -10000 + pos_idx;
+    }
+    TRACE_EVENT(PRUNE, pos_idx, -1, -1, 0, depth_left, REPETITION);
+    return 0;
+  }
+  if (pos_idx > 0) {
+    Endgames::Kind kind = endgames.probe(pos[pos_idx].material).kind;
+    if ((kind == Endgames::Kind::DEAD_DRAW) || ((kind == Endgames::Kind::KPK) && (evaluate_kpk(pos_idx) == 0))) return 0;
+  }
   if (depth_left <= 0) {
     int fd = fdepth; //4-6-8
     if ((pos_idx > 0) && pos[pos_idx - 1].steps[pos[pos_idx - 1].cur_step].f2 != NO_FIG) fd += 2;
     return quiescence(pos_idx, alpha, beta, fd);
   }
+  TRACE_EVENT(ENTER, pos_idx, -1, -1, alpha, depth_left, NONE);
   if (pos_idx > 0) generate_steps(pos_idx);
+  if ((pos_idx > 0) && (pos[pos_idx].halfmove == 0) && probe_endgame(pos_idx, tmp)) return tmp;
   if ((pos_idx >= null_depth) && !zero && (depth_left > 2)) {//2
     if ((pos_idx > 0) && !pos[pos_idx].check_on_table && (pos[pos_idx - 1].steps[pos[pos_idx - 1].cur_step].f2 == NO_FIG))  {
       zero = true;
@@ -1364,15 +2176,29 @@ ChessEngine::alpha_beta(int pos_idx, int alpha, int beta, int depth_left)
       pos[pos_idx + 1].black_castle_queenside_ok = pos[pos_idx].black_castle_queenside_ok;
       pos[pos_idx + 1].weight_white              = pos[pos_idx].weight_white;
       pos[pos_idx + 1].weight_black              = pos[pos_idx].weight_black;
-      pos[pos_idx + 1].weight_both               = pos[pos_idx].weight_both;
+      pos[pos_idx + 1].score_mg                  = pos[pos_idx].score_mg;
+      pos[pos_idx + 1].score_eg                  = pos[pos_idx].score_eg;
+      pos[pos_idx + 1].phase                     = pos[pos_idx].phase;
+      pos[pos_idx + 1].pawn_key                  = pos[pos_idx].pawn_key;
+      pos[pos_idx + 1].material                  = pos[pos_idx].material;
       pos[pos_idx + 1].en_passant_pp             = 0;
+      pos[pos_idx + 1].attacks_known             = false;
+      if (nnue_on) pos[pos_idx + 1].accumulator  = pos[pos_idx].accumulator;
+
+      // No repetition can be found through a null move
+      pos[pos_idx + 1].key      = pos[pos_idx].key ^ zobrist_keys[ZOBRIST_TURN];
+      pos[pos_idx + 1].halfmove = 0;
+      if (pos[pos_idx].en_passant_pp != 0) pos[pos_idx + 1].key ^= zobrist_keys[ZOBRIST_EP + column[pos[pos_idx].en_passant_pp] - 1];
 
       pos[pos_idx].cur_step           = MAXSTEPS;
       pos[pos_idx].steps[MAXSTEPS].f2 = NO_FIG;
 
       int tmpz = -alpha_beta(pos_idx + 1, -beta, -beta + 1, depth_left - 3);
       zero = false;
-      if (tmpz >= beta) return beta;
+      if (tmpz >= beta) {
+        TRACE_EVENT(PRUNE, pos_idx, -1, -1, tmpz, depth_left, NULL_MOVE);
+        return beta;
+      }
     }
   }
   if ((pos_idx > 4)                && 
@@ -1382,7 +2208,10 @@ ChessEngine::alpha_beta(int pos_idx, int alpha, int beta, int depth_left)
       !pos[pos_idx].check_on_table && 
       (pos[pos_idx - 1].steps[pos[pos_idx - 1].cur_step].f2 == 0)) { //futility pruning
     int weight = evaluate(pos_idx);
-    if (weight - 200 >= beta) return beta;
+    if (weight - 200 >= beta) {
+      TRACE_EVENT(PRUNE, pos_idx, -1, -1, weight, depth_left, FUTILITY);
+      return beta;
+    }
   }
   for (int i = 0; i < pos[pos_idx].steps_count; i++) {
     ext = 0;
@@ -1403,17 +2232,7 @@ ChessEngine::alpha_beta(int pos_idx, int alpha, int beta, int depth_left)
     pos[pos_idx].cur_step = i;
     move_pos(pos_idx, pos[pos_idx].steps[i]);
 
-    if (TRACE > 0) {
-      if (pos_idx == 0) {
-        std::cout << step_to_str(pos[0].steps[i]) << "  " << i + 1 << '/' << pos[0].steps_count;
-        //if (pos[0].steps[i].weight<-9000) { Serial.println(F(" checkmate")); continue; }
-      } 
-      else if (TRACE > pos_idx) {
-        std::cout << std::endl;
-        for (int ll = 0; ll < pos_idx; ll++) std::cout << "      ";
-        std::cout << pos_idx + 1 << "- " << step_to_str(pos[pos_idx].steps[i]);
-      }
-    } //TRACE
+    TRACE_EVENT(MOVE, pos_idx, pos[pos_idx].steps[i].c1, pos[pos_idx].steps[i].c2, i, depth_left, NONE);
 
     if ((pos_idx > 2) && !lazy && !zero && lazy_eval && pos[pos_idx].steps[i].f2 != NO_FIG && 
         (pos[0].steps[pos[0].cur_step].check == CheckType::NONE) && 
@@ -1421,7 +2240,10 @@ ChessEngine::alpha_beta(int pos_idx, int alpha, int beta, int depth_left)
         (( pos[pos_idx].white_move && !check_on_black_king()) ||
          (!pos[pos_idx].white_move && !check_on_white_king()))) {
       lazy = true;
-      if (-alpha_beta(pos_idx + 1, -beta, -alpha, depth_left - 3) <= alpha) tmp = alpha;
+      if (-alpha_beta(pos_idx + 1, -beta, -alpha, depth_left - 3) <= alpha) {
+        tmp = alpha;
+        TRACE_EVENT(PRUNE, pos_idx, pos[pos_idx].steps[i].c1, pos[pos_idx].steps[i].c2, alpha, depth_left, LAZY_EVAL);
+      }
       else {
         lazy = false;
         tmp = -alpha_beta(pos_idx + 1, -beta, -alpha, depth_left - 1 + ext);
@@ -1431,33 +2253,43 @@ ChessEngine::alpha_beta(int pos_idx, int alpha, int beta, int depth_left)
     else tmp = -alpha_beta(pos_idx + 1, -beta, -alpha, depth_left - 1 + ext);
 
     back_step(pos_idx, pos[pos_idx].steps[i]);
-    if (draw_repeat(pos_idx)) tmp = 0;
+
+    // The result of an interrupted sub-search is not reliable
+    if (stop_search && (pos_idx == 0)) break;
+
+    if ((pos_idx == 0) && (skill_noise > 0) && (abs(tmp) < 9000)) tmp += root_noise(pos[0].steps[i]);
     if (tmp > score) score = tmp;
     pos[pos_idx].steps[i].weight = tmp;
 
     if (score > alpha) {
       alpha = score;
       pos[pos_idx].best = pos[pos_idx].steps[i];
+
+      pv[pos_idx][pos_idx] = pos[pos_idx].steps[i];
+      for (int j = pos_idx + 1; j < pv_length[pos_idx + 1]; j++) pv[pos_idx][j] = pv[pos_idx + 1][j];
+      pv_length[pos_idx] = (pv_length[pos_idx + 1] > pos_idx + 1) ? pv_length[pos_idx + 1] : pos_idx + 1;
+
       if (pos_idx == 0 && level > 3) {
         if (print_best(depth_left)) return alpha;
       }
     }
 
-    if (pos_idx == 0) {
-      if (TRACE > 0) std::cout << "        " << tmp << std::endl;
-      //if (alpha==9999||alpha==-5000) break;
-    } 
-    else if (TRACE > pos_idx) {
-      std::cout << " = " << tmp;
-    }
+    TRACE_EVENT(SCORE, pos_idx, pos[pos_idx].steps[i].c1, pos[pos_idx].steps[i].c2, tmp, depth_left, NONE);
 
-    if (alpha >= beta) return alpha;
+    if (alpha >= beta) {
+      TRACE_EVENT(CUTOFF, pos_idx, pos[pos_idx].steps[i].c1, pos[pos_idx].steps[i].c2, alpha, depth_left, NONE);
+      return alpha;
+    }
 
-    auto end_time = std::chrono::steady_clock::now();
-    unsigned long duration = std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time).count();
+    if (!stop_search) {
+      if (halt || ((search_node_limit != 0) && (move_count >= search_node_limit))) stop_search = true;
+      else if ((pos_idx < 3) && !deterministic && time_manager.out_of_time()) stop_search = true;
+    }
 
-    if (halt || (pos_idx < 3 && duration > time_limit)) //
+    if (stop_search) {
+      TRACE_EVENT(PRUNE, pos_idx, -1, -1, score, depth_left, TIME);
       return score;
+    }
   }
   if (score == -20000) {
     if ((pos_idx > 0) && pos[pos_idx].check_on_table) {
@@ -1472,10 +2304,9 @@ ChessEngine::alpha_beta(int pos_idx, int alpha, int beta, int depth_left)
 bool 
 ChessEngine::print_best(int dep)
 {
-  auto end_time = std::chrono::steady_clock::now();
-  unsigned long duration = std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time).count();
+  unsigned long duration = time_manager.elapsed();
 
-  if (halt || (duration > time_limit)) return false;
+  if (halt || stop_search || (!deterministic && time_manager.out_of_time())) return false;
   
   if (last_best_depth == dep && 
       pos[0].best.type == last_best_step.type &&
@@ -1492,14 +2323,27 @@ ChessEngine::print_best(int dep)
   }
   last_best_depth = dep;
   last_best_step = pos[0].best;
+
+  if (info_handler != nullptr) {
+    SearchInfo info;
+    info.depth     = dep;
+    info.sel_depth = depth + 1;
+    info.score     = pos[0].best.weight;
+    info.nodes     = move_count;
+    info.time_ms   = duration;
+    info.pv        = pv[0];
+    info.pv_count  = pv_length[0];
+    (*info_handler)(info);
+    return ret;
+  }
+
   std::string st = step_to_str(pos[0].best);
   std::cout << (pos[0].white_move ? "1." : "1...") << st;
 
   for (std::size_t i = 0; i < 10 - st.length(); i++) std::cout << ' ';
   std::string depf = "/" + std::to_string(depth + 1) + " ";
 
-  end_time = std::chrono::steady_clock::now();
-  duration = std::chrono::duration_cast<std::chrono::seconds>(end_time - start_time).count();
+  duration /= 1000;
 
   std::cout << "(";
 
@@ -1543,6 +2387,16 @@ ChessEngine::solve_step()
   count_all   = 0;
   zero        = false;
   lazy        = false;
+  halt        = false;
+  stop_search = false;
+  pv_length[0] = 0;
+
+  search_node_limit = node_limit;
+  if ((skill_nodes != 0) && ((search_node_limit == 0) || (skill_nodes < search_node_limit))) search_node_limit = skill_nodes;
+  tb_hits    = 0;
+  eval_cache.clear_stats();
+  tb_pieces  = std::min(tb_probe_limit, syzygy.get_max_pieces());
+  noise_seed = deterministic ? 0 : std::chrono::steady_clock::now().time_since_epoch().count();
 
   for (int i = 1; i < MAXDEPTH; i++) {
     if (i % 2) pos[i].white_move = !pos[0].white_move;
@@ -1550,22 +2404,11 @@ ChessEngine::solve_step()
     pos[i].en_passant_pp = 0;
   }
 
-  start_time = std::chrono::steady_clock::now();
-
-  if (is_draw()) {
-    std::cout << " DRAW!" << std::endl;
-    end_of_game = EndOfGameType::DRAW;
-    return true;
-  }
-
-  last_best_depth         = -1;
-  last_best_step.type     =  MoveType::SIMPLE;
-  last_best_step.c1       = -1;
-  last_best_step.c2       = -1;
-  best_solved             =  false;
+  time_manager.start();
 
   pos[0].weight_black     = 0;
   pos[0].weight_white     = 0;
+  pos[0].material         = 0;
 
   for (int i = 0; i < 64; i++) { //
     if (board[i] < 0) {
@@ -1574,36 +2417,51 @@ ChessEngine::solve_step()
     else if (board[i] > 0) {
       pos[0].weight_white += fig_weight[board[i]]; //   8000
     }
+    pos[0].material += Endgames::piece_signature(board[i], i);
   }
 
+  if (is_draw()) {
+    std::cout << " DRAW!" << std::endl;
+    end_of_game = EndOfGameType::DRAW;
+    return true;
+  }
+
+  last_best_depth         = -1;
+  last_best_step.type     =  MoveType::SIMPLE;
+  last_best_step.c1       = -1;
+  last_best_step.c2       = -1;
+  best_solved             =  false;
+
   if (pos[0].weight_white + pos[0].weight_black < 3500) endgame = true;
   else endgame = false;  //3500?
 
   //Serial.println("endgame="+std::string(endgame));
 
-  pos[0].weight_both = 0;
+  pos[0].score_mg      = 0;
+  pos[0].score_eg      = 0;
+  pos[0].phase         = 0;
+  pos[0].pawn_key      = 0;
+  pos[0].attacks_known = false;
 
   for (int i = 0; i < 64; i++) { //
     int f = board[i];
 
     if (f == NO_FIG) continue;
-    if (abs(f) == KING && endgame) {
-      if (is_black_fig(f))
-        pos[0].weight_both -= stat_weight_black[6][i];
-      else
-        pos[0].weight_both += stat_weight_white[6][i];
-    } 
-    else {
-      if (is_black_fig(f))
-        pos[0].weight_both -= stat_weight_black[-f - 1][i];
-      else
-        pos[0].weight_both += stat_weight_white[f - 1][i];
-    }
+    pos[0].score_mg += pst_mg(f, i);
+    pos[0].score_eg += pst_eg(f, i);
+    pos[0].phase    += phase_weight[abs(f)];
+    if (abs(f) == PAWN) pos[0].pawn_key ^= zobrist_piece(f, i);
   }
 
+  nnue_on = use_nnue && nnue.is_ready();
+  if (nnue_on) nnue.refresh(board, pos[0].accumulator);
+
   kingpositions();
 
-  if (TRACE > 0) std::cout << " start score=" << evaluate(0) << std::endl;
+  #if CHESS_TRACE
+    search_trace.clear();
+  #endif
+  TRACE_EVENT(ITERATION, 0, -1, -1, evaluate(0), 0, NONE);
 
   generate_steps(0);
 
@@ -1634,34 +2492,54 @@ ChessEngine::solve_step()
   sort_steps(0);
   pos[0].steps_count = legal;
 
+  if (tb_root_probe()) return true;
+  bb_root_filter();
+
   int alpha = -20000;
   int beta  =  20000;
 
-  level = (time_limit > 300000) ? 4 : 2;
+  // Only a long timed search starts deeper. With a node limit or no time
+  // limit at all, a deep first iteration could use the whole budget on the
+  // first root steps.
+  bool long_search = !deterministic && (search_node_limit == 0) &&
+                     (time_manager.get_maximum() != ULONG_MAX) && (time_manager.get_optimum() > 300000);
+  level = long_search ? 4 : 2;
+  int max_level = 20;
+  if ((depth_limit > 0) && (depth_limit < max_level)) max_level = depth_limit;
+  if ((skill_depth > 0) && (skill_depth < max_level)) max_level = skill_depth;
+  if (level > max_level) level = max_level;
 
   for (int x = 0; x < MAXDEPTH; x++) {
     pos[x].best.f1 =  NO_FIG;
     pos[x].best.c2 = -1;
   }
 
-  stats = true;
+  stats = use_stats;
 
-  while (level <= 20) {
-    if (TRACE > 0) {
-      std::cout << "******* LEVEL=" << level << std::endl;
-    }
+  Step prev_best         = {};
+  int  prev_score        = 0;
+  bool first_interrupted = false;
+  int  first_score       = 0;
+  prev_best.c1           = -1;
+
+  while (level <= max_level) {
+    TRACE_EVENT(ITERATION, 0, -1, -1, alpha, level, NONE);
 
     for (int x = 1; x < MAXDEPTH; x++) {
       pos[x].best.f1 =  NO_FIG;
       pos[x].best.c2 = -1;
     }
 
+    // The root position is evaluated before a step is made on the board,
+    // as the pawn table entry of the root is keyed on its pawns.
+    int root_weight = evaluate(0);
+
     for (int i = 0; i < pos[0].steps_count; i++) {
       move_step(0, pos[0].steps[i]);
       if (pos[0].white_move) pos[0].steps[i].check = check_on_black_king() ? CheckType::CHECK : CheckType::NONE;
       else pos[0].steps[i].check = check_on_white_king() ? CheckType::CHECK : CheckType::NONE;
 
-      pos[0].steps[i].weight += evaluate(0) + ((int)(pos[0].steps[i].check)) * 500;
+      pos[0].steps[i].weight += root_weight + ((int)(pos[0].steps[i].check)) * 500;
 
       if (pos[0].steps[i].f2 != NO_FIG) pos[0].steps[i].weight -= pos[0].steps[i].f1;
       back_step(0, pos[0].steps[i]);
@@ -1676,10 +2554,22 @@ ChessEngine::solve_step()
     //beta=10000; alpha=9900;
     //int sec=(millis()-start_time)/1000;
     fdepth = 4;
+    int window_alpha = alpha;
     score  = alpha_beta(0, alpha, beta, level);
+    TRACE_EVENT(RESULT, 0, pos[0].best.c1, pos[0].best.c2, score, level, NONE);
+
+    if ((prev_best.c1 == -1) && stop_search) {
+      first_interrupted = true;
+      first_score       = score;
+    }
+
+    unsigned long duration = time_manager.elapsed();
 
-    auto end_time = std::chrono::steady_clock::now();
-    unsigned long duration = std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time).count();
+    // Best move instability and score drop give more time to the move
+    bool best_changed = (pos[0].best.c1 != prev_best.c1) || (pos[0].best.c2 != prev_best.c2) || (pos[0].best.type != prev_best.type);
+    bool failed_low   = (score <= window_alpha) || ((prev_best.c1 != -1) && (score < prev_score - 50));
+    prev_best  = pos[0].best;
+    prev_score = score;
 
     bool out = 0;
     if (score >= beta) out = 1;
@@ -1694,7 +2584,11 @@ ChessEngine::solve_step()
       beta  = score + 100;
     }
 
-    if ((duration > (time_limit * 0.2)) && !out) {
+    // In deterministic mode, the stats switch-off is based on the node
+    // budget instead of the time budget.
+    bool late = deterministic ? ((search_node_limit != 0) && (move_count > search_node_limit / 5))
+                              : (duration > (time_manager.get_optimum() / 5));
+    if (late && !out) {
       stats = false;
       alpha = score - 300;
       beta  = score + 300;
@@ -1705,7 +2599,8 @@ ChessEngine::solve_step()
       solved = true;
       break;
     }
-    if (duration > time_limit || halt) break;
+    if (halt || stop_search) break;
+    if (!deterministic && time_manager.iteration_done(best_changed, failed_low)) break;
     if (pos[0].best.type == last_best_step.type && pos[0].best.c1 == last_best_step.c1 && pos[0].best.c2 == last_best_step.c2) {
       samebest++;
     } 
@@ -1716,11 +2611,244 @@ ChessEngine::solve_step()
     //Serial.println(level);
     //Serial.println(duration/1000);
   } //while level
+
+  // When the first iteration is interrupted (small node budget), the root
+  // steps it did not search to the end (weight still -8000) are compared
+  // with a quiescence search only, against the score of the best step it
+  // found, if any. A move is then always given, and not one of a few steps
+  // tried first.
+  if (first_interrupted) {
+    int best_score = (pos[0].best.c2 == -1) ? -20000 : first_score;
+    for (int i = 0; i < pos[0].steps_count; i++) {
+      if (pos[0].steps[i].weight != -8000) continue;
+      pos[0].cur_step = i;
+      move_step(0, pos[0].steps[i]);
+      move_pos(0, pos[0].steps[i]);
+      int tmp = -quiescence(1, -20000, -best_score, fdepth);
+      back_step(0, pos[0].steps[i]);
+      if (tmp > best_score) {
+        best_score  = tmp;
+        pos[0].best = pos[0].steps[i];
+      }
+    }
+  }
   //Serial.println(std::string(count_in)+"/"+std::string(count_all));
   //Serial.println("Task load: "+std::string(0.1*task_execute/(millis()-start_time))+"%");
   return solved;
 }
 
+bool
+ChessEngine::get_ponder_step(Step & step)
+{
+  if ((pv_length[0] < 2) ||
+      (pv[0][0].c1   != pos[0].best.c1  ) ||
+      (pv[0][0].c2   != pos[0].best.c2  ) ||
+      (pv[0][0].type != pos[0].best.type)) return false;
+
+  step = pv[0][1];
+
+  return true;
+}
+
+// ===== Mate search ======================================================
+
+bool
+ChessEngine::mate_limit_reached()
+{
+  if (halt || ((mate_node_limit != 0) && (move_count >= mate_node_limit))) mate_aborted = true;
+  return mate_aborted;
+}
+
+// The legal steps of the position at pos_idx get a positive weight, the
+// others -1. Checks come first, those leaving the fewest replies before the
+// others, then captures. With only_checks, the other steps are not tried.
+void
+ChessEngine::order_mate_steps(int pos_idx, bool only_checks)
+{
+  Position & p     = pos[pos_idx];
+  bool       white = p.white_move;
+
+  for (int i = 0; i < p.steps_count; i++) {
+    Step & step  = p.steps[i];
+    int    weight = -1;
+
+    p.cur_step = i;
+    move_step(pos_idx, step);
+    if (!(white ? check_on_white_king() : check_on_black_king())) {
+      if (white ? check_on_black_king() : check_on_white_king()) {
+        move_pos(pos_idx, step);
+        generate_steps(pos_idx + 1);
+        int replies = 0;
+        for (int j = 0; j < pos[pos_idx + 1].steps_count; j++) {
+          move_step(pos_idx + 1, pos[pos_idx + 1].steps[j]);
+          if (!(white ? check_on_black_king() : check_on_white_king())) replies++;
+          back_step(pos_idx + 1, pos[pos_idx + 1].steps[j]);
+        }
+        weight = 2000 - 10 * replies;
+      }
+      else if (!only_checks) {
+        weight = 1 + fig_weight[abs(step.f2)] / 10;
+      }
+    }
+    back_step(pos_idx, step);
+    step.weight = weight;
+  }
+
+  sort_steps(pos_idx);
+}
+
+// True if the side to move at pos_idx mates in at most `moves` moves. The
+// mating step is then in pos[pos_idx].best.
+bool
+ChessEngine::mate_attack(int pos_idx, int moves)
+{
+  if (mate_limit_reached()) return false;
+
+  generate_steps(pos_idx);
+  order_mate_steps(pos_idx, mate_checks_only || (moves == 1));
+
+  for (int i = 0; (i < pos[pos_idx].steps_count) && (pos[pos_idx].steps[i].weight > 0); i++) {
+    Step & step = pos[pos_idx].steps[i];
+
+    pos[pos_idx].cur_step = i;
+    move_step(pos_idx, step);
+    move_pos(pos_idx, step);
+    bool mated = mate_defend(pos_idx + 1, moves - 1);
+    back_step(pos_idx, step);
+
+    if (mated) {
+      pos[pos_idx].best = step;
+      return true;
+    }
+    if (mate_aborted) return false;
+  }
+
+  return false;
+}
+
+// True if the side to move at pos_idx is mated, now or, whatever the reply,
+// in at most `moves` moves of the opponent.
+bool
+ChessEngine::mate_defend(int pos_idx, int moves)
+{
+  if (mate_limit_reached()) return false;
+
+  generate_steps(pos_idx);
+
+  bool white = pos[pos_idx].white_move;
+  bool legal = false;
+
+  for (int i = 0; i < pos[pos_idx].steps_count; i++) {
+    Step & step = pos[pos_idx].steps[i];
+
+    pos[pos_idx].cur_step = i;
+    move_step(pos_idx, step);
+    if (white ? check_on_white_king() : check_on_black_king()) {
+      back_step(pos_idx, step);
+      continue;
+    }
+    legal = true;
+    if (moves == 0) {
+      back_step(pos_idx, step);
+      return false;
+    }
+    move_pos(pos_idx, step);
+    bool mated = mate_attack(pos_idx + 1, moves);
+    back_step(pos_idx, step);
+
+    if (!mated) return false;
+  }
+
+  return legal || pos[pos_idx].check_on_table;
+}
+
+// Smallest number of moves, up to `moves`, in which the side to move at
+// pos_idx mates. 0 if there is none.
+int
+ChessEngine::mate_distance(int pos_idx, int moves)
+{
+  for (int n = 1; n <= moves; n++) {
+    if (mate_attack(pos_idx, n)) return n;
+    if (mate_aborted) break;
+  }
+  return 0;
+}
+
+ChessEngine::MateResult
+ChessEngine::solve_mate(int moves, unsigned long max_nodes, Step * line, int & line_length, bool checks_only)
+{
+  line_length = 0;
+  if ((moves < 1) || (moves > MATE_MAX_MOVES)) return MateResult::UNKNOWN;
+
+  move_count       = 0;
+  halt             = false;
+  mate_aborted     = false;
+  mate_node_limit  = max_nodes;
+  mate_checks_only = checks_only;
+
+  for (int i = 1; i < MAXDEPTH; i++) {
+    pos[i].white_move    = (i % 2) ? !pos[0].white_move : pos[0].white_move;
+    pos[i].en_passant_pp = 0;
+  }
+  kingpositions();
+
+  int n = mate_distance(0, moves);
+  if (mate_aborted) return MateResult::UNKNOWN;
+  if (n == 0)       return MateResult::NO_MATE;
+
+  // The mating line: the shortest mate against the longest defence. Each
+  // step is proven again from its position, without node limit.
+  mate_node_limit = 0;
+
+  int pos_idx = 0;
+  while (true) {
+    // The mating step is the current step of the position when found
+    n = mate_distance(pos_idx, n);
+    line[line_length] = pos[pos_idx].best;
+    move_step(pos_idx, line[line_length]);
+    move_pos(pos_idx, line[line_length]);
+    line[line_length].check = (n == 1) ? CheckType::CHECKMATE : 
+                              (pos[pos_idx].white_move ? check_on_black_king() : check_on_white_king()) ? CheckType::CHECK : CheckType::NONE;
+    line_length++;
+    pos_idx++;
+
+    if (n == 1) break;
+
+    generate_steps(pos_idx);
+
+    int longest = 0, reply = 0;
+    for (int i = 0; i < pos[pos_idx].steps_count; i++) {
+      Step & step = pos[pos_idx].steps[i];
+
+      pos[pos_idx].cur_step = i;
+      move_step(pos_idx, step);
+      if (pos[pos_idx].white_move ? check_on_white_king() : check_on_black_king()) {
+        back_step(pos_idx, step);
+        continue;
+      }
+      move_pos(pos_idx, step);
+      int d = mate_distance(pos_idx + 1, n - 1);
+      back_step(pos_idx, step);
+      if (d > longest) {
+        longest = d;
+        reply   = i;
+      }
+    }
+
+    pos[pos_idx].cur_step = reply;
+    line[line_length] = pos[pos_idx].steps[reply];
+    move_step(pos_idx, line[line_length]);
+    move_pos(pos_idx, line[line_length]);
+    line_length++;
+    pos_idx++;
+    n = longest;
+  }
+
+  for (int i = line_length - 1; i >= 0; i--) back_step(i, line[i]);
+
+  return MateResult::MATE;
+}
+
 bool 
 ChessEngine::load_board_from_fen(std::string str)
 {
@@ -1738,6 +2866,7 @@ ChessEngine::load_board_from_fen(std::string str)
   pos[0].en_passant_pp                        = 0;
   pos[0].cur_step                  = 0;
   pos[0].steps_count               = 0;
+  pos[0].halfmove                  = 0;
 
   int spaces = 0;
 
@@ -1791,12 +2920,37 @@ ChessEngine::load_board_from_fen(std::string str)
         case 'w': if (spaces == 1) { pos[0].white_move = true; load = true; } break;
       }
     }
-    if (spaces == 4) break;
+    if (spaces == 4) {
+      pos[0].halfmove = atoi(str.c_str() + ss_idx + 1);
+      break;
+    }
+  }
+
+  // The en passant square is kept only if a pawn can take, as done by
+  // move_pos(). Otherwise, the same position would get two keys.
+  int ep = pos[0].en_passant_pp;
+  if (ep != 0) {
+    bool ok = pos[0].white_move ?
+      ((ep + 9 < 64) && (((column[ep] > 1) && (board[ep + 7] ==  PAWN)) || ((column[ep] < 8) && (board[ep + 9] ==  PAWN)))) :
+      ((ep - 9 >= 0) && (((column[ep] > 1) && (board[ep - 9] == -PAWN)) || ((column[ep] < 8) && (board[ep - 7] == -PAWN))));
+    if (!ok) pos[0].en_passant_pp = 0;
   }
 
+  pos[0].key    = compute_key(0);
+  history_count = 0;
+
   return load;
 }
 
+void
+ChessEngine::commit_step()
+{
+  history[history_count++ & (HISTORY_SIZE - 1)] = pos[0].key;
+
+  pos[1].white_move = !pos[0].white_move;
+  pos[0]            =  pos[1];
+}
+
 std::string 
 ChessEngine::export_pos_to_fen(int pos_idx)
 {
@@ -1897,6 +3051,126 @@ ChessEngine::get_board()
   return &board;
 }
 
+std::string 
+ChessEngine::step_to_uci(const Step & step)
+{
+  if (step.f1 == NO_FIG) return "0000";
+
+  std::string str = board_idx_to_str(step.c1) + board_idx_to_str(step.c2);
+
+  switch (step.type) {
+    case MoveType::PROMOTE_TO_KNIGHT: str += 'n'; break;
+    case MoveType::PROMOTE_TO_BISHOP: str += 'b'; break;
+    case MoveType::PROMOTE_TO_ROOK:   str += 'r'; break;
+    case MoveType::PROMOTE_TO_QUEEN:  str += 'q'; break;
+    default:                                      break;
+  }
+
+  return str;
+}
+
+bool 
+ChessEngine::play_step(const std::string & uci_str)
+{
+  if (uci_str.length() < 4) return false;
+
+  int c1 = str_to_board_idx(uci_str, 0);
+  int c2 = str_to_board_idx(uci_str, 2);
+
+  if ((c1 < 0) || (c2 < 0)) return false;
+
+  MoveType promotion = MoveType::UNKNOWN;
+  if (uci_str.length() > 4) {
+    switch (tolower(uci_str[4])) {
+      case 'n': promotion = MoveType::PROMOTE_TO_KNIGHT; break;
+      case 'b': promotion = MoveType::PROMOTE_TO_BISHOP; break;
+      case 'r': promotion = MoveType::PROMOTE_TO_ROOK;   break;
+      case 'q': promotion = MoveType::PROMOTE_TO_QUEEN;  break;
+      default:                                           break;
+    }
+  }
+
+  int i = find_step(c1, c2, promotion);
+  if (i < 0) return false;
+
+  Step & step = pos[0].steps[i];
+
+  pos[0].cur_step = i;
+  move_step(0, step);
+  move_pos(0, step);
+  commit_step();
+
+  return true;
+}
+
+// Index of the legal step of the root position going from c1 to c2, or -1.
+// The root steps are generated.
+int
+ChessEngine::find_step(int c1, int c2, MoveType promotion)
+{
+  generate_steps(0);
+
+  for (int i = 0; i < pos[0].steps_count; i++) {
+    Step & step = pos[0].steps[i];
+
+    if ((step.c1 != c1) || (step.c2 != c2)) continue;
+    if ((step.type > MoveType::CASTLE_QUEENSIDE) && (step.type != promotion)) continue;
+
+    move_step(0, step);
+    bool legal = !(( pos[0].white_move && check_on_white_king()) ||
+                   (!pos[0].white_move && check_on_black_king()));
+    back_step(0, step);
+
+    return legal ? i : -1;
+  }
+
+  return -1;
+}
+
+bool
+ChessEngine::book_step(Step & step)
+{
+  uint16_t move;
+
+  if (!opening_book.choose(pos[0].key, move)) return false;
+
+  // Polyglot squares are numbered from a1, the board from a8.
+  int c1    = ((move >> 6) & 0x3F) ^ 56;
+  int c2    = ( move       & 0x3F) ^ 56;
+  int promo = (move >> 12) & 0x07;
+
+  // Castling is coded as the king taking its own rook.
+  if ((abs(board[c1]) == KING) && (board[c2] == ((board[c1] > 0) ? ROOK : -ROOK))) {
+    c2 = (c2 > c1) ? c1 + 2 : c1 - 2;
+  }
+
+  MoveType promotion = (promo == 0) ? MoveType::UNKNOWN : (MoveType)(promo + (int) MoveType::CASTLE_QUEENSIDE);
+
+  int i = find_step(c1, c2, promotion);
+  if (i < 0) return false;
+
+  step = pos[0].steps[i];
+  return true;
+}
+
+int
+ChessEngine::set_tablebase_path(const std::string & path)
+{
+  return syzygy.init(path);
+}
+
+int
+ChessEngine::set_bitbase_path(const std::string & path)
+{
+  return bitbases.init(path);
+}
+
+bool
+ChessEngine::load_network(const std::string & filename)
+{
+  return nnue.load(filename);
+}
+
 std::string 
 ChessEngine::board_idx_to_str(int board_idx)
 {
@@ -1918,6 +3192,17 @@ ChessEngine::get_best_move(int move_idx)
   return &best_move[move_idx]; 
 }
 
+bool
+ChessEngine::dump_trace(const std::string & filename)
+{
+  #if CHESS_TRACE
+    return search_trace.dump(filename);
+  #else
+    (void) filename;
+    return false;
+  #endif
+}
+
 static void
 chess_task_start()
 {
@@ -1928,14 +3213,20 @@ void
 ChessEngine::setup(int32_t time)
 { 
   #if CHESS_LINUX_BUILD
-    mq_unlink("/chess_task");
-    mq_unlink("/chess_engine");
+    // Queue names are made unique per process, as many engines (UCI sessions,
+    // test runners) may be running at the same time. They are unlinked as soon
+    // as they are opened: the queues stay alive until the process ends.
 
-    task_queue      = mq_open("/chess_task",      O_RDWR|O_CREAT, S_IRWXU, &task_attr);
+    std::string task_queue_name   = "/chess_task_"   + std::to_string(getpid());
+    std::string engine_queue_name = "/chess_engine_" + std::to_string(getpid());
+
+    task_queue      = mq_open(task_queue_name.c_str(),   O_RDWR|O_CREAT, S_IRWXU, &task_attr);
     if (task_queue == -1) { std::cerr << "Unable to open task_queue:" << errno << std::endl; return; }
+    mq_unlink(task_queue_name.c_str());
 
-    engine_queue    = mq_open("/chess_engine",    O_RDWR|O_CREAT, S_IRWXU, &engine_attr);
+    engine_queue    = mq_open(engine_queue_name.c_str(), O_RDWR|O_CREAT, S_IRWXU, &engine_attr);
     if (engine_queue == -1) { std::cerr << "Unable to open engine_queue:" << errno << std::endl; return; }
+    mq_unlink(engine_queue_name.c_str());
 
     chess_task = std::thread(chess_task_start); 
   #else
@@ -1948,12 +3239,78 @@ ChessEngine::setup(int32_t time)
     chess_task = std::thread(chess_task_start);
   #endif
 
+  kpk_bitbase.init();
+  endgames.init();
+  pawn_table.resize(CHESS_PAWN_HASH_KB);
+
   set_engine_time(time);
 }
 
 void 
 ChessEngine::set_engine_time(int32_t time) 
 { 
-  time_limit = 1000L * time; 
-  std::cout << "Time limit: " << time_limit << std::endl;
+  time_manager.set_move_time(1000L * time);
+  depth_limit = 0;
+  node_limit  = 0;
+  std::cout << "Time limit: " << (1000L * time) << std::endl;
+}
+
+bool
+ChessEngine::set_option(const std::string & name, int32_t value)
+{
+  if      (name == "null_move") null_move = value != 0;
+  else if (name == "futility" ) futility  = value != 0;
+  else if (name == "lazy_eval") lazy_eval = value != 0;
+  else if (name == "stats"    ) use_stats = value != 0;
+  else if (name == "skill"    ) set_skill_level(value);
+  else if (name == "deterministic") deterministic = value != 0;
+  else if (name == "syzygy_pieces") tb_probe_limit = std::max(0, std::min<int>(value, SyzygyTB::MAX_PIECES));
+  else if (name == "pawn_hash") return pawn_table.resize(value);
+  else if (name == "nnue"     ) use_nnue  = value != 0;
+  else return false;
+
+  return true;
+}
+
+bool
+ChessEngine::get_option(const std::string & name, int32_t & value)
+{
+  if      (name == "null_move") value = null_move;
+  else if (name == "futility" ) value = futility;
+  else if (name == "lazy_eval") value = lazy_eval;
+  else if (name == "stats"    ) value = use_stats;
+  else if (name == "skill"    ) value = skill_level;
+  else if (name == "deterministic") value = deterministic;
+  else if (name == "syzygy_pieces") value = tb_probe_limit;
+  else if (name == "pawn_hash") value = pawn_table.get_size();
+  else if (name == "nnue"     ) value = use_nnue;
+  else return false;
+
+  return true;
+}
+
+void 
+ChessEngine::set_search_limits(unsigned long time_ms, int depth, unsigned long nodes)
+{
+  time_manager.set_move_time(time_ms);
+  depth_limit = depth;
+  node_limit  = nodes;
+}
+
+void
+ChessEngine::set_skill_level(int skill)
+{
+  if (skill < 0) skill = 0;
+  if (skill >= SKILL_LEVEL_COUNT) skill = SKILL_LEVEL_COUNT - 1;
+
+  skill_level = skill;
+  skill_nodes = skill_limits[skill].nodes;
+  skill_depth = skill_limits[skill].depth;
+  skill_noise = skill_limits[skill].noise;
+}
+
+void
+ChessEngine::set_clock(unsigned long remaining_ms, unsigned long inc_ms, int moves_to_go)
+{
+  time_manager.set_clock(remaining_ms, inc_ms, moves_to_go);
 }
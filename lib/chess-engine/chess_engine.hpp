@@ -12,6 +12,8 @@
 #include <cinttypes>
 #include <string>
 #include <thread>
+#include <atomic>
+#include <chrono>
 
 #if CHESS_LINUX_BUILD
   #include <mqueue.h>
@@ -25,6 +27,17 @@
 
 #include "chess_engine.hpp"
 #include "chess_engine_types.hpp"
+#include "chess_engine_time.hpp"
+#include "chess_engine_book.hpp"
+#include "chess_engine_syzygy.hpp"
+#include "chess_engine_bitbase.hpp"
+#include "chess_engine_kpk.hpp"
+#include "chess_engine_endgame.hpp"
+#include "chess_engine_pawns.hpp"
+#include "chess_engine_evalcache.hpp"
+#include "chess_engine_nnue.hpp"
+#include "chess_engine_puzzles.hpp"
+#include "chess_engine_review.hpp"
 
 class ChessTask 
 {
@@ -32,6 +45,7 @@ class ChessTask
     ChessTask() { }
 
     void exec();
+    void generate();
 
     inline void set_pos_idx(int pos_idx) { task_pos_idx = pos_idx; }
     void     retrieve_steps(int pos_idx);
@@ -54,16 +68,33 @@ class ChessTask
   extern ChessTask   chess_engine_task;
 #endif
 
+// Search progress, sent to the InfoHandler each time the best root move is
+// reported. The principal variation steps are owned by the engine and are
+// valid only for the duration of the call.
+struct SearchInfo {
+  int           depth;      // Iteration level
+  int           sel_depth;  // Deepest ply reached
+  int           score;      // From the point of view of the side to move
+  unsigned long nodes;
+  unsigned long time_ms;
+  const Step  * pv;
+  int           pv_count;
+};
+
+typedef void (* InfoHandler)(const SearchInfo & info);
+
 class ChessEngine
 {
   public:
 
     ChessEngine() : 
-              TRACE(0),
         best_solved(false),
                zero(false),
               level(2),
               stats(true), 
+          use_stats(true),
+            nnue_on(false),
+           use_nnue(true),
          move_count(0),
            count_in(0),
           count_all(0),
@@ -72,12 +103,30 @@ class ChessEngine
            futility(true),
           lazy_eval(true),
              fdepth(4),
+        depth_limit(0),
+         node_limit(0),
+  search_node_limit(0),
+        skill_level(SKILL_LEVEL_COUNT - 1),
+        skill_nodes(0),
+        skill_depth(0),
+        skill_noise(0),
+         noise_seed(0),
+      deterministic(false),
+        stop_search(false),
+       info_handler(nullptr),
               depth(0),
          null_depth(0),
                lazy(false),
     last_best_depth(0),
                halt(false),
-            endgame(false) { }
+            endgame(false),
+      history_count(0),
+     tb_probe_limit(SyzygyTB::MAX_PIECES),
+          tb_pieces(0),
+            tb_hits(0),
+    mate_node_limit(0),
+       mate_aborted(false),
+   mate_checks_only(false) { }
 
 
     static const uint8_t    row[64];
@@ -88,6 +137,50 @@ class ChessEngine
     void                   new_game() { end_of_game = EndOfGameType::NONE; }
 
     void            set_engine_time(int32_t time);
+
+    // Search limits used by solve_step() in place of the engine time. A zero
+    // value means no limit on that dimension.
+    void          set_search_limits(unsigned long time_ms, int depth, unsigned long nodes);
+
+    // Game clock of the side to move, in place of the fixed time per move of
+    // set_search_limits(). Depth and node limits are kept.
+    void                  set_clock(unsigned long remaining_ms, unsigned long inc_ms, int moves_to_go);
+
+    // Playing strength, from 0 (beginner) to SKILL_LEVEL_COUNT - 1 (full
+    // strength). Lower levels cap the nodes and depth of the search, and add
+    // a random offset to the score of the root moves.
+    static constexpr int SKILL_LEVEL_COUNT = 5;
+    void            set_skill_level(int skill);
+    inline int      get_skill_level() { return skill_level; }
+
+    // In deterministic mode, the result of a search (best move, score and
+    // node count) depends only on the position and the node and depth
+    // limits: time is not checked, the move generator runs in the calling
+    // thread and the skill level randomization uses a fixed seed.
+    inline void   set_deterministic(bool on) { deterministic = on; }
+    inline bool    is_deterministic() { return deterministic; }
+    inline void                stop() { halt = true; }
+
+    // Pondering: the next solve_step() searches without time limit, until
+    // ponder_hit() makes the time limits apply again (counted from the start
+    // of the search) or stop() is called. Both may be called from another
+    // thread than the searching one.
+    inline void       set_pondering(bool on) { time_manager.set_pondering(on); }
+    inline void          ponder_hit() { time_manager.set_pondering(false); }
+
+    // Expected reply to the best move found by the last solve_step(): the
+    // second step of its principal variation. Returns false if unknown.
+    bool            get_ponder_step(Step & step);
+    inline void    set_info_handler(InfoHandler handler) { info_handler = handler; }
+    inline unsigned long get_node_count() { return move_count; }
+
+    // Search options, by name: null_move, futility, lazy_eval, stats
+    // (feature toggles), skill, deterministic, syzygy_pieces (largest
+    // number of pieces probed in the tablebases, 0 to disable), pawn_hash
+    // (pawn table size in kilobytes) and nnue (network evaluation used when
+    // loaded). Return false if the option is unknown or its value rejected.
+    bool                 set_option(const std::string & name, int32_t value);
+    bool                 get_option(const std::string & name, int32_t & value);
     void             generate_steps(int pos_idx);
 
     bool        load_board_from_fen(std::string str);
@@ -95,16 +188,43 @@ class ChessEngine
 
     bool                 solve_step();
 
+    enum class MateResult : int8_t { MATE, NO_MATE, UNKNOWN };
+
+    static constexpr int MATE_MAX_MOVES = MAXDEPTH / 2;
+
+    // Proof search for a forced mate by the side to move of the root position
+    // in at most `moves` moves. Only the rules of chess are used: no pruning,
+    // no evaluation. The attacker tries the checks first (only them with
+    // checks_only, and always for the mating move), the defender all its
+    // replies. Returns MATE with the mating line (shortest mate against the
+    // longest defence, at most 2 * moves - 1 steps), NO_MATE if there is
+    // none, or UNKNOWN if the node limit (0: none) is reached first.
+    MateResult           solve_mate(int moves, unsigned long max_nodes, Step * line, int & line_length, bool checks_only = false);
+
     void                  back_step(int pos_idx, Step & step);
     void                  move_step(int pos_idx, Step & step);
     void                   move_pos(int pos_idx, Step & step);
 
+    // Make position 1 the new root position, once a played move has been
+    // applied to position 0 with move_step() and move_pos(). The key of the
+    // previous root is kept in the game history for repetition detection.
+    void                commit_step();
+
+    // True if the root position is a draw by threefold repetition or by the
+    // fifty moves rule.
+    bool            is_draw_by_rule();
+
     Board               * get_board();
 
     Position              * get_pos(int pos_idx);
     Step            * get_best_move(int move_idx);
 
     std::string         step_to_str(const Step & step);
+    std::string         step_to_uci(const Step & step);
+
+    // Play a move given in coordinate notation (e2e4, e7e8q) on the position
+    // at index 0. Returns false if the move is not legal.
+    bool                  play_step(const std::string & uci_str);
     std::string    board_idx_to_str(int board_idx);
 
     bool        check_on_white_king();
@@ -114,26 +234,94 @@ class ChessEngine
 
     inline EndOfGameType get_end_of_game_type() { return end_of_game; }
 
-#if 0
-    void                      getbm(int n, Step ep);
-#endif
+    // Write the search trace ring buffer to a file. Returns false if the
+    // trace is not compiled in (CHESS_TRACE) or the file cannot be written.
+    bool                 dump_trace(const std::string & filename);
+
+    // Convert a move in Standard Algebraic Notation (Nf3, exd5, e8=Q+, O-O)
+    // to the corresponding legal step of the position at index 0.
+    bool                san_to_step(std::string san, Step & step);
+
+    // Set the expected best move move_idx (< MAXEPD) of an EPD test position.
+    // The search stops as soon as it is found.
+    bool                      getbm(int move_idx, const std::string & san);
+
+    // Select a move of the root position from the opening book (see
+    // opening_book). Returns false if the book is not opened or if the
+    // position is not in it.
+    bool                  book_step(Step & step);
+
+    // Register the Syzygy tablebases found in the directory (see syzygy).
+    // Returns the number of WDL tables found. Positions without castling
+    // rights and with at most syzygy_pieces pieces are then probed at the
+    // root and in the search.
+    int          set_tablebase_path(const std::string & path);
+    inline unsigned long get_tb_hits() { return tb_hits; }
+
+    // Register the endgame bitbases found in the directory (see bitbases).
+    // Returns the number of bitbases found. They are probed like the
+    // tablebases, for the positions with their material.
+    int            set_bitbase_path(const std::string & path);
+
+    // Loads the evaluation network file (see nnue). Returns false if it
+    // cannot be loaded: the hand-made evaluation is then used.
+    bool               load_network(const std::string & filename);
+
+    // Score of a tablebase win at the root. Wins found deeper in the search
+    // are reduced by their distance to the root.
+    static constexpr int TB_WIN_SCORE = 8000;
+
+    // Score of a won king and pawn against king position, less than a new
+    // queen is worth, plus 10 per rank of the pawn.
+    static constexpr int KPK_WIN_SCORE = 800;
+
+    // Score added to the material of a lone king to be mated, plus the
+    // progress made toward the mate.
+    static constexpr int MOP_UP_SCORE = 1000;
+
+    // Scale of the evaluation (in quarters) with all the pieces on the board
+    // and with only kings and pawns, the phase giving the ratio of each.
+    static constexpr int MG_SCALE    = 2;
+    static constexpr int EG_SCALE    = 5;
+    static constexpr int SCALE_SHIFT = 2;
 
     inline bool is_black_fig(int8_t fig) const { return fig < 0; }
     inline bool is_white_fig(int8_t fig) const { return fig > 0; }
 
   private:
-    int TRACE;
-
     std::thread chess_task;
 
     bool      print_best(int dep);
     bool        checkd_w();
     bool        checkd_b();
-    bool     draw_repeat(int pos_idx);
+    int        find_step(int c1, int c2, MoveType promotion);
+    bool   is_repetition(int pos_idx);
+    uint64_t compute_key(int pos_idx);
+    uint64_t  castle_key(int pos_idx);
+    int       root_noise(const Step & step);
     int           active(Step & step);
     int       quiescence(int pos_idx, int alpha, int beta, int depth_left);
     int       alpha_beta(int pos_idx, int alpha, int beta, int depth_left);
     int         evaluate(int pos_idx);
+    int     evaluate_kpk(int pos_idx);
+    bool     steps_terms(int pos_idx, const Position * & white_info, const Position * & black_info);
+    int evaluate_king_shelter(const PawnTable::Scores & pawns);
+    void evaluate_activity(const PawnTable::Scores & pawns, const Position & white_info, const Position & black_info,
+                           int & mg, int & eg);
+    int  evaluate_mop_up(int pos_idx, const Endgames::Entry & entry);
+    int      piece_count();
+    bool castling_possible(int pos_idx);
+    bool  has_legal_step(int pos_idx);
+    int        tb_search(int pos_idx, bool check_zeroing, SyzygyTB::Probe & result);
+    int     tb_probe_dtz(int pos_idx, SyzygyTB::Probe & result);
+    bool   tb_root_probe();
+    bool  probe_endgame(int pos_idx, int & score);
+    void bb_root_filter();
+    bool mate_limit_reached();
+    void order_mate_steps(int pos_idx, bool only_checks);
+    bool     mate_attack(int pos_idx, int moves);
+    bool     mate_defend(int pos_idx, int moves);
+    int    mate_distance(int pos_idx, int moves);
     void   kingpositions();
     bool         is_draw();
     void      sort_steps(int pos_idx);
@@ -144,15 +332,17 @@ class ChessEngine
 
     std::string get_time(long tim);
 
-    unsigned long time_limit;
-    std::chrono::time_point<std::chrono::steady_clock> start_time;
+    TimeManager time_manager;
 
     bool   best_solved;
     bool   zero;
     int    level;
 
     bool   stats;
-    int    move_count;
+    bool   use_stats;
+    bool   nnue_on;                  // The network evaluation is used by the current search
+    bool   use_nnue;
+    unsigned long move_count;
     int    count_in;
     int    count_all;
 
@@ -163,18 +353,45 @@ class ChessEngine
 
     int    fdepth;
 
+    int           depth_limit;
+    unsigned long node_limit;
+    unsigned long search_node_limit;  // Smallest of node_limit and skill_nodes
+    int           skill_level;
+    unsigned long skill_nodes;
+    int           skill_depth;
+    int           skill_noise;
+    uint32_t      noise_seed;
+    bool          deterministic;
+    bool          stop_search;
+    InfoHandler   info_handler;
+
     int    depth;
     int    null_depth;
     bool   lazy;
     int    last_best_depth;
 
-    bool   halt;
+    std::atomic<bool> halt;
     bool   endgame;
 
     Step   last_best_step;
     Step   best_move[MAXEPD];
 
+    // Keys of the game positions preceding the root position. Only the
+    // positions after the last capture or pawn move are of interest, and
+    // the fifty moves rule limits them to 100.
+    static constexpr int HISTORY_SIZE = 128;
+    uint64_t history[HISTORY_SIZE];
+    int      history_count;
+
     EndOfGameType end_of_game;
+
+    int           tb_probe_limit;
+    int           tb_pieces;        // Smallest of tb_probe_limit and the largest table
+    unsigned long tb_hits;
+
+    unsigned long mate_node_limit;
+    bool          mate_aborted;
+    bool          mate_checks_only;
 };
 
 #if CHESS_ENGINE
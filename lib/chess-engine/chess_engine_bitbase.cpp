@@ -0,0 +1,377 @@
+// Chess engine endgame bitbases
+//
+// Guy Turcotte
+// for inclusion in the Chess-InkPlate project
+//
+// (c) January 2021 - GPL-3.0
+
+#include "chess_engine_bitbase.hpp"
+#include "chess_engine_types.hpp"
+
+#include <cstring>
+#include <algorithm>
+
+#include <dirent.h>
+
+#if CHESS_LINUX_BUILD
+  #include <fcntl.h>
+  #include <unistd.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+#endif
+
+static const char    MAGIC[4]  = { 'C', 'I', 'B', 'B' };
+static const char    letters[] = " PNBRQK";
+
+static inline int    row_of(int sq) { return sq >> 3; }
+static inline int    col_of(int sq) { return sq &  7; }
+static inline int transpose(int sq) { return (col_of(sq) << 3) | row_of(sq); }
+
+// White king squares of the a8-d8-d5 triangle (row <= column <= 3), used
+// without pawns.
+static int8_t triangle[64];
+static int8_t triangle_sq[10];
+static bool   triangle_ready = false;
+
+static void
+init_triangle()
+{
+  int code = 0;
+  for (int sq = 0; sq < 64; sq++) {
+    if ((col_of(sq) <= 3) && (row_of(sq) <= col_of(sq))) {
+      triangle_sq[code] = sq;
+      triangle[sq] = code++;
+    }
+    else triangle[sq] = -1;
+  }
+  triangle_ready = true;
+}
+
+static inline int
+king_squares(bool has_pawns)
+{
+  return has_pawns ? 32 : 10;
+}
+
+static std::string
+material_name(const int8_t * white, int white_count, const int8_t * black, int black_count)
+{
+  std::string name = "K";
+  for (int i = 0; i < white_count; i++) name += letters[white[i]];
+  name += 'K';
+  for (int i = 0; i < black_count; i++) name += letters[-black[i]];
+  return name;
+}
+
+// Pieces of one side, strongest first. An insertion sort, as there are at
+// most two pieces besides the kings (std::sort gives array bounds warnings
+// on these small arrays).
+static void
+sort_figs(int8_t * figs, int count)
+{
+  for (int i = 1; i < count; i++) {
+    int8_t fig = figs[i];
+    int    j   = i;
+    for (; (j > 0) && (abs(figs[j - 1]) < abs(fig)); j--) figs[j] = figs[j - 1];
+    figs[j] = fig;
+  }
+}
+
+// Pieces of both sides are sorted strongest first. The stronger side has
+// more pieces, or stronger ones.
+static bool
+black_stronger(const int8_t * white, int white_count, const int8_t * black, int black_count)
+{
+  if (white_count != black_count) return black_count > white_count;
+  for (int i = 0; i < white_count; i++) {
+    if (-black[i] != white[i]) return -black[i] > white[i];
+  }
+  return false;
+}
+
+static void
+set_size(Bitbases::Material & material)
+{
+  material.size = 2ULL * king_squares(material.has_pawns) * 64;
+  for (int i = 0; i < material.count; i++) material.size *= 64;
+}
+
+bool
+Bitbases::parse_material(const std::string & name, Material & material)
+{
+  auto black_king = name.find('K', 1);
+  if ((name.empty()) || (name[0] != 'K') || (black_king == std::string::npos)) return false;
+
+  int8_t white[MAX_PIECES], black[MAX_PIECES];
+  int    white_count = 0, black_count = 0;
+
+  for (size_t i = 1; i < name.length(); i++) {
+    if (i == black_king) continue;
+    const char * p = strchr(letters + 1, name[i]);
+    if ((p == nullptr) || (*p == 'K') || ((white_count + black_count) >= (MAX_PIECES - 2))) return false;
+    if (i < black_king) white[white_count++] =   p - letters;
+    else                black[black_count++] = -(p - letters);
+  }
+
+  sort_figs(white, white_count);
+  sort_figs(black, black_count);
+
+  if (black_stronger(white, white_count, black, black_count)) return false;
+
+  material.name      = material_name(white, white_count, black, black_count);
+  material.count     = white_count + black_count;
+  material.has_pawns = false;
+  for (int i = 0; i < white_count; i++) material.figs[i]               = white[i];
+  for (int i = 0; i < black_count; i++) material.figs[white_count + i] = black[i];
+  for (int i = 0; i < material.count; i++) if (abs(material.figs[i]) == PAWN) material.has_pawns = true;
+  set_size(material);
+
+  return material.name == name;
+}
+
+bool
+Bitbases::get_material(const int8_t * board, Material & material, bool & flip)
+{
+  int8_t white[MAX_PIECES], black[MAX_PIECES];
+  int    white_count = 0, black_count = 0, kings = 0;
+
+  for (int sq = 0; sq < 64; sq++) {
+    int8_t fig = board[sq];
+    if (fig == NO_FIG) continue;
+    if (abs(fig) == KING) { kings++; continue; }
+    if ((white_count + black_count) >= (MAX_PIECES - 2)) return false;
+    if (fig > 0) white[white_count++] = fig;
+    else         black[black_count++] = fig;
+  }
+  if (kings != 2) return false;
+
+  sort_figs(white, white_count);
+  sort_figs(black, black_count);
+
+  flip = black_stronger(white, white_count, black, black_count);
+  if (flip) {
+    int8_t tmp[MAX_PIECES];
+    for (int i = 0; i < black_count; i++) tmp[i]   = -black[i];
+    for (int i = 0; i < white_count; i++) black[i] = -white[i];
+    for (int i = 0; i < black_count; i++) white[i] =  tmp[i];
+    std::swap(white_count, black_count);
+  }
+
+  material.name      = material_name(white, white_count, black, black_count);
+  material.count     = white_count + black_count;
+  material.has_pawns = false;
+  for (int i = 0; i < white_count; i++) material.figs[i]               = white[i];
+  for (int i = 0; i < black_count; i++) material.figs[white_count + i] = black[i];
+  for (int i = 0; i < material.count; i++) if (abs(material.figs[i]) == PAWN) material.has_pawns = true;
+  set_size(material);
+
+  return true;
+}
+
+int64_t
+Bitbases::index(const Material & material, const int8_t * board, bool white_move, bool flip)
+{
+  if (!triangle_ready) init_triangle();
+
+  int wk = -1, bk = -1;
+  int squares[MAX_PIECES - 2];
+
+  for (int i = 0; i < material.count; i++) squares[i] = -1;
+
+  for (int sq = 0; sq < 64; sq++) {
+    int8_t fig = flip ? -board[sq] : board[sq];
+    if (fig == NO_FIG) continue;
+
+    int s = flip ? (sq ^ 56) : sq;
+    if      (fig ==  KING) wk = s;
+    else if (fig == -KING) bk = s;
+    else {
+      int i = 0;
+      while ((i < material.count) && ((material.figs[i] != fig) || (squares[i] != -1))) i++;
+      if (i == material.count) return -1;
+      squares[i] = s;
+    }
+  }
+
+  if ((wk == -1) || (bk == -1)) return -1;
+  for (int i = 0; i < material.count; i++) if (squares[i] == -1) return -1;
+
+  // Symmetries
+  if (col_of(wk) > 3) {
+    wk ^= 7; bk ^= 7;
+    for (int i = 0; i < material.count; i++) squares[i] ^= 7;
+  }
+  if (!material.has_pawns) {
+    if (row_of(wk) > 3) {
+      wk ^= 56; bk ^= 56;
+      for (int i = 0; i < material.count; i++) squares[i] ^= 56;
+    }
+    if (row_of(wk) > col_of(wk)) {
+      wk = transpose(wk); bk = transpose(bk);
+      for (int i = 0; i < material.count; i++) squares[i] = transpose(squares[i]);
+    }
+  }
+
+  int64_t idx = (flip ? white_move : !white_move) ? 1 : 0;
+
+  idx = idx * king_squares(material.has_pawns) + (material.has_pawns ? ((row_of(wk) << 2) | col_of(wk)) : triangle[wk]);
+  idx = (idx << 6) | bk;
+  for (int i = 0; i < material.count; i++) idx = (idx << 6) | squares[i];
+
+  return idx;
+}
+
+bool
+Bitbases::position(const Material & material, uint64_t idx, int8_t * board, bool & white_move)
+{
+  if (!triangle_ready) init_triangle();
+
+  int squares[MAX_PIECES - 2];
+
+  for (int i = material.count - 1; i >= 0; i--) {
+    squares[i] = idx & 63;
+    idx >>= 6;
+  }
+  int bk = idx & 63;
+  idx >>= 6;
+
+  int n  = king_squares(material.has_pawns);
+  int wk = idx % n;
+  wk = material.has_pawns ? (((wk >> 2) << 3) | (wk & 3)) : triangle_sq[wk];
+  white_move = (idx / n) == 0;
+
+  memset(board, NO_FIG, 64);
+
+  board[wk] = KING;
+  if (board[bk] != NO_FIG) return false;
+  board[bk] = -KING;
+
+  for (int i = 0; i < material.count; i++) {
+    if (board[squares[i]] != NO_FIG) return false;
+    if ((abs(material.figs[i]) == PAWN) && ((row_of(squares[i]) == 0) || (row_of(squares[i]) == 7))) return false;
+    board[squares[i]] = material.figs[i];
+  }
+
+  return true;
+}
+
+int
+Bitbases::init(const std::string & path)
+{
+  clear();
+
+  DIR * dir = opendir(path.c_str());
+  if (dir == nullptr) return 0;
+
+  struct dirent * entry;
+
+  while ((entry = readdir(dir)) != nullptr) {
+    std::string name = entry->d_name;
+    if ((name.length() < 5) || (name.substr(name.length() - 3) != ".bb")) continue;
+
+    File * file = new File;
+    if (!parse_material(name.substr(0, name.length() - 3), file->material)) {
+      delete file;
+      continue;
+    }
+
+    std::string filename = path + "/" + name;
+    size_t      expected = HEADER_SIZE + (file->material.size + 3) / 4;
+    uint8_t     header[HEADER_SIZE];
+    bool        ok       = false;
+
+    #if CHESS_LINUX_BUILD
+      file->data = nullptr;
+      int fd = ::open(filename.c_str(), O_RDONLY);
+      if (fd >= 0) {
+        struct stat st;
+        if ((fstat(fd, &st) == 0) && ((size_t) st.st_size == expected)) {
+          void * addr = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+          if (addr != MAP_FAILED) {
+            file->data      = (const uint8_t *) addr;
+            file->data_size = st.st_size;
+            memcpy(header, file->data, HEADER_SIZE);
+            ok = true;
+          }
+        }
+        ::close(fd);
+      }
+    #else
+      if ((file->file = fopen(filename.c_str(), "rb")) != nullptr) {
+        ok = (fseek(file->file, 0, SEEK_END) == 0) && ((size_t) ftell(file->file) == expected) &&
+             (fseek(file->file, 0, SEEK_SET) == 0) && (fread(header, 1, HEADER_SIZE, file->file) == HEADER_SIZE);
+      }
+    #endif
+
+    ok = ok && (memcmp(header, MAGIC, 4) == 0) &&
+               (header[4] == VERSION) &&
+               (header[5] == file->material.count + 2);
+
+    if (!ok) {
+      #if CHESS_LINUX_BUILD
+        if (file->data != nullptr) munmap((void *) file->data, file->data_size);
+      #else
+        if (file->file != nullptr) fclose(file->file);
+      #endif
+      delete file;
+      continue;
+    }
+
+    files[file->material.name] = file;
+  }
+
+  closedir(dir);
+
+  return files.size();
+}
+
+void
+Bitbases::clear()
+{
+  for (auto & e : files) {
+    #if CHESS_LINUX_BUILD
+      munmap((void *) e.second->data, e.second->data_size);
+    #else
+      fclose(e.second->file);
+    #endif
+    delete e.second;
+  }
+  files.clear();
+}
+
+bool
+Bitbases::probe(const int8_t * board, bool white_move, int & wdl)
+{
+  Material material;
+  bool     flip;
+
+  if (!get_material(board, material, flip)) return false;
+
+  if (material.count == 0) {  // KK
+    wdl = 0;
+    return true;
+  }
+
+  auto it = files.find(material.name);
+  if (it == files.end()) return false;
+
+  int64_t idx = index(material, board, white_move, flip);
+  if (idx < 0) return false;
+
+  uint8_t  byte;
+  uint64_t offset = HEADER_SIZE + (idx >> 2);
+
+  #if CHESS_LINUX_BUILD
+    byte = it->second->data[offset];
+  #else
+    if ((fseek(it->second->file, (long) offset, SEEK_SET) != 0) ||
+        (fread(&byte, 1, 1, it->second->file) != 1)) return false;
+  #endif
+
+  switch ((byte >> ((idx & 3) << 1)) & 3) {
+    case WIN:  wdl =  1; return true;
+    case LOSS: wdl = -1; return true;
+    case DRAW: wdl =  0; return true;
+    default:   return false;
+  }
+}
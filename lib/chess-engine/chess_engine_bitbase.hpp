@@ -0,0 +1,102 @@
+// Chess engine endgame bitbases
+//
+// Guy Turcotte
+// for inclusion in the Chess-InkPlate project
+//
+// (c) January 2021 - GPL-3.0
+
+#pragma once
+
+// Win/draw/loss bitbases of small endings (3 and 4 pieces: KQK, KRK, KPK,
+// KBNK, KRKP, ...), built by tools/bitbase_gen. There is one file per
+// material set, named after it (KRKP.bb: white king and rook against black
+// king and pawn). The file is an 8 bytes header ("CIBB", version, number of
+// pieces, 2 unused bytes) followed by 2 bits per position, 4 positions per
+// byte, lowest bits first:
+//
+//   0: draw, 1: win for the side to move, 2: loss, 3: invalid position
+//
+// The index of a position is built from the side to move (black is the
+// upper half), the white king square, the black king square and the square
+// of each other piece, in the order of the file name. Board symmetries put
+// the white king on files a-d and, without pawns, in the a8-d8-d5 triangle.
+// Squares are engine board indexes (a8 = 0). Positions with en passant or
+// castling rights are not distinguished.
+//
+// The material of a file has the stronger side as white. A position with a
+// stronger black side is probed with colors switched and ranks flipped.
+
+#include <cinttypes>
+#include <string>
+#include <map>
+
+#if !CHESS_LINUX_BUILD
+  #include <cstdio>
+#endif
+
+class Bitbases
+{
+  public:
+    static constexpr int     MAX_PIECES  = 4;
+    static constexpr int     HEADER_SIZE = 8;
+    static constexpr uint8_t VERSION     = 1;
+
+    enum Value : uint8_t { DRAW = 0, WIN = 1, LOSS = 2, INVALID = 3 };
+
+    // Pieces of a material set, kings excluded: white ones first, then the
+    // black ones, strongest first.
+    struct Material {
+      std::string name;
+      int8_t      figs[MAX_PIECES - 2];
+      int         count;
+      bool        has_pawns;
+      uint64_t    size;                 // Number of positions
+    };
+
+    Bitbases() { }
+    ~Bitbases() { clear(); }
+
+    // Registers the bitbases (.bb files) of the directory. Returns the
+    // number of files found.
+    int                  init(const std::string & path);
+    void                clear();
+    inline int     size() const { return files.size(); }
+
+    // WDL value (-1 .. 1) of the position for the side to move. Returns
+    // false if the material is not in a bitbase.
+    bool                probe(const int8_t * board, bool white_move, int & wdl);
+
+    // Material set of the name (KRKP). The stronger side must be white.
+    static bool parse_material(const std::string & name, Material & material);
+
+    // Material set of the board. flip is set when black is the stronger
+    // side: the position must then be probed with colors switched.
+    static bool   get_material(const int8_t * board, Material & material, bool & flip);
+
+    // Index of the position in the bitbase of its material, -1 if the board
+    // does not hold that material. With flip, colors are switched.
+    static int64_t      index(const Material & material, const int8_t * board, bool white_move, bool flip = false);
+
+    // Position at index idx. Returns false if it cannot be set on a board:
+    // pieces sharing a square, pawns on the first or last rank.
+    static bool      position(const Material & material, uint64_t idx, int8_t * board, bool & white_move);
+
+  private:
+    struct File {
+      Material        material;
+      #if CHESS_LINUX_BUILD
+        const uint8_t * data;
+        size_t          data_size;
+      #else
+        FILE          * file;
+      #endif
+    };
+
+    std::map<std::string, File *> files;
+};
+
+#if CHESS_ENGINE
+  Bitbases bitbases;
+#else
+  extern Bitbases bitbases;
+#endif
@@ -0,0 +1,183 @@
+// Chess engine opening book
+//
+// Guy Turcotte
+// for inclusion in the Chess-InkPlate project
+//
+// (c) January 2021 - GPL-3.0
+
+#include "chess_engine_book.hpp"
+
+#include <chrono>
+#include <algorithm>
+
+#if CHESS_LINUX_BUILD
+  #include <fcntl.h>
+  #include <unistd.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+#endif
+
+static inline uint64_t
+get_be(const uint8_t * p, int len)
+{
+  uint64_t value = 0;
+  for (int i = 0; i < len; i++) value = (value << 8) | p[i];
+  return value;
+}
+
+bool
+OpeningBook::open(const std::string & filename)
+{
+  close();
+
+  size_t size;
+
+  #if CHESS_LINUX_BUILD
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if ((fstat(fd, &st) != 0) || (st.st_size < (off_t) ENTRY_SIZE)) {
+      ::close(fd);
+      return false;
+    }
+
+    void * addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (addr == MAP_FAILED) return false;
+
+    data      = (const uint8_t *) addr;
+    data_size = size = st.st_size;
+  #else
+    if ((file = fopen(filename.c_str(), "rb")) == nullptr) return false;
+
+    if (fseek(file, 0, SEEK_END) != 0) {
+      close();
+      return false;
+    }
+    size = ftell(file);
+  #endif
+
+  entry_count  = size / ENTRY_SIZE;
+  random_state = std::chrono::steady_clock::now().time_since_epoch().count() | 1;
+
+  if (entry_count == 0) close();
+
+  return is_open();
+}
+
+void
+OpeningBook::close()
+{
+  #if CHESS_LINUX_BUILD
+    if (data != nullptr) munmap((void *) data, data_size);
+    data      = nullptr;
+    data_size = 0;
+  #else
+    if (file != nullptr) fclose(file);
+    file = nullptr;
+  #endif
+
+  entry_count = 0;
+}
+
+const uint8_t *
+OpeningBook::fetch(uint32_t first, uint32_t count)
+{
+  if ((count == 0) || (count > BUFFER_ENTRIES) || (first + count > entry_count)) return nullptr;
+
+  #if CHESS_LINUX_BUILD
+    return data + ((size_t) first * ENTRY_SIZE);
+  #else
+    if (fseek(file, (long) first * ENTRY_SIZE, SEEK_SET) != 0) return nullptr;
+    if (fread(buffer, ENTRY_SIZE, count, file) != count) return nullptr;
+    return buffer;
+  #endif
+}
+
+int
+OpeningBook::probe(uint64_t key, BookEntry * entries, int max)
+{
+  if (!is_open()) return 0;
+
+  // Lower bound of the key. Single entries are read until the remaining
+  // range fits in one fetch.
+
+  uint32_t lo = 0, hi = entry_count;
+  const uint8_t * p;
+
+  while ((hi - lo) > BUFFER_ENTRIES) {
+    uint32_t mid = lo + ((hi - lo) >> 1);
+    if ((p = fetch(mid, 1)) == nullptr) return 0;
+    if (get_be(p, 8) < key) lo = mid + 1;
+    else                    hi = mid;
+  }
+
+  uint32_t count = hi - lo;
+  if (count == 0) return 0;
+  if ((p = fetch(lo, count)) == nullptr) return 0;
+
+  uint32_t i = 0;
+  while ((i < count) && (get_be(p + (i * ENTRY_SIZE), 8) < key)) i++;
+
+  // Collect the entries of the key, which may extend beyond the range.
+
+  uint32_t idx   = lo + i;
+  int      found = 0;
+
+  while ((found < max) && (idx < entry_count)) {
+    count = std::min<uint32_t>(BUFFER_ENTRIES, entry_count - idx);
+    if ((p = fetch(idx, count)) == nullptr) break;
+
+    for (i = 0; (i < count) && (found < max); i++, p += ENTRY_SIZE) {
+      if (get_be(p, 8) != key) return found;
+      entries[found].key    = key;
+      entries[found].move   = get_be(p +  8, 2);
+      entries[found].weight = get_be(p + 10, 2);
+      found++;
+    }
+    idx += count;
+  }
+
+  return found;
+}
+
+uint32_t
+OpeningBook::random()
+{
+  // xorshift64*
+  random_state ^= random_state >> 12;
+  random_state ^= random_state << 25;
+  random_state ^= random_state >> 27;
+  return (random_state * 0x2545F4914F6CDD1DULL) >> 32;
+}
+
+bool
+OpeningBook::choose(uint64_t key, uint16_t & move)
+{
+  BookEntry entries[MAX_BOOK_MOVES];
+
+  int count = probe(key, entries, MAX_BOOK_MOVES);
+  if (count == 0) return false;
+
+  uint32_t total = 0;
+  for (int i = 0; i < count; i++) total += entries[i].weight;
+
+  // All weights at 0: the moves are equally good.
+  if (total == 0) {
+    move = entries[random() % count].move;
+    return true;
+  }
+
+  uint32_t pick = random() % total;
+  for (int i = 0; i < count; i++) {
+    if (pick < entries[i].weight) {
+      move = entries[i].move;
+      return true;
+    }
+    pick -= entries[i].weight;
+  }
+
+  move = entries[count - 1].move;
+  return true;
+}
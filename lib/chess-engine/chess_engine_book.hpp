@@ -0,0 +1,96 @@
+// Chess engine opening book
+//
+// Guy Turcotte
+// for inclusion in the Chess-InkPlate project
+//
+// (c) January 2021 - GPL-3.0
+
+#pragma once
+
+// Opening book reader for Polyglot .bin files. The file is a sequence of 16
+// bytes entries (big endian), sorted by position key:
+//
+//   key    (8 bytes) : Position key (see chess_engine_zobrist.hpp)
+//   move   (2 bytes) : To file (bits 0-2), to rank (3-5), from file (6-8),
+//                      from rank (9-11), promotion (12-14: none, N, B, R, Q)
+//   weight (2 bytes) : Relative weight of the move for the position
+//   learn  (4 bytes) : Unused
+//
+// Castling moves are coded as the king taking its own rook (e1h1, e1a1, ...).
+//
+// The entries of a position are found with a binary search. On Linux, the
+// file is memory mapped. On the ESP32, the file stays on the SD card and is
+// read through a small buffer: the search seeks to single entries until the
+// remaining range fits in the buffer, which is then read in one access.
+
+#include <cinttypes>
+#include <string>
+
+#if CHESS_LINUX_BUILD
+  #include <cstddef>
+#else
+  #include <cstdio>
+#endif
+
+struct BookEntry {
+  uint64_t key;
+  uint16_t move;
+  uint16_t weight;
+};
+
+class OpeningBook
+{
+  public:
+    static constexpr int    MAX_BOOK_MOVES = 32;  // Maximum moves kept for a position
+    static constexpr size_t ENTRY_SIZE     = 16;
+
+    OpeningBook() :
+      #if CHESS_LINUX_BUILD
+        data(nullptr),
+        data_size(0),
+      #else
+        file(nullptr),
+      #endif
+        entry_count(0),
+        random_state(0) { }
+
+    ~OpeningBook() { close(); }
+
+    bool          open(const std::string & filename);
+    void         close();
+    inline bool is_open() const { return entry_count > 0; }
+    inline uint32_t size() const { return entry_count; }
+
+    // Retrieves up to max entries for the position key. Returns the number
+    // of entries found.
+    int          probe(uint64_t key, BookEntry * entries, int max);
+
+    // Selects one of the moves of the position, at random, in proportion to
+    // their weight. Returns false if the position is not in the book.
+    bool        choose(uint64_t key, uint16_t & move);
+
+  private:
+    static constexpr int BUFFER_ENTRIES = 32;
+
+    #if CHESS_LINUX_BUILD
+      const uint8_t * data;
+      size_t          data_size;
+    #else
+      FILE          * file;
+      uint8_t         buffer[BUFFER_ENTRIES * ENTRY_SIZE];
+    #endif
+
+    uint32_t entry_count;
+    uint64_t random_state;
+
+    // Returns a pointer on count raw entries (count <= BUFFER_ENTRIES),
+    // starting at entry first, or nullptr if they cannot be read.
+    const uint8_t * fetch(uint32_t first, uint32_t count);
+    uint32_t       random();
+};
+
+#if CHESS_ENGINE
+  OpeningBook opening_book;
+#else
+  extern OpeningBook opening_book;
+#endif
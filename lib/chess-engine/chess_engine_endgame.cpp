@@ -0,0 +1,96 @@
+// Chess engine endgame recognition
+//
+// Guy Turcotte
+// for inclusion in the Chess-InkPlate project
+//
+// (c) January 2021 - GPL-3.0
+
+#include "chess_engine_endgame.hpp"
+#include "chess_engine_types.hpp"
+
+#include <cstring>
+
+// Signature of the pieces of one side, kings excluded: P, N, R, Q, and L or
+// D for a bishop on a light or dark square.
+static uint64_t
+side_signature(const char * pieces, bool white)
+{
+  uint64_t signature = 0;
+
+  for (const char * p = pieces; *p; p++) {
+    int8_t fig;
+    int    sq = 0;                    // a8, a light square
+    switch (*p) {
+      case 'P': fig = PAWN;           break;
+      case 'N': fig = KNIGHT;         break;
+      case 'L': fig = BISHOP;         break;
+      case 'D': fig = BISHOP; sq = 1; break;
+      case 'R': fig = ROOK;           break;
+      default:  fig = QUEEN;          break;
+    }
+    signature += Endgames::piece_signature(white ? fig : -fig, sq);
+  }
+
+  return signature;
+}
+
+void
+Endgames::add(uint64_t signature, Kind kind, bool white_strong)
+{
+  int idx = hash(signature);
+  while ((entries[idx].kind != Kind::NONE) && (signatures[idx] != signature)) idx = (idx + 1) & (SIZE - 1);
+
+  signatures[idx] = signature;
+  entries[idx]    = { kind, white_strong };
+}
+
+// The ending is registered for both colors of the stronger side.
+void
+Endgames::add(const char * strong, const char * weak, Kind kind)
+{
+  add(side_signature(strong, true ) + side_signature(weak, false), kind, true );
+  add(side_signature(weak,   true ) + side_signature(strong, false), kind, false);
+}
+
+void
+Endgames::init()
+{
+  if (ready) return;
+
+  memset(signatures, 0, sizeof(signatures));
+  for (int i = 0; i < SIZE; i++) entries[i] = { Kind::NONE, true };
+
+  // Dead draws: a lone minor piece, or bishops all on squares of the same
+  // color (bishops promoted included).
+  add("N", "", Kind::DEAD_DRAW);
+  for (int white = 0; white <= 9; white++) {
+    for (int black = 0; black <= 9; black++) {
+      uint64_t light = white * piece_signature(BISHOP, 0) + black * piece_signature(-BISHOP, 0);
+      uint64_t dark  = white * piece_signature(BISHOP, 1) + black * piece_signature(-BISHOP, 1);
+      add(light, Kind::DEAD_DRAW, white >= black);
+      add(dark,  Kind::DEAD_DRAW, white >= black);
+    }
+  }
+  add("L", "D", Kind::DEAD_DRAW);
+
+  // No mate can be forced
+  add("NN", "",  Kind::DRAW);
+  add("N",  "N", Kind::DRAW);
+  add("N",  "L", Kind::DRAW);
+  add("N",  "D", Kind::DRAW);
+
+  add("P",  "",  Kind::KPK);
+
+  // A lone king to be mated
+  add("Q",  "",  Kind::MOP_UP);
+  add("R",  "",  Kind::MOP_UP);
+  add("QQ", "",  Kind::MOP_UP);
+  add("RQ", "",  Kind::MOP_UP);
+  add("RR", "",  Kind::MOP_UP);
+  add("LD", "",  Kind::MOP_UP);
+
+  add("LN", "",  Kind::KBNK);
+  add("DN", "",  Kind::KBNK);
+
+  ready = true;
+}
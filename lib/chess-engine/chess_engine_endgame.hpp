@@ -0,0 +1,86 @@
+// Chess engine endgame recognition
+//
+// Guy Turcotte
+// for inclusion in the Chess-InkPlate project
+//
+// (c) January 2021 - GPL-3.0
+
+#pragma once
+
+// Material signature of a position: the number of pieces of each kind and
+// color, 4 bits each, white ones in the lower 32 bits and black ones in the
+// upper 32 bits. Bishops are counted by the color of their square. The
+// signature of the root position is computed by solve_step() and kept up to
+// date by move_pos() on captures and promotions.
+//
+// The endings known by the engine are registered in a small hash table
+// indexed by signature, giving the way to evaluate them: dead draws (no
+// checkmate possible, also used to end the game), other draws, KPK (from the
+// built-in bitbase), mating a lone king (mop-up) and KBNK.
+
+#include <cinttypes>
+
+class Endgames
+{
+  public:
+    enum class Kind : uint8_t { NONE, DEAD_DRAW, DRAW, KPK, MOP_UP, KBNK };
+
+    struct Entry {
+      Kind kind;
+      bool white_strong;            // White is the side trying to win
+    };
+
+    Endgames() : ready(false) { }
+
+    void                init();
+    inline bool is_ready() const { return ready; }
+
+    // Entry of the signature, of kind NONE for the endings not known.
+    inline const Entry & probe(uint64_t signature) const {
+      int idx = hash(signature);
+      while ((entries[idx].kind != Kind::NONE) && (signatures[idx] != signature)) idx = (idx + 1) & (SIZE - 1);
+      return entries[idx];
+    }
+
+    // Signature of a single piece on a board square (a8 = 0). Kings are not
+    // counted.
+    static inline uint64_t piece_signature(int8_t fig, int sq) {
+      return (fig == 0) || (fig == 6) || (fig == -6) ? 0 : (1ULL << shift(fig, sq));
+    }
+
+    // Number of pieces fig of the signature, bishops being counted on
+    // squares of the color of sq.
+    static inline int count(uint64_t signature, int8_t fig, int sq = 0) {
+      return (signature >> shift(fig, sq)) & 15;
+    }
+
+    static inline bool light_square(int sq) { return (((sq >> 3) + (sq & 7)) & 1) == 0; }
+
+  private:
+    static constexpr int SIZE = 512;
+
+    // Pawns, knights, bishops on light squares, bishops on dark squares,
+    // rooks and queens.
+    static inline int shift(int8_t fig, int sq) {
+      static constexpr int8_t slots[7] = { 0, 0, 1, 2, 4, 5, 0 };
+      int f = (fig < 0) ? -fig : fig;
+      return ((fig < 0) ? 32 : 0) + 4 * (slots[f] + (((f == 3) && !light_square(sq)) ? 1 : 0));
+    }
+
+    static inline int hash(uint64_t signature) {
+      return (signature * 0x9E3779B97F4A7C15ULL) >> 55;
+    }
+
+    void add(uint64_t signature, Kind kind, bool white_strong);
+    void add(const char * strong, const char * weak, Kind kind);
+
+    bool     ready;
+    uint64_t signatures[SIZE];
+    Entry    entries[SIZE];
+};
+
+#if CHESS_ENGINE
+  Endgames endgames;
+#else
+  extern Endgames endgames;
+#endif
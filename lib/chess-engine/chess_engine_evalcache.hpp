@@ -0,0 +1,77 @@
+// Chess engine evaluation cache
+//
+// Guy Turcotte
+// for inclusion in the Chess-InkPlate project
+//
+// (c) January 2021 - GPL-3.0
+
+#pragma once
+
+// Direct-mapped cache of the static evaluation, indexed by the Zobrist key
+// of the position. Only the part of the evaluation depending on the
+// position alone is kept (material, piece-square, pawn structure and king
+// shelter, as middle game and endgame scores): the terms coming from the
+// steps generated on the way to the position are added after a probe. A
+// hit then gives the same evaluation as a full one, and the cache is never
+// cleared.
+//
+// The cache has 1 << CHESS_EVAL_CACHE_BITS entries of 8 bytes (8 KB by
+// default, -D CHESS_EVAL_CACHE_BITS=... in platformio.ini), in the ESP32
+// internal RAM.
+
+#ifndef CHESS_EVAL_CACHE_BITS
+  #define CHESS_EVAL_CACHE_BITS 10
+#endif
+
+#include <cinttypes>
+
+class EvalCache
+{
+  public:
+    static constexpr uint32_t SIZE = 1UL << CHESS_EVAL_CACHE_BITS;
+
+    EvalCache() : hits(0), misses(0) { }
+
+    // Scores of the position of key key. Returns false if not in the cache.
+    inline bool probe(uint64_t key, int & mg, int & eg) {
+      const Entry & entry = entries[key & (SIZE - 1)];
+
+      if (entry.check == (uint32_t)(key >> 32)) {
+        mg = entry.mg;
+        eg = entry.eg;
+        hits++;
+        return true;
+      }
+      misses++;
+      return false;
+    }
+
+    inline void store(uint64_t key, int mg, int eg) {
+      Entry & entry = entries[key & (SIZE - 1)];
+
+      entry.check = key >> 32;
+      entry.mg    = mg;
+      entry.eg    = eg;
+    }
+
+    inline void      clear_stats() { hits = misses = 0; }
+    inline unsigned long get_hits() const { return hits;   }
+    inline unsigned long get_misses() const { return misses; }
+
+  private:
+    struct Entry {
+      uint32_t check;                // Upper 32 bits of the key
+      int16_t  mg;
+      int16_t  eg;
+    };
+
+    Entry         entries[SIZE];
+    unsigned long hits;
+    unsigned long misses;
+};
+
+#if CHESS_ENGINE
+  EvalCache eval_cache;
+#else
+  extern EvalCache eval_cache;
+#endif
@@ -0,0 +1,177 @@
+// Chess engine KPK bitbase
+//
+// Guy Turcotte
+// for inclusion in the Chess-InkPlate project
+//
+// (c) January 2021 - GPL-3.0
+//
+// The index layout and the classification of the positions (initial values,
+// then iterations over the moves) are a port of Stockfish's bitbase.cpp
+// (GPL-3.0), (c) 2004-2008 Tord Romstad, 2008-2015 Marco Costalba, Joona
+// Kiiski and Tord Romstad, and the Stockfish developers.
+
+#include "chess_engine_kpk.hpp"
+
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+
+// Values of the positions while building, 2 bits each
+enum KPKValue : uint8_t { INVALID = 0, UNKNOWN = 1, DRAW = 2, WIN = 3 };
+
+// Values as flags, to be combined over the moves of a position
+static const uint8_t value_flag[4] = { 0, 1, 2, 4 };
+
+static inline int    file_of(int sq) { return sq & 7;  }
+static inline int    rank_of(int sq) { return sq >> 3; }
+
+static inline int
+distance(int s1, int s2)
+{
+  return std::max(abs(file_of(s1) - file_of(s2)), abs(rank_of(s1) - rank_of(s2)));
+}
+
+// The pawn is on files a-d, ranks 2-7
+static inline uint32_t
+kpk_index(bool white_move, int bk, int wk, int wp)
+{
+  return wk | (bk << 6) | ((white_move ? 0 : 1) << 12) | (file_of(wp) << 13) | ((6 - rank_of(wp)) << 15);
+}
+
+static inline bool
+pawn_attacks(int wp, int sq)
+{
+  return (rank_of(sq) == rank_of(wp) + 1) && (abs(file_of(sq) - file_of(wp)) == 1);
+}
+
+static inline uint8_t
+get_value(const uint8_t * values, uint32_t idx)
+{
+  return (values[idx >> 2] >> ((idx & 3) << 1)) & 3;
+}
+
+static inline void
+set_value(uint8_t * values, uint32_t idx, uint8_t value)
+{
+  int shift = (idx & 3) << 1;
+  values[idx >> 2] = (values[idx >> 2] & ~(3 << shift)) | (value << shift);
+}
+
+static uint8_t
+initial_value(bool white_move, int bk, int wk, int wp)
+{
+  if ((distance(wk, bk) <= 1) || (wk == wp) || (bk == wp) || (white_move && pawn_attacks(wp, bk))) return INVALID;
+
+  // Immediate promotion, the queen not being taken
+  if (white_move && (rank_of(wp) == 6) && (wk != wp + 8) && ((distance(bk, wp + 8) > 1) || (distance(wk, wp + 8) == 1))) return WIN;
+
+  if (!white_move) {
+    bool can_move = false;
+    for (int dr = -1; dr <= 1; dr++) {
+      for (int df = -1; df <= 1; df++) {
+        if ((dr == 0) && (df == 0)) continue;
+        int r = rank_of(bk) + dr, f = file_of(bk) + df;
+        if ((r < 0) || (r > 7) || (f < 0) || (f > 7)) continue;
+        int sq = (r << 3) | f;
+        if ((distance(sq, wk) > 1) && !pawn_attacks(wp, sq)) {
+          if (sq == wp) return DRAW;   // The pawn is taken
+          can_move = true;
+        }
+      }
+    }
+    if (!can_move) return DRAW;      // Stalemate
+  }
+
+  return UNKNOWN;
+}
+
+// Value from the values of the positions reached by the moves: a winning
+// move for white, or all moves winning for black.
+static uint8_t
+classify(const uint8_t * values, bool white_move, int bk, int wk, int wp)
+{
+  uint8_t good   = white_move ? WIN  : DRAW;
+  uint8_t bad    = white_move ? DRAW : WIN;
+  uint8_t result = 0;
+  int     king   = white_move ? wk : bk;
+
+  for (int dr = -1; dr <= 1; dr++) {
+    for (int df = -1; df <= 1; df++) {
+      if ((dr == 0) && (df == 0)) continue;
+      int r = rank_of(king) + dr, f = file_of(king) + df;
+      if ((r < 0) || (r > 7) || (f < 0) || (f > 7)) continue;
+      int sq = (r << 3) | f;
+      result |= value_flag[white_move ? get_value(values, kpk_index(false, bk, sq, wp))
+                                      : get_value(values, kpk_index(true,  sq, wk, wp))];
+    }
+  }
+
+  if (white_move) {
+    if (rank_of(wp) < 6) result |= value_flag[get_value(values, kpk_index(false, bk, wk, wp + 8))];
+    if ((rank_of(wp) == 1) && (wp + 8 != wk) && (wp + 8 != bk)) {
+      result |= value_flag[get_value(values, kpk_index(false, bk, wk, wp + 16))];
+    }
+  }
+
+  if (result & value_flag[good]   ) return good;
+  if (result & value_flag[UNKNOWN]) return UNKNOWN;
+  return bad;
+}
+
+void
+KPKBitbase::init()
+{
+  if (ready) return;
+
+  uint8_t * values = new uint8_t[MAX_INDEX / 4];
+
+  for (uint32_t idx = 0; idx < MAX_INDEX; idx++) {
+    int  wk         = idx & 63;
+    int  bk         = (idx >> 6) & 63;
+    bool white_move = ((idx >> 12) & 1) == 0;
+    int  wp         = ((6 - (idx >> 15)) << 3) | ((idx >> 13) & 3);
+
+    set_value(values, idx, initial_value(white_move, bk, wk, wp));
+  }
+
+  bool changed;
+  do {
+    changed = false;
+    for (uint32_t idx = 0; idx < MAX_INDEX; idx++) {
+      if (get_value(values, idx) != UNKNOWN) continue;
+
+      int  wk         = idx & 63;
+      int  bk         = (idx >> 6) & 63;
+      bool white_move = ((idx >> 12) & 1) == 0;
+      int  wp         = ((6 - (idx >> 15)) << 3) | ((idx >> 13) & 3);
+
+      uint8_t value = classify(values, white_move, bk, wk, wp);
+      if (value != UNKNOWN) {
+        set_value(values, idx, value);
+        changed = true;
+      }
+    }
+  } while (changed);
+
+  memset(bits, 0, sizeof(bits));
+  for (uint32_t idx = 0; idx < MAX_INDEX; idx++) {
+    if (get_value(values, idx) == WIN) bits[idx >> 5] |= 1UL << (idx & 31);
+  }
+
+  delete [] values;
+
+  ready = true;
+}
+
+bool
+KPKBitbase::probe(int wk, int wp, int bk, bool white_move)
+{
+  if (!ready) init();
+
+  if (file_of(wp) > 3) {
+    wk ^= 7; wp ^= 7; bk ^= 7;
+  }
+
+  uint32_t idx = kpk_index(white_move, bk, wk, wp);
+  return (bits[idx >> 5] >> (idx & 31)) & 1;
+}
@@ -0,0 +1,50 @@
+// Chess engine KPK bitbase
+//
+// Guy Turcotte
+// for inclusion in the Chess-InkPlate project
+//
+// (c) January 2021 - GPL-3.0
+//
+// The index layout and the classification of the positions (initial values,
+// then iterations over the moves) are a port of Stockfish's bitbase.cpp
+// (GPL-3.0), (c) 2004-2008 Tord Romstad, 2008-2015 Marco Costalba, Joona
+// Kiiski and Tord Romstad, and the Stockfish developers.
+
+#pragma once
+
+// King and pawn against king: one bit per position, set if the side with
+// the pawn wins. The bitbase is computed once, at engine setup (or on the
+// first probe), by retrograde analysis over the 196608 positions: side to
+// move, pawn on files a-d and ranks 2-7, both kings anywhere. It is built
+// with its own simple move rules, without the engine move generator, and
+// takes 24 KB once built (48 KB more while building).
+//
+// Squares are numbered from a1 (0) to h8 (63), the engine board index with
+// its rank flipped. The side with the pawn is white.
+
+#include <cinttypes>
+
+class KPKBitbase
+{
+  public:
+    KPKBitbase() : ready(false) { }
+
+    void                init();
+    inline bool is_ready() const { return ready; }
+
+    // True if white (with the pawn) wins. wk, bk and wp are a1 based
+    // squares; the position must be legal.
+    bool               probe(int wk, int wp, int bk, bool white_move);
+
+  private:
+    static constexpr int MAX_INDEX = 2 * 24 * 64 * 64;
+
+    bool     ready;
+    uint32_t bits[MAX_INDEX / 32];
+};
+
+#if CHESS_ENGINE
+  KPKBitbase kpk_bitbase;
+#else
+  extern KPKBitbase kpk_bitbase;
+#endif
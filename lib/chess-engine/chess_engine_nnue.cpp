@@ -0,0 +1,275 @@
+// Chess engine neural network evaluation
+//
+// Guy Turcotte
+// for inclusion in the Chess-InkPlate project
+//
+// (c) January 2021 - GPL-3.0
+
+#include "chess_engine_nnue.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#if !CHESS_LINUX_BUILD
+  #include "esp_heap_caps.h"
+#endif
+
+#if CHESS_NNUE_SCALAR
+  #define NNUE_KERNELS "scalar"
+#elif defined(__AVX2__)
+  #define NNUE_AVX2 1
+  #define NNUE_KERNELS "AVX2"
+  #include <immintrin.h>
+#elif defined(__SSE2__)
+  #define NNUE_SSE2 1
+  #define NNUE_KERNELS "SSE2"
+  #include <emmintrin.h>
+#else
+  #define NNUE_SWAR 1
+  #define NNUE_KERNELS "SWAR"
+#endif
+
+static const int H = Nnue::HIDDEN;
+
+// ----- Kernels -----
+//
+// vec_add / vec_sub: dst = src + w / dst = src - w, for the HIDDEN values of
+// an accumulator (dst may be src). output_dot: sum of w times the values
+// clipped to 0..127.
+
+#if NNUE_AVX2
+
+  static inline void
+  vec_add(int16_t * dst, const int16_t * src, const int16_t * w)
+  {
+    for (int i = 0; i < H; i += 16) {
+      __m256i v = _mm256_add_epi16(_mm256_loadu_si256((const __m256i *)(src + i)),
+                                   _mm256_loadu_si256((const __m256i *)(w   + i)));
+      _mm256_storeu_si256((__m256i *)(dst + i), v);
+    }
+  }
+
+  static inline void
+  vec_sub(int16_t * dst, const int16_t * src, const int16_t * w)
+  {
+    for (int i = 0; i < H; i += 16) {
+      __m256i v = _mm256_sub_epi16(_mm256_loadu_si256((const __m256i *)(src + i)),
+                                   _mm256_loadu_si256((const __m256i *)(w   + i)));
+      _mm256_storeu_si256((__m256i *)(dst + i), v);
+    }
+  }
+
+  static inline int32_t
+  output_dot(const int16_t * values, const int16_t * w)
+  {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i top  = _mm256_set1_epi16(127);
+    __m256i       sum  = _mm256_setzero_si256();
+
+    for (int i = 0; i < H; i += 16) {
+      __m256i v = _mm256_min_epi16(_mm256_max_epi16(_mm256_loadu_si256((const __m256i *)(values + i)), zero), top);
+      sum = _mm256_add_epi32(sum, _mm256_madd_epi16(v, _mm256_loadu_si256((const __m256i *)(w + i))));
+    }
+
+    __m128i s = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0x4E));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0xB1));
+    return _mm_cvtsi128_si32(s);
+  }
+
+#elif NNUE_SSE2
+
+  static inline void
+  vec_add(int16_t * dst, const int16_t * src, const int16_t * w)
+  {
+    for (int i = 0; i < H; i += 8) {
+      __m128i v = _mm_add_epi16(_mm_loadu_si128((const __m128i *)(src + i)),
+                                _mm_loadu_si128((const __m128i *)(w   + i)));
+      _mm_storeu_si128((__m128i *)(dst + i), v);
+    }
+  }
+
+  static inline void
+  vec_sub(int16_t * dst, const int16_t * src, const int16_t * w)
+  {
+    for (int i = 0; i < H; i += 8) {
+      __m128i v = _mm_sub_epi16(_mm_loadu_si128((const __m128i *)(src + i)),
+                                _mm_loadu_si128((const __m128i *)(w   + i)));
+      _mm_storeu_si128((__m128i *)(dst + i), v);
+    }
+  }
+
+  static inline int32_t
+  output_dot(const int16_t * values, const int16_t * w)
+  {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i top  = _mm_set1_epi16(127);
+    __m128i       sum  = _mm_setzero_si128();
+
+    for (int i = 0; i < H; i += 8) {
+      __m128i v = _mm_min_epi16(_mm_max_epi16(_mm_loadu_si128((const __m128i *)(values + i)), zero), top);
+      sum = _mm_add_epi32(sum, _mm_madd_epi16(v, _mm_loadu_si128((const __m128i *)(w + i))));
+    }
+
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0x4E));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0xB1));
+    return _mm_cvtsi128_si32(sum);
+  }
+
+#else
+
+  #if NNUE_SWAR
+
+    // Two int16 per 32-bit word, the carry out of the low half being kept
+    // out of the high half.
+    static const uint32_t HIGH_BITS = 0x80008000UL;
+
+    static inline void
+    vec_add(int16_t * dst, const int16_t * src, const int16_t * w)
+    {
+      for (int i = 0; i < H; i += 2) {
+        uint32_t a, b, r;
+        memcpy(&a, src + i, 4);
+        memcpy(&b, w   + i, 4);
+        r = ((a & ~HIGH_BITS) + (b & ~HIGH_BITS)) ^ ((a ^ b) & HIGH_BITS);
+        memcpy(dst + i, &r, 4);
+      }
+    }
+
+    static inline void
+    vec_sub(int16_t * dst, const int16_t * src, const int16_t * w)
+    {
+      for (int i = 0; i < H; i += 2) {
+        uint32_t a, b, r;
+        memcpy(&a, src + i, 4);
+        memcpy(&b, w   + i, 4);
+        r = ((a | HIGH_BITS) - (b & ~HIGH_BITS)) ^ ((a ^ ~b) & HIGH_BITS);
+        memcpy(dst + i, &r, 4);
+      }
+    }
+
+  #else
+
+    static inline void
+    vec_add(int16_t * dst, const int16_t * src, const int16_t * w)
+    {
+      for (int i = 0; i < H; i++) dst[i] = src[i] + w[i];
+    }
+
+    static inline void
+    vec_sub(int16_t * dst, const int16_t * src, const int16_t * w)
+    {
+      for (int i = 0; i < H; i++) dst[i] = src[i] - w[i];
+    }
+
+  #endif
+
+  static inline int32_t
+  output_dot(const int16_t * values, const int16_t * w)
+  {
+    int32_t sum = 0;
+
+    for (int i = 0; i < H; i++) {
+      int v = values[i];
+      if (v < 0) v = 0; else if (v > 127) v = 127;
+      sum += v * w[i];
+    }
+    return sum;
+  }
+
+#endif
+
+// ----- Network -----
+
+const char *
+Nnue::kernels()
+{
+  return NNUE_KERNELS;
+}
+
+void
+Nnue::unload()
+{
+  free(ft_weights);
+  ft_weights = nullptr;
+  ready      = false;
+}
+
+bool
+Nnue::load(const std::string & filename)
+{
+  unload();
+
+  FILE * file = fopen(filename.c_str(), "rb");
+  if (file == nullptr) return false;
+
+  char     magic[4];
+  uint32_t header[3];
+  int8_t   out8[2 * HIDDEN];
+  size_t   size = (size_t) INPUTS * HIDDEN * sizeof(int16_t);
+
+  #if CHESS_LINUX_BUILD
+    ft_weights = (int16_t *) malloc(size);
+  #else
+    ft_weights = (int16_t *) heap_caps_malloc(size, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    if (ft_weights == nullptr) ft_weights = (int16_t *) heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+  #endif
+
+  bool ok = (ft_weights != nullptr) &&
+            (fread(magic,      1, 4,           file) == 4) && (memcmp(magic, "CINN", 4) == 0) &&
+            (fread(header,     4, 3,           file) == 3) &&
+            (header[0] == VERSION) && (header[1] == INPUTS) && (header[2] == HIDDEN) &&
+            (fread(ft_bias,    2, HIDDEN,      file) == HIDDEN) &&
+            (fread(ft_weights, 2, INPUTS * HIDDEN, file) == (size_t) INPUTS * HIDDEN) &&
+            (fread(out8,       1, 2 * HIDDEN,  file) == 2 * HIDDEN) &&
+            (fread(&out_bias,  4, 1,           file) == 1);
+
+  fclose(file);
+
+  if (!ok) {
+    unload();
+    return false;
+  }
+
+  for (int i = 0; i < 2 * HIDDEN; i++) out_weights[i] = out8[i];
+  ready = true;
+
+  return true;
+}
+
+void
+Nnue::refresh(const int8_t * board, NnueAccumulator & acc) const
+{
+  for (int p = 0; p < 2; p++) {
+    memcpy(acc.values[p], ft_bias, sizeof(ft_bias));
+    for (int i = 0; i < 64; i++) {
+      if (board[i] != 0) vec_add(acc.values[p], acc.values[p], weights(p, board[i], i));
+    }
+  }
+}
+
+void
+Nnue::update(const NnueAccumulator & from, NnueAccumulator & to,
+             const Change * added,   int added_count,
+             const Change * removed, int removed_count) const
+{
+  for (int p = 0; p < 2; p++) {
+    int16_t * values = to.values[p];
+
+    vec_add(values, from.values[p], weights(p, added[0].fig, added[0].board_idx));
+    for (int i = 1; i < added_count;   i++) vec_add(values, values, weights(p, added[i].fig,   added[i].board_idx));
+    for (int i = 0; i < removed_count; i++) vec_sub(values, values, weights(p, removed[i].fig, removed[i].board_idx));
+  }
+}
+
+int
+Nnue::evaluate(const NnueAccumulator & acc, bool white_move) const
+{
+  int us   = white_move ? 0 : 1;
+  int sum  = out_bias + output_dot(acc.values[us],     out_weights) +
+                        output_dot(acc.values[us ^ 1], out_weights + HIDDEN);
+
+  return std::max(-MAX_SCORE, std::min(sum >> OUTPUT_SHIFT, MAX_SCORE));
+}
@@ -0,0 +1,124 @@
+// Chess engine neural network evaluation
+//
+// Guy Turcotte
+// for inclusion in the Chess-InkPlate project
+//
+// (c) January 2021 - GPL-3.0
+
+#pragma once
+
+// Optional NNUE (efficiently updatable neural network) evaluation, used in
+// place of the hand-made one when a network file is loaded.
+//
+// The network is small enough for the ESP32:
+//
+//   768 inputs -> 2 x HIDDEN (int16) -> 1 output
+//
+// The inputs are the pieces on the board, seen from each side (the
+// perspective): index (kind * 64 + square), kind being 0 to 5 for the
+// pawn to the king of the perspective side and 6 to 11 for the enemy
+// pieces. Squares are board indexes (a8 = 0) for the white perspective,
+// flipped vertically (a1 = 0) for the black one.
+//
+// The first layer gives an accumulator of HIDDEN values per perspective,
+// the bias plus the weights of the pieces on the board. It is kept for each
+// ply of the search, updated by move_pos() from the accumulator of the
+// parent position with the few inputs changed by the step (as weight_white
+// and weight_black are): back_step() has nothing to undo.
+//
+// The output is computed from the accumulator values clipped to 0..127,
+// side to move first: (bias + sum(weight * value)) >> OUTPUT_SHIFT, in
+// centipawns for the side to move.
+//
+// Network file (little endian):
+//
+//   magic       (4 bytes)            : "CINN"
+//   version     (uint32)             : 1
+//   inputs      (uint32)             : 768
+//   hidden      (uint32)             : HIDDEN
+//   ft_bias     (int16[HIDDEN])
+//   ft_weights  (int16[768][HIDDEN])
+//   out_weights (int8[2 * HIDDEN])   : Side to move, then the other side
+//   out_bias    (int32)
+//
+// HIDDEN is CHESS_NNUE_HIDDEN (32 by default, -D CHESS_NNUE_HIDDEN=... in
+// platformio.ini), a multiple of 16. The first layer weights (48 KB for 32)
+// are put in the ESP32 internal RAM when there is room, else in PSRAM.
+//
+// Kernels: AVX2 or SSE2 when compiled for them on Linux, else 32-bit SIMD
+// within a register (two int16 per word, for the ESP32 which has no vector
+// unit). -D CHESS_NNUE_SCALAR=1 selects the plain C++ loops.
+
+#ifndef CHESS_NNUE_HIDDEN
+  #define CHESS_NNUE_HIDDEN 32
+#endif
+
+#include <cinttypes>
+#include <string>
+
+struct alignas(4) NnueAccumulator {
+  int16_t values[2][CHESS_NNUE_HIDDEN];  // White, black perspectives
+};
+
+class Nnue
+{
+  public:
+    static constexpr int      INPUTS       = 768;
+    static constexpr int      HIDDEN       = CHESS_NNUE_HIDDEN;
+    static constexpr int      OUTPUT_SHIFT = 4;
+    static constexpr int      MAX_SCORE    = 4000; // Kept under the tablebase and mate scores
+    static constexpr uint32_t VERSION      = 1;
+
+    static_assert((HIDDEN % 16) == 0, "CHESS_NNUE_HIDDEN must be a multiple of 16");
+
+    // An input changed by a step: piece fig on square board_idx.
+    struct Change {
+      int8_t fig;
+      int8_t board_idx;
+    };
+
+    Nnue() : ft_weights(nullptr), ready(false) { }
+   ~Nnue() { unload(); }
+
+    // Loads the network file. Returns false if it cannot be read or is not
+    // of this network size: no network is then loaded.
+    bool                 load(const std::string & filename);
+    void               unload();
+    inline bool      is_ready() const { return ready; }
+
+    // Name of the kernels compiled in.
+    static const char * kernels();
+
+    // Accumulator of the pieces of the board.
+    void              refresh(const int8_t * board, NnueAccumulator & acc) const;
+
+    // Accumulator to, from the accumulator from of the parent position and
+    // the changes of the step. There is always at least one added input
+    // (the piece on its destination square).
+    void               update(const NnueAccumulator & from, NnueAccumulator & to,
+                              const Change * added,   int added_count,
+                              const Change * removed, int removed_count) const;
+
+    // Score of the position, in centipawns for the side to move.
+    int              evaluate(const NnueAccumulator & acc, bool white_move) const;
+
+  private:
+    int16_t * ft_weights;
+    int16_t   ft_bias[HIDDEN];
+    int16_t   out_weights[2 * HIDDEN];  // Widened from the int8 of the file
+    int32_t   out_bias;
+    bool      ready;
+
+    inline const int16_t * weights(int perspective, int8_t fig, int board_idx) const {
+      bool own  = (fig > 0) == (perspective == 0);
+      int  kind = (own ? 0 : 6) + ((fig > 0) ? fig : -fig) - 1;
+      int  sq   = (perspective == 0) ? board_idx : board_idx ^ 56;
+      return ft_weights + (kind * 64 + sq) * HIDDEN;
+    }
+};
+
+#if CHESS_ENGINE
+  Nnue nnue;
+#else
+  extern Nnue nnue;
+#endif
@@ -0,0 +1,166 @@
+// Chess engine pawn structure evaluation
+//
+// Guy Turcotte
+// for inclusion in the Chess-InkPlate project
+//
+// (c) January 2021 - GPL-3.0
+
+#include "chess_engine_pawns.hpp"
+#include "chess_engine_types.hpp"
+
+#include <cstdlib>
+#include <cstring>
+
+#if !CHESS_LINUX_BUILD
+  #include "esp_heap_caps.h"
+#endif
+
+// Scores of a pawn, middle game and endgame. The passed pawn bonus is by
+// rank, from the pawn side.
+static const int DOUBLED_MG    = -10, DOUBLED_EG    = -20;
+static const int ISOLATED_MG   = -10, ISOLATED_EG   = -15;
+static const int BACKWARD_MG   =  -8, BACKWARD_EG   = -10;
+static const int passed_mg[9]  = { 0, 0,  5, 10, 15, 25, 40,  60, 0 };
+static const int passed_eg[9]  = { 0, 0, 10, 15, 25, 45, 70, 110, 0 };
+
+PawnTable::~PawnTable()
+{
+  free(entries);
+}
+
+bool
+PawnTable::resize(int kb)
+{
+  if ((kb < 1) || (kb > MAX_KB)) return false;
+
+  uint32_t count = 1;
+  while ((count * 2 * sizeof(Entry)) <= (uint32_t) kb * 1024) count *= 2;
+
+  #if CHESS_LINUX_BUILD
+    Entry * table = (Entry *) malloc(count * sizeof(Entry));
+  #else
+    Entry * table = (Entry *) heap_caps_malloc(count * sizeof(Entry),
+                                               (kb > INTERNAL_KB) ? (MALLOC_CAP_SPIRAM   | MALLOC_CAP_8BIT)
+                                                                  : (MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT));
+  #endif
+
+  if (table == nullptr) return false;
+
+  memset(table, 0, count * sizeof(Entry));
+
+  free(entries);
+  entries = table;
+  mask    = count - 1;
+  size_kb = kb;
+
+  return true;
+}
+
+// Rows are numbered from the top of the board (0: rank 8), so white pawns
+// move toward the lower rows.
+void
+PawnTable::evaluate(const int8_t * board, Scores & scores)
+{
+  // Row of the least advanced pawn of each file (-1 for white and 8 for
+  // black when there is none) and number of pawns. Files are numbered from
+  // 1, with an empty file on both sides.
+  int white_back[10], black_back[10];
+  int white_count[10], black_count[10];
+
+  for (int f = 0; f < 10; f++) {
+    white_back[f]  = -1;
+    black_back[f]  =  8;
+    white_count[f] = black_count[f] = 0;
+  }
+
+  for (int sq = 8; sq < 56; sq++) {
+    int f = (sq & 7) + 1, r = sq >> 3;
+    if (board[sq] == PAWN) {
+      white_count[f]++;
+      if (r > white_back[f]) white_back[f] = r;
+    }
+    else if (board[sq] == -PAWN) {
+      black_count[f]++;
+      if (r < black_back[f]) black_back[f] = r;
+    }
+  }
+
+  int mg = 0, eg = 0;
+
+  scores.white_files = scores.black_files = 0;
+
+  for (int f = 1; f <= 8; f++) {
+    if (white_count[f] > 0) scores.white_files |= 1 << (f - 1);
+    if (black_count[f] > 0) scores.black_files |= 1 << (f - 1);
+    if (white_count[f] > 1) { mg += DOUBLED_MG * (white_count[f] - 1); eg += DOUBLED_EG * (white_count[f] - 1); }
+    if (black_count[f] > 1) { mg -= DOUBLED_MG * (black_count[f] - 1); eg -= DOUBLED_EG * (black_count[f] - 1); }
+  }
+
+  for (int sq = 8; sq < 56; sq++) {
+    int f = (sq & 7) + 1, r = sq >> 3;
+
+    if (board[sq] == PAWN) {
+      bool isolated = (white_count[f - 1] == 0) && (white_count[f + 1] == 0);
+      bool passed   = (black_back[f - 1] >= r) && (black_back[f] >= r) && (black_back[f + 1] >= r);
+
+      if (passed) {
+        mg += passed_mg[8 - r];
+        eg += passed_eg[8 - r];
+      }
+      if (isolated) {
+        mg += ISOLATED_MG;
+        eg += ISOLATED_EG;
+      }
+      else if (!passed &&
+               (white_back[f - 1] < r) && (white_back[f + 1] < r) &&
+               (r >= 2) && (((f > 1) && (board[sq - 17] == -PAWN)) ||
+                            ((f < 8) && (board[sq - 15] == -PAWN)))) {
+        // All the pawns of the adjacent files are ahead, and the square in
+        // front is attacked by a black pawn.
+        mg += BACKWARD_MG;
+        eg += BACKWARD_EG;
+      }
+    }
+    else if (board[sq] == -PAWN) {
+      bool isolated = (black_count[f - 1] == 0) && (black_count[f + 1] == 0);
+      bool passed   = (white_back[f - 1] <= r) && (white_back[f] <= r) && (white_back[f + 1] <= r);
+
+      if (passed) {
+        mg -= passed_mg[r + 1];
+        eg -= passed_eg[r + 1];
+      }
+      if (isolated) {
+        mg -= ISOLATED_MG;
+        eg -= ISOLATED_EG;
+      }
+      else if (!passed &&
+               (black_back[f - 1] > r) && (black_back[f + 1] > r) &&
+               (r <= 5) && (((f > 1) && (board[sq + 15] == PAWN)) ||
+                            ((f < 8) && (board[sq + 17] == PAWN)))) {
+        mg -= BACKWARD_MG;
+        eg -= BACKWARD_EG;
+      }
+    }
+  }
+
+  scores.mg = mg;
+  scores.eg = eg;
+
+  scores.white_outposts = scores.black_outposts = 0;
+
+  for (int sq = 16; sq < 48; sq++) {
+    int f = (sq & 7) + 1, r = sq >> 3;
+    int bit;
+
+    if (((bit = outpost_bit(sq, true)) >= 0) &&
+        (black_back[f - 1] >= r) && (black_back[f + 1] >= r) &&
+        (((f > 1) && (board[sq + 7] == PAWN)) || ((f < 8) && (board[sq + 9] == PAWN)))) {
+      scores.white_outposts |= 1UL << bit;
+    }
+    if (((bit = outpost_bit(sq, false)) >= 0) &&
+        (white_back[f - 1] <= r) && (white_back[f + 1] <= r) &&
+        (((f > 1) && (board[sq - 9] == -PAWN)) || ((f < 8) && (board[sq - 7] == -PAWN)))) {
+      scores.black_outposts |= 1UL << bit;
+    }
+  }
+}
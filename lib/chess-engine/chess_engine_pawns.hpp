@@ -0,0 +1,105 @@
+// Chess engine pawn structure evaluation
+//
+// Guy Turcotte
+// for inclusion in the Chess-InkPlate project
+//
+// (c) January 2021 - GPL-3.0
+
+#pragma once
+
+// Passed, isolated, doubled and backward pawns, as middle game and endgame
+// scores (white minus black) added to the tapered evaluation. The files
+// holding pawns of each side are also kept, for the open files near the
+// kings, and the outpost squares of each side.
+//
+// The pawns change on few moves of a search: the scores are kept in a hash
+// table indexed by the pawn key of the position (Zobrist key of the pawns
+// only, see Position::pawn_key), the analysis of the board being done only
+// when the pawn structure is not in the table. An entry depends only on the
+// pawns: the table is never cleared.
+//
+// The table size is CHESS_PAWN_HASH_KB kilobytes by default (-D
+// CHESS_PAWN_HASH_KB=... in platformio.ini), changed with the pawn_hash
+// engine option. Small tables are allocated in the ESP32 internal RAM, the
+// larger ones in PSRAM.
+
+#ifndef CHESS_PAWN_HASH_KB
+  #define CHESS_PAWN_HASH_KB 16
+#endif
+
+#include <cinttypes>
+
+class PawnTable
+{
+  public:
+    static constexpr int MAX_KB      = 4096;
+    static constexpr int INTERNAL_KB =   32; // Largest table put in the ESP32 internal RAM
+
+    // Outposts: squares of the 4th to 6th ranks (from the side point of
+    // view) defended by a pawn of the side and that no enemy pawn can
+    // attack anymore, bit (rank - 4) * 8 + file - 1 (see outpost_bit()).
+    struct Scores {
+      uint32_t white_outposts;
+      uint32_t black_outposts;
+      int16_t  mg;
+      int16_t  eg;
+      uint8_t  white_files;          // Bit f - 1 set: a white pawn is on file f
+      uint8_t  black_files;
+    };
+
+    // Bit of square board_idx in the outposts of a side, -1 if the square
+    // is not on the 4th to 6th ranks of that side.
+    static inline int outpost_bit(int board_idx, bool white) {
+      int rank = white ? 8 - (board_idx >> 3) : (board_idx >> 3) + 1;
+      return ((rank < 4) || (rank > 6)) ? -1 : ((rank - 4) << 3) + (board_idx & 7);
+    }
+
+    PawnTable() : entries(nullptr), mask(0), size_kb(0) { }
+   ~PawnTable();
+
+    // Table of kb kilobytes (1 to MAX_KB), rounded down to a power of 2
+    // entries. Returns false if it cannot be allocated: the current table is
+    // then kept.
+    bool                   resize(int kb);
+    inline int   get_size() const { return size_kb; }
+
+    // Pawn structure scores of the board, of pawn key pawn_key.
+    inline void probe(uint64_t pawn_key, const int8_t * board, Scores & scores) {
+      if (entries == nullptr) {
+        evaluate(board, scores);
+        return;
+      }
+
+      Entry  & entry = entries[pawn_key & mask];
+      uint32_t check = pawn_key >> 32;
+
+      if (entry.check == check) {
+        scores = entry.scores;
+      }
+      else {
+        evaluate(board, scores);
+        entry.check  = check;
+        entry.scores = scores;
+      }
+    }
+
+    // Analysis of the pawns of the board (a8 = 0).
+    static void          evaluate(const int8_t * board, Scores & scores);
+
+  private:
+    // A zeroed entry is the one of the boards without pawns.
+    struct Entry {
+      uint32_t check;                // Upper 32 bits of the pawn key
+      Scores   scores;
+    };
+
+    Entry  * entries;
+    uint32_t mask;
+    int      size_kb;
+};
+
+#if CHESS_ENGINE
+  PawnTable pawn_table;
+#else
+  extern PawnTable pawn_table;
+#endif
@@ -0,0 +1,196 @@
+// Chess puzzles file
+//
+// Guy Turcotte
+// for inclusion in the Chess-InkPlate project
+//
+// (c) January 2021 - GPL-3.0
+
+#include "chess_engine_puzzles.hpp"
+
+#include <chrono>
+#include <cstring>
+
+static const char MAGIC[4] = { 'C', 'I', 'P', 'Z' };
+static const char pieces[] = " PNBRQK";
+
+static inline uint32_t
+get_le(const uint8_t * p, int len)
+{
+  uint32_t value = 0;
+  for (int i = len - 1; i >= 0; i--) value = (value << 8) | p[i];
+  return value;
+}
+
+static inline void
+put_le(uint8_t * p, uint32_t value, int len)
+{
+  for (int i = 0; i < len; i++, value >>= 8) p[i] = value & 0xFF;
+}
+
+bool
+Puzzles::open(const std::string & filename)
+{
+  close();
+
+  if ((file = fopen(filename.c_str(), "rb")) == nullptr) return false;
+
+  uint8_t header[HEADER_SIZE];
+  bool    ok = (fread(header, 1, HEADER_SIZE, file) == HEADER_SIZE) &&
+               (memcmp(header, MAGIC, 4) == 0) &&
+               (header[4] == VERSION);
+
+  if (ok) {
+    for (int i = 0; i <= BUCKET_COUNT; i++) first[i] = get_le(&header[8 + 4 * i], 4);
+    for (int i = 0; i <  BUCKET_COUNT; i++) if (first[i] > first[i + 1]) ok = false;
+
+    ok = ok && (first[0] == 0) &&
+               (fseek(file, 0, SEEK_END) == 0) &&
+               ((size_t) ftell(file) == HEADER_SIZE + first[BUCKET_COUNT] * RECORD_SIZE);
+  }
+
+  if (!ok) {
+    close();
+    return false;
+  }
+
+  record_count = first[BUCKET_COUNT];
+  random_state = std::chrono::steady_clock::now().time_since_epoch().count() | 1;
+
+  return is_open();
+}
+
+void
+Puzzles::close()
+{
+  if (file != nullptr) fclose(file);
+  file         = nullptr;
+  record_count = 0;
+}
+
+uint32_t
+Puzzles::random()
+{
+  // xorshift64*
+  random_state ^= random_state >> 12;
+  random_state ^= random_state << 25;
+  random_state ^= random_state >> 27;
+  return (random_state * 0x2545F4914F6CDD1DULL) >> 32;
+}
+
+bool
+Puzzles::get(uint32_t idx, Puzzle & puzzle)
+{
+  uint8_t record[RECORD_SIZE];
+
+  if ((idx >= record_count) ||
+      (fseek(file, (long)(HEADER_SIZE + idx * RECORD_SIZE), SEEK_SET) != 0) ||
+      (fread(record, 1, RECORD_SIZE, file) != RECORD_SIZE)) return false;
+
+  unpack(record, puzzle);
+
+  return puzzle.move_count > 0;
+}
+
+bool
+Puzzles::pick(int bucket, Puzzle & puzzle, uint32_t & idx)
+{
+  if (!is_open()) return false;
+
+  if (bucket < 0) bucket = 0;
+  if (bucket >= BUCKET_COUNT) bucket = BUCKET_COUNT - 1;
+
+  // Nearest bucket with puzzles, looking alternately above and below
+  for (int delta = 0; delta < BUCKET_COUNT; delta++) {
+    for (int b : { bucket + delta, bucket - delta }) {
+      if ((b < 0) || (b >= BUCKET_COUNT) || (bucket_size(b) == 0)) continue;
+      idx = first[b] + (random() % bucket_size(b));
+      return get(idx, puzzle);
+    }
+  }
+
+  return false;
+}
+
+std::string
+Puzzles::fen(const Puzzle & puzzle)
+{
+  std::string result;
+
+  for (int row = 0; row < 8; row++) {
+    int empty = 0;
+    for (int col = 0; col < 8; col++) {
+      int8_t fig = puzzle.board[(row << 3) + col];
+      if (fig == NO_FIG) {
+        empty++;
+        continue;
+      }
+      if (empty > 0) result += (char)('0' + empty);
+      empty = 0;
+      result += (fig > 0) ? pieces[fig] : (char)(pieces[-fig] - 'A' + 'a');
+    }
+    if (empty > 0) result += (char)('0' + empty);
+    if (row < 7) result += '/';
+  }
+
+  result += puzzle.white_move ? " w " : " b ";
+
+  if (puzzle.castling == 0) result += '-';
+  else {
+    if (puzzle.castling & 1) result += 'K';
+    if (puzzle.castling & 2) result += 'Q';
+    if (puzzle.castling & 4) result += 'k';
+    if (puzzle.castling & 8) result += 'q';
+  }
+
+  result += ' ';
+  if (puzzle.en_passant == 0) result += '-';
+  else {
+    result += (char)('a' + (puzzle.en_passant & 7));
+    result += (char)('8' - (puzzle.en_passant >> 3));
+  }
+
+  return result;
+}
+
+void
+Puzzles::pack(const Puzzle & puzzle, uint8_t * record)
+{
+  memset(record, 0, RECORD_SIZE);
+
+  for (int i = 0; i < 64; i++) {
+    int8_t  fig    = puzzle.board[i];
+    uint8_t nibble = (fig > 0) ? fig : ((fig < 0) ? (8 - fig) : 0);
+    record[i >> 1] |= nibble << ((i & 1) << 2);
+  }
+
+  record[32] = (puzzle.white_move ? 1 : 0) | ((puzzle.castling & 15) << 1);
+  record[33] = puzzle.en_passant;
+  put_le(&record[34], puzzle.rating, 2);
+  record[36] = puzzle.move_count;
+  for (int i = 0; i < puzzle.move_count; i++) put_le(&record[40 + 2 * i], puzzle.moves[i], 2);
+}
+
+void
+Puzzles::unpack(const uint8_t * record, Puzzle & puzzle)
+{
+  for (int i = 0; i < 64; i++) {
+    uint8_t nibble = (record[i >> 1] >> ((i & 1) << 2)) & 15;
+    puzzle.board[i] = (nibble > 8) ? (8 - nibble) : ((nibble <= KING) ? nibble : NO_FIG);
+  }
+
+  puzzle.white_move = (record[32] & 1) != 0;
+  puzzle.castling   = (record[32] >> 1) & 15;
+  puzzle.en_passant = record[33];
+  puzzle.rating     = get_le(&record[34], 2);
+  puzzle.move_count = (record[36] <= MAX_MOVES) ? record[36] : 0;
+  for (int i = 0; i < puzzle.move_count; i++) puzzle.moves[i] = get_le(&record[40 + 2 * i], 2);
+}
+
+void
+Puzzles::write_header(const uint32_t * first, uint8_t * header)
+{
+  memset(header, 0, HEADER_SIZE);
+  memcpy(header, MAGIC, 4);
+  header[4] = VERSION;
+  for (int i = 0; i <= BUCKET_COUNT; i++) put_le(&header[8 + 4 * i], first[i], 4);
+}
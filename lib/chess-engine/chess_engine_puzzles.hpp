@@ -0,0 +1,120 @@
+// Chess puzzles file
+//
+// Guy Turcotte
+// for inclusion in the Chess-InkPlate project
+//
+// (c) January 2021 - GPL-3.0
+
+#pragma once
+
+// Puzzles file (puzzles.bin), built by tools/puzzle_builder from Lichess CSV
+// or EPD files. All numbers are little endian. The file is a header followed
+// by fixed size records, sorted by rating:
+//
+//   header (140 bytes):
+//     magic   (4 bytes)  : "CIPZ"
+//     version (1 byte)
+//     unused  (3 bytes)
+//     first   (33 x 4)   : Index of the first record of each rating bucket
+//                          (bucket i: ratings i * 100 to i * 100 + 99, the
+//                          last one for all higher ratings), plus the record
+//                          count
+//
+//   record (72 bytes):
+//     board      (32 bytes) : 2 squares per byte, a8 first, low nibble
+//                             first: 0 empty, 1-6 white P N B R Q K, 9-14
+//                             black ones
+//     flags      (1 byte)   : White to move (bit 0), castling rights (bits
+//                             1-4: white kingside, queenside, black
+//                             kingside, queenside)
+//     en_passant (1 byte)   : Board index of the en passant square, 0 if
+//                             none
+//     rating     (2 bytes)
+//     move_count (1 byte)
+//     unused     (3 bytes)
+//     moves      (16 x 2)   : The solution, starting with the move to find:
+//                             from (bits 0-5) and to (6-11) board indexes,
+//                             promotion (12-14: none, N, B, R, Q)
+//
+// A puzzle is found without reading anything else than the header and its
+// record: the records of a rating bucket are contiguous, and one of them is
+// picked at random.
+
+#include "chess_engine_types.hpp"
+
+#include <cinttypes>
+#include <string>
+#include <cstdio>
+
+struct Puzzle {
+  Board    board;
+  bool     white_move;
+  uint8_t  castling;           // Bits 0-3 of the record flags
+  uint8_t  en_passant;
+  uint16_t rating;
+  uint8_t  move_count;
+  uint16_t moves[16];          // Puzzles::MAX_MOVES
+};
+
+class Puzzles
+{
+  public:
+    static constexpr uint8_t VERSION      =   1;
+    static constexpr int     MAX_MOVES    =  16;
+    static constexpr int     BUCKET_COUNT =  32;
+    static constexpr int     BUCKET_WIDTH = 100;
+    static constexpr size_t  HEADER_SIZE  = 8 + 4 * (BUCKET_COUNT + 1);
+    static constexpr size_t  RECORD_SIZE  =  72;
+
+    Puzzles() : file(nullptr), record_count(0), random_state(0) { }
+   ~Puzzles() { close(); }
+
+    bool          open(const std::string & filename);
+    void         close();
+    inline bool is_open() const { return record_count > 0; }
+    inline uint32_t size() const { return record_count; }
+
+    static inline int bucket_of(int rating) {
+      return (rating / BUCKET_WIDTH < BUCKET_COUNT) ? rating / BUCKET_WIDTH : BUCKET_COUNT - 1;
+    }
+    inline uint32_t bucket_size(int bucket) const { return first[bucket + 1] - first[bucket]; }
+
+    // Reads the record at index idx.
+    bool           get(uint32_t idx, Puzzle & puzzle);
+
+    // Reads a record at random from the rating bucket, or from the nearest
+    // one that is not empty. Its index is returned in idx.
+    bool          pick(int bucket, Puzzle & puzzle, uint32_t & idx);
+
+    // FEN string of the puzzle position.
+    static std::string fen(const Puzzle & puzzle);
+
+    static void         pack(const Puzzle & puzzle, uint8_t * record);
+    static void       unpack(const uint8_t * record, Puzzle & puzzle);
+    static void write_header(const uint32_t * first, uint8_t * header);
+
+    static inline uint16_t encode_move(int c1, int c2, MoveType type) {
+      int promotion = (type > MoveType::CASTLE_QUEENSIDE) ? (int)(type) - (int)(MoveType::PROMOTE_TO_KNIGHT) + 1 : 0;
+      return c1 | (c2 << 6) | (promotion << 12);
+    }
+    static inline int          move_from(uint16_t move) { return  move       & 63; }
+    static inline int            move_to(uint16_t move) { return (move >> 6) & 63; }
+    static inline MoveType move_promotion(uint16_t move) {
+      int promotion = (move >> 12) & 7;
+      return (promotion == 0) ? MoveType::UNKNOWN : (MoveType)((int)(MoveType::PROMOTE_TO_KNIGHT) + promotion - 1);
+    }
+
+  private:
+    FILE     * file;
+    uint32_t   record_count;
+    uint32_t   first[BUCKET_COUNT + 1];
+    uint64_t   random_state;
+
+    uint32_t random();
+};
+
+#if CHESS_ENGINE
+  Puzzles puzzles;
+#else
+  extern Puzzles puzzles;
+#endif
@@ -0,0 +1,204 @@
+// Chess game review
+//
+// Guy Turcotte
+// for inclusion in the Chess-InkPlate project
+//
+// (c) January 2021 - GPL-3.0
+
+#include "chess_engine.hpp"
+#include "chess_engine_review.hpp"
+
+#include <fstream>
+#include <sstream>
+#include <cstring>
+#include <algorithm>
+
+static const char * START_FEN = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq -";
+
+static const char * names[]   = { "best", "inaccuracy", "mistake", "blunder", "unknown" };
+static const char * symbols[] = { "",     "?!",         "?",       "??",      ""        };
+
+static inline int
+cap(int score)
+{
+  return (score > GameReview::SCORE_CAP) ? GameReview::SCORE_CAP :
+         ((score < -GameReview::SCORE_CAP) ? -GameReview::SCORE_CAP : score);
+}
+
+// Searches the root position. Gives its score from the point of view of
+// the side to move, with the best move found (empty if none). Returns false
+// if the score is unknown: no move found while the game is not ended.
+static bool
+search(std::string & best, int & score)
+{
+  Position * pos       = chess_engine.get_pos(0);
+  Step     * best_move = chess_engine.get_best_move(0);
+
+  for (int i = 0; i < MAXEPD; i++) best_move[i].c1 = -1;
+
+  best.clear();
+  score = 0;
+
+  if (chess_engine.is_draw_by_rule()) return true;
+
+  chess_engine.new_game();
+  pos[0].best.f1 = NO_FIG;
+  pos[0].best.c1 = -1;
+
+  chess_engine.solve_step();
+
+  if (pos[0].best.c1 != -1) {
+    best  = chess_engine.step_to_uci(pos[0].best);
+    score = pos[0].best.weight;
+    return true;
+  }
+
+  // No legal move
+  switch (chess_engine.get_end_of_game_type()) {
+    case EndOfGameType::CHECKMATE: score = -GameReview::SCORE_CAP; return true;
+    case EndOfGameType::NONE:                                      return false;
+    default:                                                       return true;
+  }
+}
+
+bool
+GameReview::review(const Step * steps, int count, unsigned long nodes, Entry * entries,
+                   int done, ProgressHandler progress)
+{
+  int  skill      = chess_engine.get_skill_level();
+  bool ok         = true;
+  bool prev_known = true;   // Score of the position before the move i - 1 known
+
+  chess_engine.set_skill_level(ChessEngine::SKILL_LEVEL_COUNT - 1);
+  chess_engine.set_search_limits(0, 0, nodes);
+
+  chess_engine.load_board_from_fen(START_FEN);
+
+  for (int i = 0; i <= count; i++) {
+    if (i >= done) {
+      std::string best;
+      int         score;
+      bool        known = search(best, score);
+
+      // The score of this position is the one after the previous move
+      if (i > done) {
+        Entry & prev = entries[i - 1];
+        prev.after = -score;
+        if (prev_known && (chess_engine.step_to_uci(steps[i - 1]) == prev.best)) {
+          prev.loss = 0;
+          prev.cls  = Class::BEST;
+        }
+        else if (prev_known && known) {
+          prev.loss = std::max(0, cap(prev.score) - cap(prev.after));
+          prev.cls  = classify(prev.loss);
+        }
+        else {
+          prev.loss = 0;
+          prev.cls  = Class::UNKNOWN;
+        }
+      }
+      prev_known = known;
+
+      if (i < count) {
+        strncpy(entries[i].best, best.c_str(), sizeof(entries[i].best) - 1);
+        entries[i].best[sizeof(entries[i].best) - 1] = 0;
+        entries[i].score = score;
+      }
+
+      if (progress != nullptr) (*progress)(i, count);
+    }
+
+    if (i == count) break;
+
+    if (!chess_engine.play_step(chess_engine.step_to_uci(steps[i]))) {
+      ok = false;
+      break;
+    }
+  }
+
+  chess_engine.set_skill_level(skill);
+
+  return ok;
+}
+
+std::string
+GameReview::sidecar_name(const std::string & game_filename)
+{
+  std::size_t dot   = game_filename.find_last_of('.');
+  std::size_t slash = game_filename.find_last_of('/');
+
+  if ((dot == std::string::npos) || ((slash != std::string::npos) && (dot < slash))) return game_filename + ".review";
+
+  return game_filename.substr(0, dot) + ".review";
+}
+
+bool
+GameReview::save(const std::string & filename, const Step * steps, const Entry * entries, int count)
+{
+  std::ofstream file(filename);
+
+  if (!file.is_open()) return false;
+
+  file << "# Chess-InkPlate game review: ply move class loss best score after" << std::endl;
+
+  for (int i = 0; i < count; i++) {
+    const Entry & e = entries[i];
+    file << (i + 1)                            << ' '
+         << chess_engine.step_to_uci(steps[i]) << ' '
+         << name(e.cls)                        << ' '
+         << e.loss                             << ' '
+         << ((e.best[0] == 0) ? "-" : e.best)  << ' '
+         << e.score                            << ' '
+         << e.after                            << std::endl;
+  }
+
+  file.close();
+
+  return !file.fail();
+}
+
+int
+GameReview::load(const std::string & filename, const Step * steps, int count, Entry * entries)
+{
+  std::ifstream file(filename);
+  std::string   line;
+  int           found = 0;
+
+  if (!file.is_open()) return 0;
+
+  while ((found < count) && std::getline(file, line)) {
+    if (line.empty() || (line[0] == '#')) continue;
+
+    std::istringstream stream(line);
+    int                ply, loss, score, after;
+    std::string        move, cls, best;
+
+    if (!(stream >> ply >> move >> cls >> loss >> best >> score >> after)) break;
+    if ((ply != found + 1) || (move != chess_engine.step_to_uci(steps[found]))) break;
+
+    Entry & e = entries[found];
+
+    strncpy(e.best, (best == "-") ? "" : best.c_str(), sizeof(e.best) - 1);
+    e.best[sizeof(e.best) - 1] = 0;
+    e.score = score;
+    e.after = after;
+    e.loss  = loss;
+    e.cls   = (cls == names[(int) Class::UNKNOWN]) ? Class::UNKNOWN : classify(loss);
+
+    found++;
+  }
+
+  return found;
+}
+
+GameReview::Class
+GameReview::classify(int loss)
+{
+  if (loss >= BLUNDER_LOSS   ) return Class::BLUNDER;
+  if (loss >= MISTAKE_LOSS   ) return Class::MISTAKE;
+  if (loss >= INACCURACY_LOSS) return Class::INACCURACY;
+  return Class::BEST;
+}
+
+const char * GameReview::name  (Class cls) { return names  [(int) cls]; }
+const char * GameReview::symbol(Class cls) { return symbols[(int) cls]; }
@@ -0,0 +1,77 @@
+// Chess game review
+//
+// Guy Turcotte
+// for inclusion in the Chess-InkPlate project
+//
+// (c) January 2021 - GPL-3.0
+
+#pragma once
+
+// Review of a game played from the start position: every position is
+// searched with a fixed node budget, and each move is classified by the
+// score it loses compared to the best move found (best, inaccuracy, mistake,
+// blunder). A game of N moves costs N + 1 searches: the score after a move
+// is the score of the next position. A move is unknown when the search gave
+// no move for the position before or after it (game not ended): its loss is
+// not computed.
+//
+// The annotations are kept in a sidecar text file, one line per move:
+//
+//   <ply> <move> <class> <loss> <best move> <score> <score after>
+//
+// with moves in coordinate notation and scores in centipawns from the point
+// of view of the side making the move. When a game is reviewed again, the
+// moves of the sidecar file that are still those of the game are reused and
+// only the new ones are searched.
+
+#include "chess_engine_types.hpp"
+
+#include <string>
+
+class GameReview
+{
+  public:
+    enum class Class : uint8_t { BEST, INACCURACY, MISTAKE, BLUNDER, UNKNOWN };
+    static constexpr int CLASS_COUNT = 5;
+
+    struct Entry {
+      char    best[6];              // Best move found, coordinate notation, empty if none
+      int16_t score;                // Score before the move
+      int16_t after;                // Score after the move
+      int16_t loss;
+      Class   cls;
+    };
+
+    // Score loss (centipawns) of each class
+    static constexpr int INACCURACY_LOSS =   50;
+    static constexpr int MISTAKE_LOSS    =  100;
+    static constexpr int BLUNDER_LOSS    =  300;
+
+    // Scores are capped before computing the loss, for a won position not
+    // to be reported as a blunder when a mate is missed.
+    static constexpr int SCORE_CAP       = 1000;
+
+    typedef void (* ProgressHandler)(int done, int count);
+
+    // Reviews the plies done to count - 1 of the game steps, the plies before
+    // done being already in entries. The engine searches under a node limit,
+    // at full strength: its skill level is restored afterward, but not its
+    // time limit (set_engine_time() or set_search_limits() is to be called
+    // by the caller). The root position of the engine is left at the end of
+    // the game. Returns false if a step is not legal.
+    static bool review(const Step * steps, int count, unsigned long nodes, Entry * entries,
+                       int done = 0, ProgressHandler progress = nullptr);
+
+    // Sidecar file of a game file: same name, with the .review extension.
+    static std::string sidecar_name(const std::string & game_filename);
+
+    static bool save(const std::string & filename, const Step * steps, const Entry * entries, int count);
+
+    // Reads the entries of the sidecar file. Returns the number of plies
+    // found, stopping at the first one that is not the move of the game.
+    static int  load(const std::string & filename, const Step * steps, int count, Entry * entries);
+
+    static Class classify(int loss);
+    static const char *   name(Class cls);
+    static const char * symbol(Class cls);   // "", "?!", "?", "??", ""
+};
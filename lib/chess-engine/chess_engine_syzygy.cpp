@@ -0,0 +1,866 @@
+// Chess engine Syzygy tablebases
+//
+// Guy Turcotte
+// for inclusion in the Chess-InkPlate project
+//
+// (c) January 2021 - GPL-3.0
+//
+// The table decoding and indexing are a port of the Syzygy probing code of
+// Stockfish (src/syzygy/tbprobe.cpp, GPL-3.0): (c) 2013 Ronald de Man, the
+// author of the tablebases, (c) 2016 Marco Costalba and Lucas Braesch, and
+// the Stockfish developers.
+
+#include "chess_engine_syzygy.hpp"
+#include "chess_engine_types.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#include <dirent.h>
+
+#if CHESS_LINUX_BUILD
+  #include <fcntl.h>
+  #include <unistd.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+#endif
+
+// Squares are numbered as in the tables: a1 = 0 .. h8 = 63. The engine board
+// index is the square with its rank flipped.
+
+static inline int   file_of(int sq) { return sq & 7;  }
+static inline int   rank_of(int sq) { return sq >> 3; }
+static inline int off_a1h8(int sq) { return rank_of(sq) - file_of(sq); }
+
+// Table flags
+static constexpr uint8_t STM          =   1;
+static constexpr uint8_t MAPPED       =   2;
+static constexpr uint8_t WIN_PLIES    =   4;
+static constexpr uint8_t LOSS_PLIES   =   8;
+static constexpr uint8_t WIDE         =  16;
+static constexpr uint8_t SINGLE_VALUE = 128;
+
+static const uint8_t WDL_MAGIC[4] = { 0x71, 0xE8, 0x23, 0x5D };
+static const uint8_t DTZ_MAGIC[4] = { 0xD7, 0x66, 0x0C, 0xA5 };
+
+static constexpr int MAX_PIECES = SyzygyTB::MAX_PIECES;
+
+// Encoding tables, computed once.
+static int      map_b1h1h7[64];                   // Squares below the a1-h8 diagonal: 0 .. 27
+static int      map_a1d1d4[64];                   // Squares of the a1-d1-d4 triangle: 0 .. 9
+static int      map_kk[10][64];                   // Legal positions of two kings: 0 .. 461
+static uint64_t binomial[MAX_PIECES][64];
+static int      map_pawns[64];
+static int      lead_pawn_idx[MAX_PIECES][64];
+static int      lead_pawns_size[MAX_PIECES][4];
+static bool     tables_ready = false;
+
+static void
+init_tables()
+{
+  int code = 0;
+  for (int sq = 0; sq < 64; sq++) {
+    if (off_a1h8(sq) < 0) map_b1h1h7[sq] = code++;
+  }
+
+  std::vector<int> diagonal;
+  code = 0;
+  for (int sq = 0; sq <= 27; sq++) {
+    if ((off_a1h8(sq) < 0) && (file_of(sq) <= 3)) map_a1d1d4[sq] = code++;
+    else if ((off_a1h8(sq) == 0) && (file_of(sq) <= 3)) diagonal.push_back(sq);
+  }
+  for (int sq : diagonal) map_a1d1d4[sq] = code++;
+
+  // The first king is in the a1-d1-d4 triangle. If it is on the diagonal,
+  // the other one is not above it. Both kings on the diagonal come last.
+  std::vector<std::pair<int, int>> both_on_diagonal;
+  code = 0;
+  for (int idx = 0; idx < 10; idx++) {
+    for (int s1 = 0; s1 <= 27; s1++) {
+      if ((map_a1d1d4[s1] != idx) || ((idx == 0) && (s1 != 1))) continue;   // b1 is 0
+      for (int s2 = 0; s2 < 64; s2++) {
+        if ((abs(file_of(s1) - file_of(s2)) <= 1) && (abs(rank_of(s1) - rank_of(s2)) <= 1)) continue;
+        if      ((off_a1h8(s1) == 0) && (off_a1h8(s2) >  0)) continue;
+        else if ((off_a1h8(s1) == 0) && (off_a1h8(s2) == 0)) both_on_diagonal.push_back({ idx, s2 });
+        else map_kk[idx][s2] = code++;
+      }
+    }
+  }
+  for (auto & p : both_on_diagonal) map_kk[p.first][p.second] = code++;
+
+  binomial[0][0] = 1;
+  for (int n = 1; n < 64; n++) {
+    for (int k = 0; (k < MAX_PIECES) && (k <= n); k++) {
+      binomial[k][n] = ((k > 0) ? binomial[k - 1][n - 1] : 0) + ((k < n) ? binomial[k][n - 1] : 0);
+    }
+  }
+
+  // Pawns squares a2 .. h7: the leading pawn has the highest value, the one
+  // nearest to the edge with the lowest rank.
+  int available = 47;
+  for (int count = 1; count < MAX_PIECES - 1; count++) {
+    for (int f = 0; f < 4; f++) {
+      int idx = 0;
+      for (int r = 1; r <= 6; r++) {
+        int sq = (r << 3) | f;
+        if (count == 1) {
+          map_pawns[sq]     = available--;
+          map_pawns[sq ^ 7] = available--;
+        }
+        lead_pawn_idx[count][sq] = idx;
+        idx += binomial[count - 1][map_pawns[sq]];
+      }
+      lead_pawns_size[count][f] = idx;
+    }
+  }
+
+  tables_ready = true;
+}
+
+static inline bool
+pawns_comp(int s1, int s2)
+{
+  return map_pawns[s1] < map_pawns[s2];
+}
+
+// Table piece code (white 1 .. 6, black 9 .. 14) to engine figure.
+static inline int8_t
+code_to_fig(int code)
+{
+  return (code & 8) ? -(code & 7) : code;
+}
+
+static inline uint16_t
+get_le16(const uint8_t * p)
+{
+  return p[0] | (p[1] << 8);
+}
+
+static inline uint32_t
+get_be32(const uint8_t * p)
+{
+  return ((uint32_t) p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+// Material signature: 4 bits per piece kind, pawns to queens, white then
+// black.
+static uint64_t
+signature(const int counts[2][KING])
+{
+  uint64_t sig = 0;
+  for (int c = 0; c < 2; c++) {
+    for (int t = PAWN; t < KING; t++) sig |= (uint64_t) counts[c][t] << (20 * c + 4 * (t - 1));
+  }
+  return sig;
+}
+
+// ----- Files -----
+
+bool
+SyzygyTB::TBFile::open(const std::string & filename)
+{
+  #if CHESS_LINUX_BUILD
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if ((fstat(fd, &st) != 0) || (st.st_size == 0)) {
+      ::close(fd);
+      return false;
+    }
+
+    void * addr = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (addr == MAP_FAILED) return false;
+
+    data = (const uint8_t *) addr;
+    size = st.st_size;
+  #else
+    if ((file = fopen(filename.c_str(), "rb")) == nullptr) return false;
+    if (fseek(file, 0, SEEK_END) != 0) {
+      close();
+      return false;
+    }
+    size = ftell(file);
+  #endif
+
+  return true;
+}
+
+void
+SyzygyTB::TBFile::close()
+{
+  #if CHESS_LINUX_BUILD
+    if (data != nullptr) munmap((void *) data, size);
+    data = nullptr;
+  #else
+    if (file != nullptr) fclose(file);
+    file = nullptr;
+  #endif
+  size = 0;
+}
+
+// Reads length bytes at offset. Fails if they are not all in the file.
+bool
+SyzygyTB::TBFile::read(uint64_t offset, void * buffer, size_t length)
+{
+  if ((offset > size) || (length > size - offset)) return false;
+
+  #if CHESS_LINUX_BUILD
+    memcpy(buffer, data + offset, length);
+    return true;
+  #else
+    if (fseek(file, (long) offset, SEEK_SET) != 0) return false;
+    return fread(buffer, 1, length, file) == length;
+  #endif
+}
+
+// ----- Registration -----
+
+int
+SyzygyTB::init(const std::string & path)
+{
+  clear();
+
+  if (!tables_ready) init_tables();
+
+  DIR * dir = opendir(path.c_str());
+  if (dir == nullptr) return 0;
+
+  int             count = 0;
+  struct dirent * entry;
+
+  while ((entry = readdir(dir)) != nullptr) {
+    std::string name = entry->d_name;
+    if (name.length() < 8) continue;
+
+    std::string ext = name.substr(name.length() - 5);
+    bool        dtz = (ext == ".rtbz");
+    if (!dtz && (ext != ".rtbw")) continue;
+
+    std::string material = name.substr(0, name.length() - 5);
+    auto        v        = material.find('v');
+    if ((v == std::string::npos) || (material[0] != 'K') || (material[v + 1] != 'K')) continue;
+
+    int  counts[2][KING] = { { 0 } };
+    int  pieces          = 0;
+    bool valid           = true;
+
+    for (size_t i = 0; i < material.length(); i++) {
+      if (i == v) continue;
+      const char * p = strchr(fig_symb1, (material[i] == 'P') ? 'p' : material[i]);
+      if ((p == nullptr) || (*p == ' ')) { valid = false; break; }
+      int t = p - fig_symb1;
+      if (t != KING) counts[(i < v) ? 0 : 1][t]++;
+      pieces++;
+    }
+    if (!valid || (pieces > MAX_PIECES)) continue;
+
+    Table * table = new Table;
+
+    table->filename          = path + "/" + name;
+    table->dtz               = dtz;
+    table->loaded            = false;
+    table->failed            = false;
+    table->piece_count       = pieces;
+    table->has_pawns         = (counts[0][PAWN] + counts[1][PAWN]) > 0;
+    table->has_unique_pieces = false;
+    table->symmetric         = material.substr(0, v) == material.substr(v + 1);
+
+    for (int c = 0; c < 2; c++) {
+      for (int t = PAWN; t < KING; t++) if (counts[c][t] == 1) table->has_unique_pieces = true;
+    }
+
+    // The leading color is the one with less pawns, white when equal.
+    bool lead_white = (counts[1][PAWN] == 0) || ((counts[0][PAWN] != 0) && (counts[1][PAWN] >= counts[0][PAWN]));
+    table->pawn_count[0] = counts[lead_white ? 0 : 1][PAWN];
+    table->pawn_count[1] = counts[lead_white ? 1 : 0][PAWN];
+
+    auto & tables = dtz ? dtz_tables : wdl_tables;
+    uint64_t sig  = signature(counts);
+    if (tables.find(sig) != tables.end()) {
+      delete table;
+      continue;
+    }
+    tables[sig] = table;
+
+    if (!dtz) {
+      count++;
+      if (pieces > max_pieces) max_pieces = pieces;
+    }
+  }
+
+  closedir(dir);
+
+  return count;
+}
+
+void
+SyzygyTB::clear()
+{
+  for (auto tables : { &wdl_tables, &dtz_tables }) {
+    for (auto & e : *tables) {
+      e.second->file.close();
+      delete e.second;
+    }
+    tables->clear();
+  }
+  max_pieces = 0;
+}
+
+SyzygyTB::Table *
+SyzygyTB::find(std::map<uint64_t, Table *> & tables, const int8_t * board, bool & black_stronger)
+{
+  int counts[2][KING] = { { 0 } };
+
+  for (int i = 0; i < 64; i++) {
+    int8_t fig = board[i];
+    if ((fig != NO_FIG) && (abs(fig) != KING)) counts[(fig > 0) ? 0 : 1][abs(fig)]++;
+  }
+
+  // The tables are computed with white as the stronger side: KRvK, not KvKR.
+  black_stronger = false;
+  auto it = tables.find(signature(counts));
+  if (it == tables.end()) {
+    for (int t = PAWN; t < KING; t++) std::swap(counts[0][t], counts[1][t]);
+    it = tables.find(signature(counts));
+    if (it == tables.end()) return nullptr;
+    black_stronger = true;
+  }
+
+  Table * table = it->second;
+  if (!table->loaded && !table->failed) {
+    if (!load(*table)) {
+      table->file.close();
+      table->failed = true;
+    }
+  }
+
+  return table->failed ? nullptr : table;
+}
+
+// ----- Table headers -----
+
+void
+SyzygyTB::set_groups(Table & t, PairsData & d, const int order[2], int f)
+{
+  int n = 0, first_len = t.has_pawns ? 0 : (t.has_unique_pieces ? 3 : 2);
+
+  // Pieces of the same kind that follow each other form a group. The first
+  // group is made of the leading pieces (or pawns).
+  d.group_len[n] = 1;
+  for (int i = 1; i < t.piece_count; i++) {
+    if ((--first_len > 0) || (d.pieces[i] == d.pieces[i - 1])) d.group_len[n]++;
+    else d.group_len[++n] = 1;
+  }
+  d.group_len[++n] = 0;
+
+  // The groups are not encoded in the order of pieces[], but in the order
+  // given by order[]: order[0] is the position of the leading group,
+  // order[1] the position of the remaining pawns.
+  bool     pp           = t.has_pawns && (t.pawn_count[1] > 0);
+  int      next         = pp ? 2 : 1;
+  int      free_squares = 64 - d.group_len[0] - (pp ? d.group_len[1] : 0);
+  uint64_t idx          = 1;
+
+  for (int k = 0; (next < n) || (k == order[0]) || (k == order[1]); k++) {
+    if (k == order[0]) {
+      d.group_idx[0] = idx;
+      idx *= t.has_pawns ? lead_pawns_size[d.group_len[0]][f] : (t.has_unique_pieces ? 31332 : 462);
+    }
+    else if (k == order[1]) {
+      d.group_idx[1] = idx;
+      idx *= binomial[d.group_len[1]][48 - d.group_len[0]];
+    }
+    else {
+      d.group_idx[next] = idx;
+      idx *= binomial[d.group_len[next]][free_squares];
+      free_squares -= d.group_len[next++];
+    }
+  }
+  d.group_idx[n] = idx;
+}
+
+// Number of values represented by a symbol, less one. Symbols are pairs of
+// symbols, down to the leaves.
+uint8_t
+SyzygyTB::set_symlen(PairsData & d, int sym, std::vector<bool> & visited)
+{
+  visited[sym] = true;
+
+  const uint8_t * lr = &d.btree[3 * sym];
+  int right = (lr[2] << 4) | (lr[1] >> 4);
+  if (right == 0xFFF) return 0;
+  int left  = ((lr[1] & 0x0F) << 8) | lr[0];
+
+  if (!visited[left ]) d.symlen[left ] = set_symlen(d, left,  visited);
+  if (!visited[right]) d.symlen[right] = set_symlen(d, right, visited);
+
+  return d.symlen[left] + d.symlen[right] + 1;
+}
+
+bool
+SyzygyTB::set_sizes(PairsData & d, uint64_t & offset, TBFile & file)
+{
+  uint8_t b[8];
+
+  if (!file.read(offset++, &d.flags, 1)) return false;
+
+  if (d.flags & SINGLE_VALUE) {
+    d.num_blocks        = 0;
+    d.block_length_size = 0;
+    d.span              = 0;
+    d.sparse_index_size = 0;
+    d.block_size        = 0;
+    if (!file.read(offset++, b, 1)) return false;
+    d.min_sym_len = b[0];                  // The single value
+    return true;
+  }
+
+  // The size of the table is the index of the last group.
+  int last = 0;
+  while (d.group_len[last] != 0) last++;
+  uint64_t tb_size = d.group_idx[last];
+
+  if (!file.read(offset, b, 8)) return false;
+  offset += 8;
+
+  d.block_size        = 1UL  << b[0];
+  d.span              = 1ULL << b[1];
+  d.sparse_index_size = (tb_size + d.span - 1) / d.span;
+  d.num_blocks        = b[3] | (b[4] << 8) | (b[5] << 16) | ((uint32_t) b[6] << 24);
+  d.block_length_size = d.num_blocks + b[2];  // Padded
+  int max_sym_len     = b[7];
+
+  if (!file.read(offset++, b, 1)) return false;
+  d.min_sym_len = b[0];
+
+  if (max_sym_len < d.min_sym_len) return false;
+
+  int count = max_sym_len - d.min_sym_len + 1;
+  std::vector<uint8_t> lowest(2 * count);
+  if (!file.read(offset, lowest.data(), lowest.size())) return false;
+  offset += lowest.size();
+
+  d.lowest_sym.resize(count);
+  for (int i = 0; i < count; i++) d.lowest_sym[i] = get_le16(&lowest[2 * i]);
+
+  // Canonical Huffman code: base64[i] is the lowest code of length
+  // min_sym_len + i, left aligned on 64 bits. Longer codes have lower values.
+  d.base64.assign(count, 0);
+  for (int i = count - 2; i >= 0; i--) {
+    d.base64[i] = (d.base64[i + 1] + d.lowest_sym[i] - d.lowest_sym[i + 1]) / 2;
+  }
+  for (int i = 0; i < count; i++) d.base64[i] <<= 64 - i - d.min_sym_len;
+
+  if (!file.read(offset, b, 2)) return false;
+  offset += 2;
+  int sym_count = get_le16(b);
+
+  d.btree.resize(3 * sym_count);
+  if ((sym_count > 0) && !file.read(offset, d.btree.data(), d.btree.size())) return false;
+  offset += d.btree.size() + (sym_count & 1);
+
+  d.symlen.assign(sym_count, 0);
+  std::vector<bool> visited(sym_count, false);
+  for (int sym = 0; sym < sym_count; sym++) {
+    if (!visited[sym]) d.symlen[sym] = set_symlen(d, sym, visited);
+  }
+
+  return true;
+}
+
+bool
+SyzygyTB::load(Table & t)
+{
+  t.loaded = true;
+
+  if (!t.file.open(t.filename)) return false;
+
+  uint8_t b[4];
+  if (!t.file.read(0, b, 4) || (memcmp(b, t.dtz ? DTZ_MAGIC : WDL_MAGIC, 4) != 0)) return false;
+
+  uint64_t offset = 4;
+
+  if (!t.file.read(offset++, b, 1)) return false;
+  if (((b[0] & 2) != 0) != t.has_pawns) return false;   // Has pawns flag
+
+  int  sides    = (!t.dtz && !t.symmetric) ? 2 : 1;
+  int  max_file = t.has_pawns ? 3 : 0;
+  bool pp       = t.has_pawns && (t.pawn_count[1] > 0);
+
+  for (int f = 0; f <= max_file; f++) {
+    if (!t.file.read(offset, b, 2)) return false;
+    int order[2][2] = { { b[0] & 0x0F, pp ? (b[1] & 0x0F) : 0x0F },
+                        { b[0] >> 4,   pp ? (b[1] >> 4)   : 0x0F } };
+    offset += 1 + (pp ? 1 : 0);
+
+    for (int k = 0; k < t.piece_count; k++) {
+      if (!t.file.read(offset++, b, 1)) return false;
+      for (int i = 0; i < sides; i++) t.items[i][f].pieces[k] = i ? (b[0] >> 4) : (b[0] & 0x0F);
+    }
+    for (int i = 0; i < sides; i++) set_groups(t, t.items[i][f], order[i], f);
+  }
+
+  offset += offset & 1;
+
+  for (int f = 0; f <= max_file; f++) {
+    for (int i = 0; i < sides; i++) {
+      if (!set_sizes(t.items[i][f], offset, t.file)) return false;
+    }
+  }
+
+  if (t.dtz) {
+    // Maps of the DTZ values, one per WDL value, for each file.
+    uint64_t map = offset;
+    for (int f = 0; f <= max_file; f++) {
+      PairsData & d = t.items[0][f];
+      if (!(d.flags & MAPPED)) continue;
+      if (d.flags & WIDE) {
+        offset += offset & 1;
+        for (int i = 0; i < 4; i++) {
+          if (!t.file.read(offset, b, 2)) return false;
+          d.map_idx[i] = offset - map + 2;
+          offset += 2 * get_le16(b) + 2;
+        }
+      }
+      else {
+        for (int i = 0; i < 4; i++) {
+          if (!t.file.read(offset, b, 1)) return false;
+          d.map_idx[i] = offset - map + 1;
+          offset += b[0] + 1;
+        }
+      }
+    }
+    offset += offset & 1;
+
+    t.map.resize(offset - map);
+    if (!t.map.empty() && !t.file.read(map, t.map.data(), t.map.size())) return false;
+  }
+
+  for (int f = 0; f <= max_file; f++) {
+    for (int i = 0; i < sides; i++) {
+      t.items[i][f].sparse_index = offset;
+      offset += t.items[i][f].sparse_index_size * 6;
+    }
+  }
+  for (int f = 0; f <= max_file; f++) {
+    for (int i = 0; i < sides; i++) {
+      t.items[i][f].block_length = offset;
+      offset += (uint64_t) t.items[i][f].block_length_size * 2;
+    }
+  }
+  for (int f = 0; f <= max_file; f++) {
+    for (int i = 0; i < sides; i++) {
+      offset = (offset + 0x3F) & ~0x3FULL;
+      t.items[i][f].data = offset;
+      offset += (uint64_t) t.items[i][f].num_blocks * t.items[i][f].block_size;
+    }
+  }
+
+  // The block buffer of decompress(), with room for the bytes the decoder
+  // looks ahead past the end of a block.
+  uint32_t block_size = 0;
+  for (int f = 0; f <= max_file; f++) {
+    for (int i = 0; i < sides; i++) block_size = std::max(block_size, t.items[i][f].block_size);
+  }
+  t.block.assign(block_size + 8, 0);
+
+  return true;
+}
+
+// ----- Probing -----
+
+// Value at index idx of a table. The sparse index gives the block and the
+// offset in the block of one value every span values; the block lengths
+// allow to move to the right block. The block is then decoded up to the
+// symbol holding the value, which is expanded down to the value.
+int
+SyzygyTB::decompress(Table & t, PairsData & d, uint64_t idx, bool & ok)
+{
+  TBFile & file = t.file;
+
+  ok = true;
+
+  if (d.flags & SINGLE_VALUE) return d.min_sym_len;
+
+  uint8_t b[6];
+
+  ok = false;
+  if (!file.read(d.sparse_index + (idx / d.span) * 6, b, 6)) return 0;
+
+  uint32_t block  = b[0] | (b[1] << 8) | (b[2] << 16) | ((uint32_t) b[3] << 24);
+  int64_t  offset = get_le16(&b[4]);
+
+  offset += (int64_t)(idx % d.span) - (int64_t)(d.span / 2);
+
+  auto block_length = [&](uint32_t blk, int & len) -> bool {
+    uint8_t l[2];
+    if (!file.read(d.block_length + 2 * (uint64_t) blk, l, 2)) return false;
+    len = get_le16(l);
+    return true;
+  };
+
+  int len;
+  while (offset < 0) {
+    if ((block == 0) || !block_length(--block, len)) return 0;
+    offset += len + 1;
+  }
+  while (true) {
+    if (!block_length(block, len)) return 0;
+    if (offset <= len) break;
+    offset -= len + 1;
+    block++;
+  }
+
+  // The last block may end the file without padding: the bytes past its end
+  // are zeroes.
+  uint64_t start  = d.data + (uint64_t) block * d.block_size;
+  size_t   length = d.block_size + 8;
+
+  if (start >= file.get_size()) return 0;
+  size_t available = std::min<uint64_t>(length, file.get_size() - start);
+  if (!file.read(start, t.block.data(), available)) return 0;
+  std::fill(t.block.begin() + available, t.block.begin() + length, 0);
+
+  const uint8_t * ptr      = t.block.data();
+  const uint8_t * end      = ptr + length - 4;
+  uint64_t        buf64    = ((uint64_t) get_be32(ptr) << 32) | get_be32(ptr + 4);
+  int             buf_size = 64;
+  int             sym;
+
+  ptr += 8;
+
+  while (true) {
+    int l = 0;
+    while (buf64 < d.base64[l]) l++;
+
+    sym = (int)((buf64 - d.base64[l]) >> (64 - l - d.min_sym_len)) + d.lowest_sym[l];
+    if (sym >= (int) d.symlen.size()) return 0;
+
+    if (offset < d.symlen[sym] + 1) break;
+    offset -= d.symlen[sym] + 1;
+
+    l        += d.min_sym_len;
+    buf64   <<= l;
+    buf_size -= l;
+    if (buf_size <= 32) {
+      if (ptr > end) return 0;
+      buf_size += 32;
+      buf64    |= (uint64_t) get_be32(ptr) << (64 - buf_size);
+      ptr      += 4;
+    }
+  }
+
+  while (d.symlen[sym] != 0) {
+    const uint8_t * lr = &d.btree[3 * sym];
+    int left = ((lr[1] & 0x0F) << 8) | lr[0];
+    if (offset < d.symlen[left] + 1) sym = left;
+    else {
+      offset -= d.symlen[left] + 1;
+      sym     = (lr[2] << 4) | (lr[1] >> 4);
+    }
+  }
+
+  ok = true;
+  const uint8_t * lr = &d.btree[3 * sym];
+  return ((lr[1] & 0x0F) << 8) | lr[0];
+}
+
+int
+SyzygyTB::probe_table(Table & t, const int8_t * board, bool white_move, bool black_stronger, int wdl, Probe & result)
+{
+  int      squares[MAX_PIECES];
+  int      size       = 0;
+  int      lead_count = 0;
+  int      tb_file    = 0;
+  uint64_t idx;
+
+  // Symmetric tables only hold the white to move positions: with black to
+  // move, colors are switched and squares flipped, as when black is the
+  // stronger side.
+  bool flip         = (t.symmetric && !white_move) || black_stronger;
+  int  flip_color   = flip ? 8  : 0;
+  int  flip_squares = flip ? 56 : 0;
+  int  stm          = (flip ? 1 : 0) ^ (white_move ? 0 : 1);
+
+  PairsData * d = &t.items[0][0];
+
+  // With pawns, there are 4 tables, according to the file of the leading
+  // pawn (a .. d, after mirroring).
+  if (t.has_pawns) {
+    int8_t fig = code_to_fig(d->pieces[0] ^ flip_color);
+    for (int sq = 0; sq < 64; sq++) {
+      if (board[sq ^ 56] == fig) squares[size++] = sq ^ flip_squares;
+    }
+    lead_count = size;
+    std::swap(squares[0], *std::max_element(squares, squares + lead_count, pawns_comp));
+    tb_file = file_of(squares[0]);
+    if (tb_file > 3) tb_file = 7 - tb_file;
+  }
+
+  d = t.dtz ? &t.items[0][tb_file] : &t.items[t.symmetric ? 0 : stm][tb_file];
+
+  // DTZ tables hold the positions of one side to move only.
+  if (t.dtz && ((d->flags & STM) != stm) && !(t.symmetric && !t.has_pawns)) {
+    result = Probe::CHANGE_STM;
+    return 0;
+  }
+
+  // Other pieces, in the order of the table.
+  for (int i = lead_count; i < t.piece_count; ) {
+    int8_t fig   = code_to_fig(d->pieces[i] ^ flip_color);
+    int    first = i;
+    for (int sq = 0; (sq < 64) && (i < t.piece_count); sq++) {
+      if (board[sq ^ 56] == fig) squares[i++] = sq ^ flip_squares;
+    }
+    if (i == first) {
+      result = Probe::FAIL;
+      return 0;
+    }
+  }
+  size = t.piece_count;
+
+  // The leading piece goes to the a1-d1-d4 triangle (or files a .. d).
+  if (file_of(squares[0]) > 3) {
+    for (int i = 0; i < size; i++) squares[i] ^= 7;
+  }
+
+  if (t.has_pawns) {
+    idx = lead_pawn_idx[lead_count][squares[0]];
+    std::stable_sort(squares + 1, squares + lead_count, pawns_comp);
+    for (int i = 1; i < lead_count; i++) idx += binomial[i][map_pawns[squares[i]]];
+  }
+  else {
+    if (rank_of(squares[0]) > 3) {
+      for (int i = 0; i < size; i++) squares[i] ^= 56;
+    }
+
+    // First piece of the leading group not on the a1-h8 diagonal goes below
+    // it.
+    for (int i = 0; i < d->group_len[0]; i++) {
+      if (off_a1h8(squares[i]) == 0) continue;
+      if (off_a1h8(squares[i]) > 0) {
+        for (int j = i; j < size; j++) squares[j] = ((squares[j] >> 3) | (squares[j] << 3)) & 63;
+      }
+      break;
+    }
+
+    if (t.has_unique_pieces) {
+      int adjust1 = (squares[1] > squares[0]);
+      int adjust2 = (squares[2] > squares[0]) + (squares[2] > squares[1]);
+
+      if (off_a1h8(squares[0])) {
+        idx = ((uint64_t) map_a1d1d4[squares[0]] * 63 + (squares[1] - adjust1)) * 62 + squares[2] - adjust2;
+      }
+      else if (off_a1h8(squares[1])) {
+        idx = (6 * 63 + rank_of(squares[0]) * 28 + map_b1h1h7[squares[1]]) * 62 + squares[2] - adjust2;
+      }
+      else if (off_a1h8(squares[2])) {
+        idx = 6 * 63 * 62 + 4 * 28 * 62 +
+              rank_of(squares[0]) * 7 * 28 +
+              (rank_of(squares[1]) - adjust1) * 28 +
+              map_b1h1h7[squares[2]];
+      }
+      else {
+        idx = 6 * 63 * 62 + 4 * 28 * 62 + 4 * 7 * 28 +
+              rank_of(squares[0]) * 7 * 6 +
+              (rank_of(squares[1]) - adjust1) * 6 +
+              (rank_of(squares[2]) - adjust2);
+      }
+    }
+    else {
+      idx = map_kk[map_a1d1d4[squares[0]]][squares[1]];
+    }
+  }
+
+  // Remaining groups: combinations of squares, not counting the squares
+  // taken by the previous groups.
+  idx *= d->group_idx[0];
+
+  int * group_sq        = squares + d->group_len[0];
+  bool  remaining_pawns = t.has_pawns && (t.pawn_count[1] > 0);
+
+  for (int next = 1; d->group_len[next] != 0; next++) {
+    std::stable_sort(group_sq, group_sq + d->group_len[next]);
+    uint64_t n = 0;
+    for (int i = 0; i < d->group_len[next]; i++) {
+      int adjust = 0;
+      for (int * s = squares; s < group_sq; s++) if (group_sq[i] > *s) adjust++;
+      n += binomial[i + 1][group_sq[i] - adjust - (remaining_pawns ? 8 : 0)];
+    }
+    remaining_pawns = false;
+    idx      += n * d->group_idx[next];
+    group_sq += d->group_len[next];
+  }
+
+  bool ok;
+  int  value = decompress(t, *d, idx, ok);
+  if (!ok) {
+    result = Probe::FAIL;
+    return 0;
+  }
+
+  if (!t.dtz) return value - 2;
+
+  // DTZ values may be mapped, per WDL value, and stored in moves instead of
+  // plies.
+  static const int wdl_map[] = { 1, 3, 0, 2, 0 };
+
+  PairsData & d0 = t.items[0][tb_file];
+  if (d0.flags & MAPPED) {
+    uint32_t at = d0.map_idx[wdl_map[wdl + 2]];
+    if (d0.flags & WIDE) {
+      at += 2 * value;
+      if (at + 1 >= t.map.size()) { result = Probe::FAIL; return 0; }
+      value = get_le16(&t.map[at]);
+    }
+    else {
+      at += value;
+      if (at >= t.map.size()) { result = Probe::FAIL; return 0; }
+      value = t.map[at];
+    }
+  }
+
+  if (((wdl ==  2) && !(d0.flags & WIN_PLIES )) ||
+      ((wdl == -2) && !(d0.flags & LOSS_PLIES)) ||
+       (wdl ==  1) || (wdl == -1)) {
+    value *= 2;
+  }
+
+  return value + 1;
+}
+
+int
+SyzygyTB::probe_wdl(const int8_t * board, bool white_move, Probe & result)
+{
+  result = Probe::OK;
+
+  int pieces = 0;
+  for (int i = 0; i < 64; i++) if (board[i] != NO_FIG) pieces++;
+  if (pieces == 2) return 0;   // KvK
+
+  bool    black_stronger;
+  Table * table = find(wdl_tables, board, black_stronger);
+  if (table == nullptr) {
+    result = Probe::FAIL;
+    return 0;
+  }
+
+  return probe_table(*table, board, white_move, black_stronger, 0, result);
+}
+
+int
+SyzygyTB::probe_dtz(const int8_t * board, bool white_move, int wdl, Probe & result)
+{
+  result = Probe::OK;
+
+  bool    black_stronger;
+  Table * table = find(dtz_tables, board, black_stronger);
+  if (table == nullptr) {
+    result = Probe::FAIL;
+    return 0;
+  }
+
+  return probe_table(*table, board, white_move, black_stronger, wdl, result);
+}
@@ -0,0 +1,145 @@
+// Chess engine Syzygy tablebases
+//
+// Guy Turcotte
+// for inclusion in the Chess-InkPlate project
+//
+// (c) January 2021 - GPL-3.0
+//
+// The table decoding and indexing are a port of the Syzygy probing code of
+// Stockfish (src/syzygy/tbprobe.cpp, GPL-3.0): (c) 2013 Ronald de Man, the
+// author of the tablebases, (c) 2016 Marco Costalba and Lucas Braesch, and
+// the Stockfish developers.
+
+#pragma once
+
+// Probing of the Syzygy endgame tablebases (WDL .rtbw and DTZ .rtbz files),
+// following the format of the reference implementation by Ronald de Man.
+//
+// A table holds one value for each position of a material set (KRvK, ...):
+//
+// - WDL: win, cursed win (win spoiled by the fifty moves rule), draw, blessed
+//   loss or loss, as -2 .. 2 from the side to move point of view.
+// - DTZ: distance to the next capture or pawn move (zeroing move) that keeps
+//   the WDL value, in plies.
+//
+// The tables do not hold the right value when the best move is a capture (or
+// a pawn move for DTZ), nor the positions with castling rights or en passant.
+// This class only reads the raw table values: ChessEngine resolves the
+// captures with its own move generator before trusting them.
+//
+// The files are found in a single directory: any path on Linux, a folder of
+// the SD card on the device. They are opened on their first probe. On Linux
+// they are memory mapped. On the ESP32, the headers are kept in memory and
+// the compressed blocks are read from the file when needed.
+
+#include <cinttypes>
+#include <string>
+#include <vector>
+#include <map>
+
+#if !CHESS_LINUX_BUILD
+  #include <cstdio>
+#endif
+
+class SyzygyTB
+{
+  public:
+    static constexpr int MAX_PIECES = 7;
+
+    enum class Probe : int8_t { FAIL, OK, CHANGE_STM, ZEROING_BEST_MOVE };
+
+    SyzygyTB() : max_pieces(0) { }
+    ~SyzygyTB() { clear(); }
+
+    // Registers the tables found in the directory. Returns the number of
+    // WDL tables found.
+    int                 init(const std::string & path);
+    void               clear();
+    inline int get_max_pieces() const { return max_pieces; }
+
+    // board is the engine board (a8 = 0), without castling rights.
+    int            probe_wdl(const int8_t * board, bool white_move, Probe & result);
+    int            probe_dtz(const int8_t * board, bool white_move, int wdl, Probe & result);
+
+  private:
+    class TBFile
+    {
+      public:
+        TBFile() :
+          #if CHESS_LINUX_BUILD
+            data(nullptr),
+          #else
+            file(nullptr),
+          #endif
+            size(0) { }
+
+        bool open(const std::string & filename);
+        void close();
+        bool read(uint64_t offset, void * buffer, size_t length);
+        inline uint64_t get_size() const { return size; }
+
+      private:
+        #if CHESS_LINUX_BUILD
+          const uint8_t * data;
+        #else
+          FILE          * file;
+        #endif
+        uint64_t size;
+    };
+
+    struct PairsData {
+      uint8_t               flags;
+      uint32_t              block_size;          // Bytes
+      uint64_t              span;                // Positions between two sparse index entries
+      uint32_t              num_blocks;
+      uint32_t              block_length_size;
+      uint64_t              sparse_index_size;
+      int                   min_sym_len;         // Single value of the table with SINGLE_VALUE
+      std::vector<uint64_t> base64;
+      std::vector<uint16_t> lowest_sym;
+      std::vector<uint8_t>  symlen;
+      std::vector<uint8_t>  btree;               // Left and right symbols, 12 bits each
+      uint64_t              sparse_index;        // File offsets
+      uint64_t              block_length;
+      uint64_t              data;
+      uint8_t               pieces[MAX_PIECES];
+      uint64_t              group_idx[MAX_PIECES + 1];
+      int                   group_len[MAX_PIECES + 1];
+      uint32_t              map_idx[4];          // DTZ: offsets in the value maps
+    };
+
+    struct Table {
+      std::string          filename;
+      bool                 dtz;
+      bool                 loaded;
+      bool                 failed;
+      bool                 has_pawns;
+      bool                 has_unique_pieces;
+      bool                 symmetric;            // Same material for both sides
+      int                  piece_count;
+      int                  pawn_count[2];        // Leading color first
+      TBFile               file;
+      PairsData            items[2][4];          // [side to move][file of the leading pawn]
+      std::vector<uint8_t> map;                  // DTZ value maps
+      std::vector<uint8_t> block;                // Compressed block being decoded
+    };
+
+    std::map<uint64_t, Table *> wdl_tables;      // By material signature
+    std::map<uint64_t, Table *> dtz_tables;
+    int                         max_pieces;
+
+    Table       * find(std::map<uint64_t, Table *> & tables, const int8_t * board, bool & black_stronger);
+    bool          load(Table & table);
+    bool      set_sizes(PairsData & d, uint64_t & offset, TBFile & file);
+    void     set_groups(Table & table, PairsData & d, const int order[2], int f);
+    uint8_t  set_symlen(PairsData & d, int sym, std::vector<bool> & visited);
+    int      decompress(Table & table, PairsData & d, uint64_t idx, bool & ok);
+    int     probe_table(Table & table, const int8_t * board, bool white_move, bool black_stronger,
+                        int wdl, Probe & result);
+};
+
+#if CHESS_ENGINE
+  SyzygyTB syzygy;
+#else
+  extern SyzygyTB syzygy;
+#endif
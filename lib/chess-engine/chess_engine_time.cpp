@@ -0,0 +1,82 @@
+// Chess engine time manager
+//
+// Guy Turcotte
+// for inclusion in the Chess-InkPlate project
+//
+// (c) January 2021 - GPL-3.0
+
+#include "chess_engine_time.hpp"
+
+#include <algorithm>
+
+void
+TimeManager::set_move_time(unsigned long time_ms)
+{
+  optimum    = maximum = (time_ms == 0) ? ULONG_MAX : time_ms;
+  clock_mode = false;
+}
+
+void
+TimeManager::set_clock(unsigned long remaining_ms, unsigned long inc_ms, int moves_to_go)
+{
+  unsigned long available = (remaining_ms > MOVE_OVERHEAD) ? remaining_ms - MOVE_OVERHEAD : 1;
+  int           moves     = (moves_to_go > 0) ? std::min(moves_to_go, MOVES_HORIZON) : MOVES_HORIZON;
+
+  optimum = available / moves + inc_ms * 3 / 4;
+
+  // Never more than 80% of what is left, unless this is the last move
+  // before the time control.
+  maximum = (moves == 1) ? available * 9 / 10 : available * 8 / 10;
+  maximum = std::min(maximum, optimum * 5);
+  optimum = std::min(optimum, maximum);
+
+  if (maximum == 0) maximum = 1;
+  if (optimum == 0) optimum = 1;
+
+  clock_mode = true;
+}
+
+void
+TimeManager::start()
+{
+  start_time          = std::chrono::steady_clock::now();
+  instability         = 0;
+  last_iteration_end  = 0;
+  last_iteration_time = 0;
+}
+
+bool
+TimeManager::iteration_done(bool best_changed, bool failed_low)
+{
+  if (maximum == ULONG_MAX) return false;
+
+  unsigned long now            = elapsed();
+  unsigned long iteration_time = now - last_iteration_end;
+
+  // The next iteration is expected to take as much more time than this one
+  // as this one took compared to the previous one (within reason).
+  unsigned long next_time;
+  if (last_iteration_time == 0) next_time = iteration_time * 4;
+  else {
+    next_time = iteration_time * iteration_time / last_iteration_time;
+    next_time = std::min(std::max(next_time, iteration_time * 2), iteration_time * 6);
+  }
+
+  last_iteration_end  = now;
+  last_iteration_time = std::max(iteration_time, 1UL);
+
+  if (pondering) return false;
+
+  if (now + next_time > maximum) return true;
+
+  if (clock_mode) {
+    instability /= 2;
+    if (best_changed) instability += EXTENSION_STEP;
+    if (failed_low  ) instability += EXTENSION_STEP;
+
+    unsigned long target = std::min(maximum, optimum + optimum / 1000 * instability);
+    if (now >= target) return true;
+  }
+
+  return false;
+}
@@ -0,0 +1,81 @@
+// Chess engine time manager
+//
+// Guy Turcotte
+// for inclusion in the Chess-InkPlate project
+//
+// (c) January 2021 - GPL-3.0
+
+#pragma once
+
+// Decides how long the engine is thinking on a move. Two modes:
+//
+// - Fixed time per move (the device ENGINE_TIME setting, UCI movetime): the
+//   budget is the maximum. An iteration is not started when it would not end
+//   before it, as its result would be thrown away.
+//
+// - Clock (remaining time, increment, moves to go): an optimum time is
+//   allocated for the move, with a maximum that is never exceeded. The
+//   optimum is extended when the best move changes between iterations or
+//   when the score drops (fail-low).
+//
+// solve_step() calls iteration_done() after each iteration to know if the
+// search must go on, and out_of_time() inside the search.
+//
+// While pondering (searching on the opponent's time), there is no limit. The
+// limits apply again at the ponder hit, counted from start(): the time
+// already spent on the position is credited to the move.
+
+#include <cinttypes>
+#include <climits>
+#include <chrono>
+#include <atomic>
+
+class TimeManager
+{
+  public:
+    TimeManager() :
+          optimum(ULONG_MAX),
+          maximum(ULONG_MAX),
+      clock_mode(false),
+       pondering(false) { }
+
+    // A zero time means no time limit.
+    void     set_move_time(unsigned long time_ms);
+    void         set_clock(unsigned long remaining_ms, unsigned long inc_ms, int moves_to_go);
+
+    // Called at the beginning of the search.
+    void             start();
+
+    // Called at the end of each iteration. Returns true if the search must
+    // stop: optimum time used or next iteration not expected to end in time.
+    bool    iteration_done(bool best_changed, bool failed_low);
+
+    inline unsigned long elapsed() const {
+      return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - start_time).count();
+    }
+
+    // Called from another thread than the search one.
+    inline void     set_pondering(bool on) { pondering = on; }
+
+    inline bool       out_of_time() const { return !pondering && (elapsed() > maximum); }
+    inline unsigned long get_optimum() const { return optimum; }
+    inline unsigned long get_maximum() const { return maximum; }
+
+  private:
+    static constexpr unsigned long MOVE_OVERHEAD  = 50; // ms kept for the GUI/communication
+    static constexpr int           MOVES_HORIZON  = 40; // Moves expected when not given
+    static constexpr int           EXTENSION_STEP = 500; // Per mille of optimum
+
+    unsigned long optimum;
+    unsigned long maximum;
+    bool          clock_mode;
+
+    std::atomic<bool> pondering;
+
+    int           instability;         // Per mille extension of the optimum
+    unsigned long last_iteration_end;
+    unsigned long last_iteration_time;
+
+    std::chrono::time_point<std::chrono::steady_clock> start_time;
+};
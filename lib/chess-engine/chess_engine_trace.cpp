@@ -0,0 +1,42 @@
+// Chess engine search trace
+//
+// Guy Turcotte
+// for inclusion in the Chess-InkPlate project
+//
+// (c) January 2021 - GPL-3.0
+
+#include "chess_engine_trace.hpp"
+
+#include <fstream>
+#include <cstring>
+
+bool
+SearchTrace::dump(const std::string & filename)
+{
+  std::ofstream file(filename, std::ios::out | std::ios::binary);
+
+  if (!file.is_open()) return false;
+
+  TraceFileHeader header;
+
+  std::memcpy(header.magic, "CTRC", 4);
+  header.version    = TRACE_FILE_VERSION;
+  header.event_size = sizeof(TraceEvent);
+  header.reserved   = 0;
+  header.count      = (head < SIZE) ? head : SIZE;
+  header.lost       = head - header.count;
+
+  file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+
+  // Oldest event first: when the ring has wrapped, it is the one at head.
+
+  uint32_t first = head - header.count;
+  for (uint32_t i = 0; i < header.count; i++) {
+    file.write(reinterpret_cast<const char *>(&events[(first + i) & (SIZE - 1)]), sizeof(TraceEvent));
+  }
+
+  bool res = !file.fail();
+  file.close();
+
+  return res;
+}
@@ -0,0 +1,96 @@
+// Chess engine search trace
+//
+// Guy Turcotte
+// for inclusion in the Chess-InkPlate project
+//
+// (c) January 2021 - GPL-3.0
+
+#pragma once
+
+// Binary trace of the search events. Each event is a fixed size record
+// written in a ring buffer, so only the last CHESS_TRACE_SIZE events are
+// kept. Recording an event is a few stores: it does not change the timing of
+// the search the way printing to the console (or the ESP32 serial port) did.
+//
+// The trace is compiled in only when CHESS_TRACE is set to 1 (-D CHESS_TRACE=1
+// in platformio.ini). The ring buffer is dumped to a file with
+// ChessEngine::dump_trace() and decoded offline with tools/trace_decoder.
+
+#ifndef CHESS_TRACE
+  #define CHESS_TRACE 0
+#endif
+
+#ifndef CHESS_TRACE_SIZE
+  #define CHESS_TRACE_SIZE 4096 // Must be a power of 2
+#endif
+
+#include <cinttypes>
+#include <string>
+
+enum class TraceKind   : uint8_t { ITERATION, ENTER, MOVE, SCORE, CUTOFF, PRUNE, RESULT };
+enum class PruneReason : uint8_t { NONE, NULL_MOVE, FUTILITY, LAZY_EVAL, REPETITION, TIME };
+
+#pragma pack(push, 1)
+struct TraceEvent {
+  TraceKind   kind;
+  uint8_t     ply;      // pos_idx at the time of the event
+  int8_t      c1, c2;   // Move, if any (-1 otherwise)
+  int16_t     score;    // Score, alpha at node entry, move index for MOVE
+  int8_t      depth;    // Remaining depth or iteration level
+  PruneReason reason;   // Why a node or a move was pruned
+  uint32_t    node;     // Node count when the event was recorded
+};
+
+struct TraceFileHeader {
+  char        magic[4]; // "CTRC"
+  uint8_t     version;
+  uint8_t     event_size;
+  uint16_t    reserved;
+  uint32_t    count;    // Number of events following the header, oldest first
+  uint32_t    lost;     // Number of events overwritten in the ring
+};
+#pragma pack(pop)
+
+class SearchTrace
+{
+  public:
+    static constexpr uint8_t  TRACE_FILE_VERSION = 1;
+    static constexpr uint32_t SIZE               = CHESS_TRACE_SIZE;
+
+    static_assert((SIZE & (SIZE - 1)) == 0, "CHESS_TRACE_SIZE must be a power of 2");
+
+    SearchTrace() : head(0) { }
+
+    inline void clear() { head = 0; }
+
+    inline void add(TraceKind kind, int ply, int c1, int c2, int score, int depth, PruneReason reason, uint32_t node) {
+      TraceEvent & e = events[head++ & (SIZE - 1)];
+      e.kind   = kind;
+      e.ply    = ply;
+      e.c1     = c1;
+      e.c2     = c2;
+      e.score  = score;
+      e.depth  = depth;
+      e.reason = reason;
+      e.node   = node;
+    }
+
+    bool dump(const std::string & filename);
+
+  private:
+    uint32_t   head;
+    TraceEvent events[SIZE];
+};
+
+#if CHESS_TRACE
+  #if CHESS_ENGINE
+    SearchTrace search_trace;
+  #else
+    extern SearchTrace search_trace;
+  #endif
+
+  #define TRACE_EVENT(kind, ply, c1, c2, score, depth, reason) \
+    search_trace.add(TraceKind::kind, ply, c1, c2, score, depth, PruneReason::reason, move_count)
+#else
+  #define TRACE_EVENT(kind, ply, c1, c2, score, depth, reason)
+#endif
@@ -11,6 +11,8 @@
 
 #include <cinttypes>
 
+#include "chess_engine_nnue.hpp"
+
 const int MAXSTEPS = 150;
 const int MAXDEPTH =  30;
 const int MAXEPD   =   5;
@@ -31,6 +33,13 @@ enum class MoveType  : int8_t { UNKNOWN = -1, SIMPLE, EN_PASSANT, CASTLE_KINGSID
 enum class EndOfGameType : int8_t { NONE, CHECKMATE, PAT, DRAW };
 
 const int fig_weight[] = { 0, 100, 320, 330, 500, 900, 0 };
+
+// Game phase: the sum of the phase weight of the pieces, from PHASE_MAX
+// with all of them on the board (more after a promotion) down to 0 with
+// only kings and pawns.
+const int   phase_weight[] = { 0, 0, 3, 3, 5, 10, 0 };
+const int   PHASE_SHIFT    = 6;
+const int   PHASE_MAX      = 1 << PHASE_SHIFT;
 const char  fig_symb[] = "  NBRQK";
 const char fig_symb1[] = " pNBRQK";
 
@@ -62,5 +71,20 @@ struct Position {
   bool    check_on_table;
   short   weight_white;
   short   weight_black;
-  short   weight_both;
+  short   score_mg;              // Piece-square scores, white minus black,
+  short   score_eg;              //   in the middle game and in the endgame
+  uint8_t phase;                 // Game phase (see phase_weight)
+  bool    attacks_known;         // The fields below were set by generate_steps()
+  uint8_t king_attackers;        // Pieces of the side to move reaching the enemy king zone
+  int16_t king_attack;           // Zone squares they reach, by king_attack_weight
+  int16_t mobility_mg;           // Steps of the pieces of the side to move, by
+  int16_t mobility_eg;           //   mobility_mg and mobility_eg
+  uint8_t center;                // Steps reaching the four center squares
+  uint32_t knight_squares;       // Knights and bishops of the side to move, by
+  uint32_t bishop_squares;       //   PawnTable::outpost_bit()
+  uint64_t key;                  // Zobrist key of the position
+  uint64_t pawn_key;             // Zobrist key of the pawns only (see pawn_table)
+  uint64_t material;             // Material signature (see endgames)
+  int16_t halfmove;              // Plies since the last capture or pawn move
+  NnueAccumulator accumulator;   // First layer of the network, when loaded (see nnue)
 };
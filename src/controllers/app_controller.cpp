@@ -97,6 +97,14 @@ AppController::key_event(EventMgr::KeyEvent key)
   }
 }
 
+// Nothing is to be running while the device sleeps: the engine stops
+// searching on the user's time.
+void
+AppController::going_to_light_sleep()
+{
+  game_controller.stop_pondering();
+}
+
 void
 AppController::going_to_deep_sleep()
 {
@@ -295,6 +295,8 @@ EventMgr::set_orientation(Screen::Orientation orient)
           int8_t light_sleep_duration;
           config.get(Config::Ident::TIMEOUT, &light_sleep_duration);
 
+          app_controller.going_to_light_sleep();
+
           LOG_I("Light Sleep for %d minutes...", light_sleep_duration);
           ESP::delay(500);
 
@@ -9,22 +9,45 @@
 #include "viewers/board_viewer.hpp"
 #include "viewers/page.hpp"
 #include "viewers/msg_viewer.hpp"
+#include "models/config.hpp"
+#include "alloc.hpp"
 
 #include "chess_engine_steps.hpp"
+#include "chess_engine_trace.hpp"
 
 #if EPUB_INKPLATE_BUILD
   #include "nvs.h"
 #endif
 
+#if CHESS_INKPLATE_BUILD
+  #include <esp_pthread.h>
+#endif
+
 #include <string>
 #include <iostream>
 #include <iomanip>
 #include <sstream>
 #include <fstream>
+#include <cstring>
+#include <atomic>
+#include <chrono>
 
 static inline bool is_white_fig(int8_t fig) { return fig > 0; }
 static inline bool is_black_fig(int8_t fig) { return fig < 0; }
 
+static std::atomic<bool> ponder_searching(false);
+
+// Search of the pondering thread. A book move is left to engine_play().
+static void
+ponder_task()
+{
+  Step book_step;
+
+  if (!chess_engine.is_draw_by_rule() && !chess_engine.book_step(book_step)) chess_engine.solve_step();
+
+  ponder_searching = false;
+}
+
 bool 
 GameController::load()
 {
@@ -72,6 +95,8 @@ GameController::load()
 void 
 GameController::save()
 {
+  if (puzzle_mode) return; // The game was saved when the puzzle was started
+
   std::string   filename = MAIN_FOLDER "/current_game.save";
   std::ofstream file(filename, std::ios::out | std::ios::binary);
 
@@ -122,8 +147,7 @@ GameController::replay()
     chess_engine.move_pos (0, game_steps[step_idx]);
 
     chess_engine.generate_steps(1);
-    pos[1].white_move = !pos[0].white_move;
-    pos[0]            =  pos[1];
+    chess_engine.commit_step();
   }
 
   cursor_pos = game_play_white ? Pos(3, 3) : Pos(4, 4);
@@ -135,6 +159,11 @@ GameController::new_game(bool user_play_white)
 {
   game_over    = false;
   game_started = true;
+  puzzle_mode  = false;
+  review_count = 0;
+
+  board_viewer.set_annotations(nullptr, 0);
+  board_viewer.clear_hint();
 
   chess_engine.new_game();
 
@@ -158,10 +187,16 @@ GameController::new_game(bool user_play_white)
 void
 GameController::engine_play()
 {
-  board_viewer.show_board(
-    game_play_white, Pos(-1, -1), Pos(-1, -1), 
-    game_steps, game_play_number,
-    msg = "Engine is playing.");
+  bool pondered = ponder_found; // The board is already shown by end_pondering()
+
+  ponder_found = false;
+
+  if (!pondered) {
+    board_viewer.show_board(
+      game_play_white, Pos(-1, -1), Pos(-1, -1), 
+      game_steps, game_play_number,
+      msg = "Engine is playing.");
+  }
 
   msg.clear();
 
@@ -171,10 +206,158 @@ GameController::engine_play()
   for (int i = 0; i < MAXEPD; i++) best_move[i].c1 = -1;
 
   pos[0].best.c1 = -1;
+
+  if (chess_engine.is_draw_by_rule()) {
+    msg = "DRAW!!";
+    game_over = true;
+    return;
+  }
   
-  event_mgr.set_stay_on(true);
-  chess_engine.solve_step();
-  event_mgr.set_stay_on(false);
+  // Opening moves are taken from the book, without searching.
+  Step book_step, expected;
+  bool searched = true;
+
+  if (chess_engine.book_step(book_step)) {
+    pos[0].best = book_step;
+    searched    = false;
+  }
+  else if (pondered) {
+    chess_engine.generate_steps(0);
+    pos[0].best = ponder_best;
+  }
+  else {
+    event_mgr.set_stay_on(true);
+    chess_engine.solve_step();
+    event_mgr.set_stay_on(false);
+
+    #if CHESS_TRACE
+      chess_engine.dump_trace(MAIN_FOLDER "/search_trace.bin");
+    #endif
+  }
+
+  // The user reply expected by the search, taken before the move is played
+  if (searched) searched = chess_engine.get_ponder_step(expected);
+
+  play_best();
+
+  if (searched && !game_over) start_pondering(expected);
+}
+
+// The engine searches the position after the expected user move in its own
+// thread, on the user's time. As the engine board changes during the search,
+// the board shown and used to select the user move is a copy of the game
+// position. The search runs until the user move (end_pondering()), or until
+// stop_pondering() is called before leaving the board or going to sleep.
+void
+GameController::start_pondering(const Step & expected)
+{
+  int8_t ponder;
+  config.get(Config::Ident::PONDER, &ponder);
+
+  if ((ponder == 0) || puzzle_mode) return;
+
+  memcpy(shown_board, *game_board, sizeof(Board));
+
+  if (!chess_engine.play_step(chess_engine.step_to_uci(expected))) return;
+
+  memcpy(ponder_board, *chess_engine.get_board(), sizeof(Board));
+
+  Position * pos       = chess_engine.get_pos(0);
+  Step     * best_move = chess_engine.get_best_move(0);
+
+  for (int i = 0; i < MAXEPD; i++) best_move[i].c1 = -1;
+
+  pos[0].best.c1 = -1;
+
+  ponder_step = expected;
+  pondering   = true;
+  game_board  = &shown_board;
+  board_viewer.set_board(&shown_board);
+
+  chess_engine.set_pondering(true);
+  ponder_searching = true;
+
+  #if CHESS_INKPLATE_BUILD
+    // Lowest priority: the user interface stays responsive
+    esp_pthread_cfg_t cfg = esp_pthread_get_default_config();
+    cfg.thread_name = "ponderTask";
+    cfg.pin_to_core = 0;
+    cfg.stack_size  = PONDER_STACK_SIZE;
+    cfg.prio        = 1;
+    esp_pthread_set_cfg(&cfg);
+  #endif
+
+  ponder_thread = std::thread(ponder_task);
+}
+
+// Called with the user move in game_steps[game_play_number]. On the expected
+// move, the search goes on under the engine time limits, the time already
+// spent being credited, and its best move is kept for engine_play().
+// Otherwise, it is stopped.
+void
+GameController::end_pondering(bool async)
+{
+  if (!pondering) return;
+
+  Step & step = game_steps[game_play_number];
+
+  if ((step.c1 == ponder_step.c1) && 
+      (step.c2 == ponder_step.c2) &&
+      (!async || (ponder_step.type == promotion_move_type))) {
+
+    chess_engine.ponder_hit();
+
+    step = ponder_step;
+    board_viewer.set_board(&ponder_board);
+    board_viewer.show_board(
+      game_play_white, Pos(-1, -1), Pos(-1, -1), 
+      game_steps, game_play_number + 1,
+      "Engine is playing.");
+
+    event_mgr.set_stay_on(true);
+    ponder_thread.join();
+    event_mgr.set_stay_on(false);
+
+    ponder_best  = chess_engine.get_pos(0)->best;
+    ponder_found = (ponder_best.c1 != -1);
+  }
+
+  stop_pondering();
+}
+
+void
+GameController::stop_pondering()
+{
+  if (!pondering) return;
+
+  // The search may not have started yet: the stop request is repeated.
+  while (ponder_searching) {
+    chess_engine.stop();
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  if (ponder_thread.joinable()) ponder_thread.join();
+
+  chess_engine.set_pondering(false);
+  board_viewer.set_board(nullptr);
+  pondering = false;
+
+  // The engine root position is back to the game one. The cursor is kept
+  // where the user left it.
+  Pos cursor = cursor_pos;
+  Pos from   = from_pos;
+
+  replay();
+
+  cursor_pos = cursor;
+  from_pos   = from;
+}
+
+// Plays pos[0].best, found in the steps of the root position, or reports the
+// end of the game if there is none.
+void
+GameController::play_best()
+{
+  Position * pos = chess_engine.get_pos(0);
 
   if (pos[0].best.c1 != -1) {
     for (int i = 0; i < pos[0].steps_count; i++) {
@@ -204,8 +387,13 @@ GameController::engine_play()
       msg = "CHECKMATE!!";
     }
 
-    pos[0] = pos[1];
+    chess_engine.commit_step();
     game_play_number++;
+
+    if (!game_over && chess_engine.is_draw_by_rule()) {
+      game_over = true;
+      msg = "DRAW!!";
+    }
   } 
   else {
     EndOfGameType the_end = chess_engine.get_end_of_game_type();
@@ -232,9 +420,259 @@ GameController::engine_play()
   }
 }
 
+bool
+GameController::new_puzzle()
+{
+  if (!puzzles.is_open() && !puzzles.open(MAIN_FOLDER "/puzzles.bin")) return false;
+
+  int8_t rating;
+  config.get(Config::Ident::PUZZLE_RATING, &rating);
+
+  Puzzle   picked;
+  uint32_t idx;
+  if (!puzzles.pick(rating, picked, idx)) return false;
+
+  // The game is kept on the SD card and resumed with resume_game()
+  if (!puzzle_mode && game_started) save();
+
+  puzzle       = picked;
+  puzzle_index = idx;
+  puzzle_step  = 0;
+  puzzle_mode  = true;
+  review_count = 0;
+
+  board_viewer.set_annotations(nullptr, 0);
+  board_viewer.clear_hint();
+
+  game_over    = false;
+  game_started = true;
+
+  chess_engine.new_game();
+  chess_engine.load_board_from_fen(Puzzles::fen(puzzle));
+
+  game_board = chess_engine.get_board();
+
+  game_play_white  = puzzle.white_move;
+  game_play_number = 0;
+
+  cursor_pos = game_play_white ? Pos(3, 3) : Pos(4, 4);
+  from_pos   = Pos(-1, -1);
+
+  std::ostringstream stream;
+  stream << "Puzzle " << (puzzle_index + 1) << ", rating " << puzzle.rating 
+         << ". " << (game_play_white ? "White" : "Black") << " to play:";
+  msg = stream.str();
+
+  return true;
+}
+
+void
+GameController::resume_game()
+{
+  if (!puzzle_mode) return;
+
+  puzzle_mode  = false;
+  game_over    = false;
+  review_count = 0;
+  msg.clear();
+
+  board_viewer.set_annotations(nullptr, 0);
+  board_viewer.clear_hint();
+
+  chess_engine.new_game();
+
+  if (load()) replay();
+  else        new_game(true);
+}
+
+// The engine time limit, after a search under other limits.
+void
+GameController::restore_limits()
+{
+  int8_t engine_time;
+  config.get(Config::Ident::ENGINE_TIME, &engine_time);
+  chess_engine.set_engine_time(15 * engine_time);
+}
+
+static inline Pos
+board_pos(int board_idx)
+{
+  return Pos(board_idx & 7, 7 - (board_idx >> 3));
+}
+
+// Suggested move for the user: the next move of a puzzle, a book move, or
+// the best move of a short search at full strength. The hint is kept for
+// the position, for the next requests to be answered without searching.
+bool
+GameController::hint()
+{
+  Position * pos = chess_engine.get_pos(0);
+
+  if (game_over) return false;
+
+  pos[0].white_move = game_play_white;
+
+  if (!hint_valid || (hint_key != pos[0].key)) {
+    Step step;
+    bool found = false;
+
+    if (puzzle_mode) {
+      step.c1   = Puzzles::move_from(puzzle.moves[puzzle_step]);
+      step.c2   = Puzzles::move_to  (puzzle.moves[puzzle_step]);
+      step.f1   = (*game_board)[step.c1];
+      step.f2   = (*game_board)[step.c2];
+      step.type = Puzzles::move_promotion(puzzle.moves[puzzle_step]);
+      if (step.type == MoveType::UNKNOWN) step.type = MoveType::SIMPLE;
+      found = true;
+    }
+    else if (chess_engine.book_step(step)) {
+      found = true;
+    }
+    else {
+      Step * best_move = chess_engine.get_best_move(0);
+      int    skill     = chess_engine.get_skill_level();
+
+      for (int i = 0; i < MAXEPD; i++) best_move[i].c1 = -1;
+      pos[0].best.c1 = -1;
+
+      chess_engine.set_skill_level(ChessEngine::SKILL_LEVEL_COUNT - 1);
+      chess_engine.set_search_limits(0, 0, HINT_NODES);
+      chess_engine.new_game();
+      chess_engine.solve_step();
+      chess_engine.set_skill_level(skill);
+      restore_limits();
+
+      if (pos[0].best.c1 != -1) {
+        step  = pos[0].best;
+        found = true;
+      }
+    }
+
+    if (!found) return false;
+
+    hint_valid = true;
+    hint_key   = pos[0].key;
+    hint_step  = step;
+  }
+
+  board_viewer.set_hint(board_pos(hint_step.c1), board_pos(hint_step.c2));
+  msg = "Hint: " + chess_engine.step_to_str(hint_step);
+
+  return true;
+}
+
+static void
+review_progress(int done, int count)
+{
+  if ((done % 10) == 0) {
+    msg_viewer.show(MsgViewer::Severity::INFO, false, false, "Game Review",
+      "Reviewing the game, position %d of %d. Please wait.", done + 1, count + 1);
+  }
+}
+
+// Every move of the game is searched with the node budget of a Club level
+// move (a smaller budget misclassifies sound opening moves), the moves
+// already in the review file being reused. The result is kept in the review
+// file next to the saved game, and shown with the moves.
+bool
+GameController::review_game()
+{
+  if (puzzle_mode || (game_play_number == 0)) return false;
+
+  std::string         filename = MAIN_FOLDER "/current_game.review";
+  GameReview::Entry * entries  = (GameReview::Entry *) allocate(sizeof(GameReview::Entry) * game_play_number);
+
+  if (entries == nullptr) return false;
+
+  int  done = GameReview::load(filename, game_steps, game_play_number, entries);
+  bool ok   = true;
+
+  if (done < game_play_number) {
+    event_mgr.set_stay_on(true);
+    ok = GameReview::review(game_steps, game_play_number, REVIEW_NODES, entries, done, review_progress);
+    event_mgr.set_stay_on(false);
+
+    restore_limits();
+
+    if (ok) GameReview::save(filename, game_steps, entries, game_play_number);
+
+    replay(); // The engine root position is back to the current one
+  }
+
+  if (ok) {
+    int counts[GameReview::CLASS_COUNT] = { 0 };
+
+    for (int i = 0; i < game_play_number; i++) {
+      review_classes[i] = entries[i].cls;
+      if (((i & 1) == 0) == game_play_white) counts[(int) entries[i].cls]++;
+    }
+    review_count = game_play_number;
+    board_viewer.set_annotations(review_classes, review_count);
+
+    std::ostringstream stream;
+    stream << "Your moves: " 
+           << counts[(int) GameReview::Class::INACCURACY] << " ?!, "
+           << counts[(int) GameReview::Class::MISTAKE   ] << " ?, "
+           << counts[(int) GameReview::Class::BLUNDER   ] << " ??";
+    if (counts[(int) GameReview::Class::UNKNOWN] > 0) {
+      stream << ", " << counts[(int) GameReview::Class::UNKNOWN] << " unknown";
+    }
+    msg = stream.str();
+  }
+
+  free(entries);
+
+  return ok;
+}
+
+// True if the step is the expected move of the puzzle solution.
+bool
+GameController::puzzle_move(const Step & step)
+{
+  uint16_t move      = puzzle.moves[puzzle_step];
+  MoveType promotion = (step.type > MoveType::CASTLE_QUEENSIDE) ? step.type : MoveType::UNKNOWN;
+
+  return (step.c1   == Puzzles::move_from(move)) &&
+         (step.c2   == Puzzles::move_to(move)  ) &&
+         (promotion == Puzzles::move_promotion(move));
+}
+
+// The opponent reply is taken from the puzzle solution. No search is done.
+void
+GameController::puzzle_play()
+{
+  Position * pos = chess_engine.get_pos(0);
+
+  if (!game_over && (puzzle_step < puzzle.move_count)) {
+    pos[0].white_move = !game_play_white;
+    chess_engine.generate_steps(0);
+
+    pos[0].best.c1 = -1;
+    for (int i = 0; i < pos[0].steps_count; i++) {
+      if (puzzle_move(pos[0].steps[i])) {
+        pos[0].best = pos[0].steps[i];
+        break;
+      }
+    }
+
+    puzzle_step++;
+    play_best();
+  }
+
+  if (game_over || (puzzle_step >= puzzle.move_count)) {
+    game_over = true;
+    msg = "Puzzle solved!";
+  }
+  else {
+    msg = "Correct. Please find the next move:";
+  }
+}
+
 void
 GameController::complete_move(bool async)
 {
+  end_pondering(async);
+
   Position * pos       = chess_engine.get_pos(0);
   Step     * best_move = chess_engine.get_best_move(0);
 
@@ -313,12 +751,27 @@ GameController::complete_move(bool async)
         }
       }
 
-      pos[1].white_move = !pos[0].white_move;
-      pos[0]            =  pos[1];
+      if (puzzle_mode && 
+          !puzzle_move(game_steps[game_play_number]) && 
+          (game_steps[game_play_number].check != CheckType::CHECKMATE)) {
+        // Only the stored line is accepted, or any other checkmate
+        chess_engine.back_step(0, game_steps[game_play_number]);
+        msg = "Not the solution. Please retry.";
+      }
+      else {
+        chess_engine.commit_step();
 
-      game_play_number++;
+        game_play_number++;
 
-      engine_play();  
+        if (puzzle_mode) {
+          puzzle_step++;
+          if (game_steps[game_play_number - 1].check == CheckType::CHECKMATE) game_over = true;
+          puzzle_play();
+        }
+        else {
+          engine_play();  
+        }
+      }
     }
   } 
   else {
@@ -339,7 +792,17 @@ GameController::complete_move(bool async)
 void
 GameController::play(Pos pos_from, Pos pos_to)
 {
-  Position * pos       = chess_engine.get_pos(0);
+  // The engine root position is not used: it may be the one being pondered.
+  board_viewer.clear_hint();
+
+  if (puzzle_mode && game_over) {
+    from_pos = Pos(-1, -1);
+    board_viewer.show_board(
+      game_play_white, cursor_pos, from_pos, 
+      game_steps, game_play_number, 
+      msg = "Puzzle solved! Another one is in the menu.");
+    return;
+  }
 
   game_started = true;
   
@@ -350,8 +813,8 @@ GameController::play(Pos pos_from, Pos pos_to)
   game_steps[game_play_number].f2 = (*game_board)[game_steps[game_play_number].c2];
 
   if ((abs(game_steps[game_play_number].f1) == PAWN) &&
-      (( pos[0].white_move && (ChessEngine::row[game_steps[game_play_number].c2] == 8)) ||
-       (!pos[0].white_move && (ChessEngine::row[game_steps[game_play_number].c2] == 1)))) {
+      (( game_play_white && (ChessEngine::row[game_steps[game_play_number].c2] == 8)) ||
+       (!game_play_white && (ChessEngine::row[game_steps[game_play_number].c2] == 1)))) {
     // This is a pawn promotion move to the last board row. The following will display
     // a promotino selection menu that will trigger, on return, the complete_move method.
     complete_user_move = true;
@@ -367,6 +830,14 @@ GameController::play(Pos pos_from, Pos pos_to)
 void 
 GameController::enter()
 { 
+  if (!opening_book.is_open()) opening_book.open(MAIN_FOLDER "/book.bin");
+  if (!tablebases_checked) {
+    chess_engine.set_tablebase_path(MAIN_FOLDER "/syzygy");
+    chess_engine.set_bitbase_path(MAIN_FOLDER "/bitbases");
+    chess_engine.load_network(MAIN_FOLDER "/nnue.bin");
+    tablebases_checked = true;
+  }
+
   if (!game_started) {
     if (load()) {
       replay();
@@ -396,6 +867,9 @@ GameController::enter()
 void 
 GameController::leave(bool going_to_deep_sleep)
 {
+  // Pondering goes on while the user selects a promotion
+  if (!complete_user_move) stop_pondering();
+
   if (going_to_deep_sleep) save();
 }
 
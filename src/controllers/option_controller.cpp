@@ -26,11 +26,15 @@ static int8_t timeout;
 static int8_t chess_font;
 static int8_t show_heap;
 static int8_t engine_time;
+static int8_t skill_level;
+static int8_t puzzle_rating;
+static int8_t ponder;
 // static int8_t ok;
 
 static Screen::PixelResolution  old_resolution;
 static int8_t old_chess_font;
 static int8_t old_engine_time;
+static int8_t old_skill_level;
 
 static constexpr int8_t MAIN_FORM_SIZE = 4;
 static FormViewer::FormEntry main_params_form_entries[MAIN_FORM_SIZE] = {
@@ -40,10 +44,13 @@ static FormViewer::FormEntry main_params_form_entries[MAIN_FORM_SIZE] = {
   { "Show Heap Size :",           &show_heap,              2, FormViewer::yes_no_choices,     FormViewer::FormEntryType::HORIZONTAL_CHOICES }
 };
 
-static constexpr int8_t FONT_FORM_SIZE = 2;
+static constexpr int8_t FONT_FORM_SIZE = 5;
 static FormViewer::FormEntry chess_params_form_entries[FONT_FORM_SIZE] = {
-  { "Engine Work Duration :", &engine_time, 5, FormViewer::engine_time_choices, FormViewer::FormEntryType::HORIZONTAL_CHOICES },
-  { "Chess Font :",           &chess_font,  7, FormViewer::font_choices,        FormViewer::FormEntryType::VERTICAL_CHOICES   }
+  { "Engine Work Duration :", &engine_time,   5, FormViewer::engine_time_choices,   FormViewer::FormEntryType::HORIZONTAL_CHOICES },
+  { "Engine Skill Level :",   &skill_level,   5, FormViewer::skill_level_choices,   FormViewer::FormEntryType::HORIZONTAL_CHOICES },
+  { "Puzzles Rating :",       &puzzle_rating, 5, FormViewer::puzzle_rating_choices, FormViewer::FormEntryType::HORIZONTAL_CHOICES },
+  { "Think On User's Time :", &ponder,        2, FormViewer::yes_no_choices,        FormViewer::FormEntryType::HORIZONTAL_CHOICES },
+  { "Chess Font :",           &chess_font,    7, FormViewer::font_choices,          FormViewer::FormEntryType::VERTICAL_CHOICES   }
 };
 
 extern bool start_web_server();
@@ -71,11 +78,15 @@ main_parameters()
 static void
 chess_parameters()
 {
-  config.get(Config::Ident::ENGINE_TIME,  &engine_time);
-  config.get(Config::Ident::DEFAULT_FONT, &chess_font );
+  config.get(Config::Ident::ENGINE_TIME,   &engine_time  );
+  config.get(Config::Ident::SKILL_LEVEL,   &skill_level  );
+  config.get(Config::Ident::PUZZLE_RATING, &puzzle_rating);
+  config.get(Config::Ident::PONDER,        &ponder       );
+  config.get(Config::Ident::DEFAULT_FONT,  &chess_font   );
   
   old_chess_font         = chess_font;
   old_engine_time        = engine_time;
+  old_skill_level        = skill_level;
   // ok                     = 0;
 
   form_viewer.show(
@@ -115,10 +126,58 @@ new_game_play_black()
   app_controller.set_controller(AppController::Ctrl::LAST);
 }
 
-static MenuViewer::MenuEntry menu[8] = {
+void
+new_puzzle()
+{
+  if (game_controller.new_puzzle()) {
+    app_controller.set_controller(AppController::Ctrl::LAST);
+  }
+  else {
+    msg_viewer.show(MsgViewer::Severity::ALERT, false, false, "No Puzzle",
+      "Unable to find a puzzle in the file %s. It is built with the puzzle_builder tool.",
+      MAIN_FOLDER "/puzzles.bin");
+  }
+}
+
+void
+resume_game()
+{
+  game_controller.resume_game();
+  app_controller.set_controller(AppController::Ctrl::LAST);
+}
+
+void
+review_game()
+{
+  if (game_controller.review_game()) {
+    app_controller.set_controller(AppController::Ctrl::LAST);
+  }
+  else {
+    msg_viewer.show(MsgViewer::Severity::ALERT, false, false, "Game Review",
+      "The game could not be reviewed. Puzzles are not reviewed.");
+  }
+}
+
+void
+hint()
+{
+  if (game_controller.hint()) {
+    app_controller.set_controller(AppController::Ctrl::LAST);
+  }
+  else {
+    msg_viewer.show(MsgViewer::Severity::ALERT, false, false, "Hint",
+      "No hint was found for this position.");
+  }
+}
+
+static MenuViewer::MenuEntry menu[12] = {
   { MenuViewer::Icon::RETURN,      "Return to the chessboard",             CommonActions::return_to_last},
+  { MenuViewer::Icon::W_PAWN,      "Hint for the next move",               hint                         },
   { MenuViewer::Icon::W_KNIGHT,    "New game, play white",                 new_game_play_white          },
   { MenuViewer::Icon::B_KNIGHT,    "New game, play black",                 new_game_play_black          },
+  { MenuViewer::Icon::W_QUEEN,     "New puzzle",                           new_puzzle                   },
+  { MenuViewer::Icon::REVERT,      "Back to the saved game",               resume_game                  },
+  { MenuViewer::Icon::BOOK_LIST,   "Review the game",                      review_game                  },
   { MenuViewer::Icon::MAIN_PARAMS, "Main parameters",                      main_parameters              },
   { MenuViewer::Icon::CHESS,       "Chess parameters",                     chess_parameters             },
 //{ MenuViewer::Icon::WIFI,        "WiFi Access to the games folder",      wifi_mode                     },
@@ -169,12 +228,16 @@ OptionController::key_event(EventMgr::KeyEvent key)
     if (form_viewer.event(key)) {
       chess_form_is_shown = false;
       // if (ok) {
-        config.put(Config::Ident::ENGINE_TIME,  engine_time);
-        config.put(Config::Ident::DEFAULT_FONT, chess_font );
+        config.put(Config::Ident::ENGINE_TIME,   engine_time  );
+        config.put(Config::Ident::SKILL_LEVEL,   skill_level  );
+        config.put(Config::Ident::PUZZLE_RATING, puzzle_rating);
+        config.put(Config::Ident::PONDER,        ponder       );
+        config.put(Config::Ident::DEFAULT_FONT,  chess_font   );
         config.save();
 
         if (old_chess_font  != chess_font ) fonts.setup();
         if (old_engine_time != engine_time) chess_engine.set_engine_time(15 * engine_time);
+        if (old_skill_level != skill_level) chess_engine.set_skill_level(skill_level);
       // }
     }
   }
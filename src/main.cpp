@@ -103,6 +103,11 @@
 
       chess_engine.setup(time_limit * 15);
 
+      int8_t skill_level;
+      config.get(Config::Ident::SKILL_LEVEL, &skill_level);
+
+      chess_engine.set_skill_level(skill_level);
+
       app_controller.start();
     }
     else {
@@ -185,6 +190,11 @@
 
       chess_engine.setup(time_limit * 15);
 
+      int8_t skill_level;
+      config.get(Config::Ident::SKILL_LEVEL, &skill_level);
+
+      chess_engine.set_skill_level(skill_level);
+
       // exit(0)  // Used for some Valgrind tests
       app_controller.start();
     }
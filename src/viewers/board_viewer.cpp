@@ -72,6 +72,32 @@ BoardViewer::show_cursor(bool play_white,
   }
 }
 
+// A frame inside the square, not to be confused with the cursor.
+void
+BoardViewer::show_hint(bool play_white, 
+                       Dim dim, 
+                       Pos hint_pos, 
+                       Page::Format & fmt)
+{
+  Pos pos;
+
+  if (play_white) {
+    pos.x = fmt.margin_left + fmt.screen_left + (dim.width  * (     hint_pos.x  + 1));
+    pos.y = fmt.margin_top  + fmt.screen_top  + (dim.height * ((7 - hint_pos.y) + 1));
+  }
+  else {
+    pos.x = fmt.margin_left + fmt.screen_left + (dim.width  * ((7 - hint_pos.x) + 1));
+    pos.y = fmt.margin_top  + fmt.screen_top  + (dim.height * (     hint_pos.y  + 1));
+  }
+
+  int16_t inset = dim.width / 5;
+
+  dim.width  -= 2 * inset; dim.height -= 2 * inset;
+  pos.x      +=     inset; pos.y      +=     inset;
+
+  page.put_highlight(dim, pos);
+}
+
 void
 BoardViewer::show_board(bool        play_white, 
                         Pos         cursor_pos, 
@@ -80,7 +106,7 @@ BoardViewer::show_board(bool        play_white,
                         int         step_count, 
                         std::string msg)
 {
-  Board * board = chess_engine.get_board();
+  const Board * board = (shown_board != nullptr) ? shown_board : chess_engine.get_board();
 
   std::ostringstream stream;
 
@@ -176,6 +202,8 @@ BoardViewer::show_board(bool        play_white,
 
   Dim dim = page.add_text_raw(stream.str(), fmt);
 
+  if (hint_from.x  >= 0) show_hint(play_white, dim, hint_from, fmt);
+  if (hint_to.x    >= 0) show_hint(play_white, dim, hint_to,   fmt);
   if (cursor_pos.x >= 0) show_cursor(play_white, dim, cursor_pos, fmt, true);
   if ((from_pos.x  >= 0) && (memcmp(&from_pos, &cursor_pos, sizeof(Pos)) != 0)) {
     show_cursor(play_white, dim, from_pos, fmt, false);
@@ -204,7 +232,9 @@ BoardViewer::show_board(bool        play_white,
     }
     for (int i = first; i < step_count; i++) {
       if ((i & 1) == 0) stream << ((i / 2) + 1) << '.';
-      stream << chess_engine.step_to_str(steps[i]) << ' ';
+      stream << chess_engine.step_to_str(steps[i]);
+      if (i < annotation_count) stream << GameReview::symbol(annotations[i]);
+      stream << ' ';
     }
 
     if (steps[step_count-1].check == CheckType::CHECKMATE) {
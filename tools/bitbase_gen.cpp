@@ -0,0 +1,332 @@
+// Endgame bitbase generator
+//
+// Guy Turcotte
+// for inclusion in the Chess-InkPlate project
+//
+// (c) January 2021 - GPL-3.0
+//
+// Builds the win/draw/loss bitbases of small endings (see
+// lib/chess-engine/chess_engine_bitbase.hpp) by retrograde analysis. All
+// positions of the material set are first set as unknown. Passes are then
+// made over them until nothing changes: with the engine move generator, a
+// position is a win if one of its moves leads to a loss for the opponent, and
+// a loss if all of them lead to wins for the opponent (or if it is a
+// checkmate). The positions still unknown at the end are draws. Captures and
+// promotions lead to other material sets: their bitbases are built first,
+// in the same directory, and probed as the engine does.
+//
+// The values are kept in memory shared by worker processes (the chess engine
+// is a single instance per process). For each pass, the workers are forked
+// and each one looks at its own slice of the positions. Slices are aligned on
+// bytes: a worker only writes the values of its slice, but reads the values
+// written by the others during the pass, which speeds up the propagation.
+//
+// Usage: bitbase_gen [-o directory] [-j workers] [-f] ending...
+//
+// An ending is named after its material, stronger side first: KQK, KRK, KPK,
+// KBNK, KRKP, ...
+
+#include "chess_engine.hpp"
+#include "chess_engine_bitbase.hpp"
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <set>
+#include <chrono>
+#include <thread>
+#include <cstdio>
+#include <cstring>
+
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+static std::string output  = ".";
+static int         workers = 1;
+static bool        force   = false;
+
+static uint8_t   * values  = nullptr;   // Shared, 2 bits per position
+static uint64_t  * changes = nullptr;   // Shared, one count per worker
+
+static inline int
+get_value(uint64_t idx)
+{
+  return (values[idx >> 2] >> ((idx & 3) << 1)) & 3;
+}
+
+static inline void
+set_value(uint64_t idx, int value)
+{
+  int shift = (idx & 3) << 1;
+  values[idx >> 2] = (values[idx >> 2] & ~(3 << shift)) | (value << shift);
+}
+
+static std::string
+file_name(const std::string & name)
+{
+  return output + "/" + name + ".bb";
+}
+
+static bool
+file_exists(const std::string & name)
+{
+  struct stat st;
+  return stat(file_name(name).c_str(), &st) == 0;
+}
+
+// Value of the position at index idx of the material set, from the values
+// known so far. The position is set on the engine board.
+static int
+evaluate_position(const Bitbases::Material & material, uint64_t idx)
+{
+  int8_t   * board = *chess_engine.get_board();
+  Position * pos   = chess_engine.get_pos(0);
+  bool       white_move;
+
+  if (!Bitbases::position(material, idx, board, white_move)) return Bitbases::INVALID;
+
+  pos->white_move                = white_move;
+  pos->white_castle_kingside_ok  = false;
+  pos->white_castle_queenside_ok = false;
+  pos->black_castle_kingside_ok  = false;
+  pos->black_castle_queenside_ok = false;
+  pos->en_passant_pp             = 0;
+
+  // The side not to move cannot be in check (this covers the kings side by
+  // side).
+  if (white_move ? chess_engine.check_on_black_king() : chess_engine.check_on_white_king()) return Bitbases::INVALID;
+
+  chess_engine.generate_steps(0);
+
+  bool any_move = false, all_wins = true;
+
+  for (int i = 0; i < pos->steps_count; i++) {
+    Step & step = pos->steps[i];
+
+    chess_engine.move_step(0, step);
+    if (white_move ? chess_engine.check_on_white_king() : chess_engine.check_on_black_king()) {
+      chess_engine.back_step(0, step);
+      continue;
+    }
+    any_move = true;
+
+    int value;
+    if ((step.f2 != NO_FIG) || (step.type > MoveType::CASTLE_QUEENSIDE)) {
+      int wdl;
+      if (!bitbases.probe(board, !white_move, wdl)) {
+        chess_engine.back_step(0, step);
+        std::cerr << "Missing bitbase for a conversion of " << material.name << std::endl;
+        _exit(1);
+      }
+      value = (wdl > 0) ? Bitbases::WIN : ((wdl < 0) ? Bitbases::LOSS : Bitbases::DRAW);
+    }
+    else {
+      value = get_value(Bitbases::index(material, board, !white_move));
+    }
+
+    chess_engine.back_step(0, step);
+
+    if (value == Bitbases::LOSS) return Bitbases::WIN;
+    if (value != Bitbases::WIN ) all_wins = false;
+  }
+
+  if (!any_move) return pos->check_on_table ? Bitbases::LOSS : Bitbases::DRAW;
+
+  return all_wins ? Bitbases::LOSS : Bitbases::DRAW;
+}
+
+static void
+worker(int worker_idx, const Bitbases::Material & material, uint64_t first, uint64_t last)
+{
+  std::cout.rdbuf(nullptr); // Engine console output is not needed
+
+  uint64_t count = 0;
+
+  for (uint64_t idx = first; idx < last; idx++) {
+    if (get_value(idx) != Bitbases::DRAW) continue;   // Known
+
+    int value = evaluate_position(material, idx);
+    if (value != Bitbases::DRAW) {
+      set_value(idx, value);
+      count++;
+    }
+  }
+
+  changes[worker_idx] = count;
+  _exit(0);
+}
+
+// Material sets reached by a capture or a promotion.
+static std::set<std::string>
+conversions(const Bitbases::Material & material)
+{
+  std::set<std::string> result;
+
+  for (int i = 0; i < material.count; i++) {
+    static const int8_t promotions[] = { NO_FIG, KNIGHT, BISHOP, ROOK, QUEEN };
+
+    for (int8_t promotion : promotions) {
+      if ((promotion != NO_FIG) && (abs(material.figs[i]) != PAWN)) continue;
+
+      // A board with the material, on any squares
+      int8_t board[64] = { 0 };
+      board[0] = KING;
+      board[1] = -KING;
+      for (int j = 0; j < material.count; j++) {
+        if (j != i) board[2 + j] = material.figs[j];
+        else if (promotion != NO_FIG) board[2 + j] = (material.figs[j] > 0) ? promotion : -promotion;
+      }
+
+      Bitbases::Material converted;
+      bool               flip;
+      if (Bitbases::get_material(board, converted, flip) && (converted.count > 0)) result.insert(converted.name);
+    }
+  }
+
+  return result;
+}
+
+static bool
+generate(const std::string & name)
+{
+  if (!force && file_exists(name)) return true;
+
+  Bitbases::Material material;
+  if (!Bitbases::parse_material(name, material)) {
+    std::cerr << "Not a valid ending (at most " << Bitbases::MAX_PIECES << " pieces, stronger side first): " << name << std::endl;
+    return false;
+  }
+
+  for (auto & sub : conversions(material)) {
+    if (!file_exists(sub) && !generate(sub)) return false;
+  }
+
+  bitbases.init(output);
+
+  auto start = std::chrono::steady_clock::now();
+
+  size_t bytes = (material.size + 3) / 4;
+  values = (uint8_t *) mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (values == MAP_FAILED) {
+    std::cerr << "Not enough memory for " << name << std::endl;
+    return false;
+  }
+  memset(values, 0, bytes);
+
+  // Slices of whole bytes
+  uint64_t slice = ((material.size / workers) + 3) & ~3ULL;
+  int      pass  = 0;
+  uint64_t total;
+
+  do {
+    for (int w = 0; w < workers; w++) {
+      uint64_t first = w * slice;
+      uint64_t last  = (w == workers - 1) ? material.size : std::min(material.size, first + slice);
+
+      changes[w] = 0;
+      if (first >= last) continue;
+
+      pid_t pid = fork();
+      if (pid < 0) {
+        std::cerr << "Unable to start worker." << std::endl;
+        return false;
+      }
+      if (pid == 0) worker(w, material, first, last);
+    }
+
+    bool ok = true;
+    int  status;
+    while (wait(&status) > 0) {
+      if (!WIFEXITED(status) || (WEXITSTATUS(status) != 0)) ok = false;
+    }
+    if (!ok) {
+      munmap(values, bytes);
+      return false;
+    }
+
+    total = 0;
+    for (int w = 0; w < workers; w++) total += changes[w];
+
+    std::cout << "\r" << name << ": pass " << ++pass << ", " << total << " positions resolved      " << std::flush;
+  } while (total > 0);
+
+  uint64_t counts[4] = { 0 };
+  for (uint64_t idx = 0; idx < material.size; idx++) counts[get_value(idx)]++;
+
+  uint8_t header[Bitbases::HEADER_SIZE] = { 'C', 'I', 'B', 'B', Bitbases::VERSION, (uint8_t)(material.count + 2), 0, 0 };
+
+  FILE * file = fopen(file_name(name).c_str(), "wb");
+  bool   ok   = (file != nullptr) &&
+                (fwrite(header, 1, sizeof(header), file) == sizeof(header)) &&
+                (fwrite(values, 1, bytes, file) == bytes);
+  if (file != nullptr) ok = (fclose(file) == 0) && ok;
+
+  munmap(values, bytes);
+
+  if (!ok) {
+    std::cerr << std::endl << "Unable to write " << file_name(name) << std::endl;
+    unlink(file_name(name).c_str());
+    return false;
+  }
+
+  auto          end  = std::chrono::steady_clock::now();
+  unsigned long wall = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+
+  std::cout << "\r" << name << ": " << (counts[0] + counts[1] + counts[2]) << " positions, "
+            << counts[Bitbases::WIN ] << " wins, "
+            << counts[Bitbases::DRAW] << " draws, "
+            << counts[Bitbases::LOSS] << " losses (side to move), "
+            << pass << " passes, " << (wall / 1000.0) << "s, "
+            << (bytes + Bitbases::HEADER_SIZE) << " bytes" << std::endl;
+
+  return true;
+}
+
+static void
+usage(const char * name)
+{
+  std::cerr << "Usage: " << name << " [-o directory] [-j workers] [-f] ending..." << std::endl
+            << "  -o directory  Directory of the bitbases (default .)"                  << std::endl
+            << "  -j workers    Number of worker processes (default: all cores)"        << std::endl
+            << "  -f            Build the endings again, even if their file is present" << std::endl
+            << "An ending is named after its material, stronger side first (KQK, KRK, KPK, KBNK, KRKP, ...)." << std::endl
+            << "The bitbases of the endings reached by captures and promotions are built first." << std::endl;
+}
+
+int
+main(int argc, char ** argv)
+{
+  int opt;
+
+  workers = std::thread::hardware_concurrency();
+
+  while ((opt = getopt(argc, argv, "o:j:f")) != -1) {
+    switch (opt) {
+      case 'o': output  = optarg;       break;
+      case 'j': workers = atoi(optarg); break;
+      case 'f': force   = true;         break;
+      default: usage(argv[0]); return 1;
+    }
+  }
+
+  if (optind >= argc) { usage(argv[0]); return 1; }
+  if (workers < 1) workers = 1;
+
+  changes = (uint64_t *) mmap(nullptr, workers * sizeof(uint64_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (changes == MAP_FAILED) {
+    std::cerr << "Unable to allocate shared memory." << std::endl;
+    return 1;
+  }
+
+  // No engine task: the steps are generated in the calling thread. The
+  // workers are forked from this single threaded process.
+  chess_engine.set_deterministic(true);
+
+  for (int i = optind; i < argc; i++) {
+    if (!generate(argv[i])) return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,38 @@
+#!/bin/sh
+#
+# This script is used to build the Linux command line tools
+# located in the tools folder. Executables are put in tools/bin.
+#
+# Guy Turcotte, March 2021
+#
+
+cd "$(dirname "$0")/.."
+
+CXX=${CXX:-g++}
+CXXFLAGS="-std=gnu++17 -O3 -D CHESS_LINUX_BUILD=1 -D CHESS_INKPLATE_BUILD=0 -I lib/chess-engine $EXTRA_FLAGS"
+ENGINE="lib/chess-engine/chess_engine.cpp lib/chess-engine/chess_engine_steps.cpp lib/chess-engine/chess_engine_trace.cpp lib/chess-engine/chess_engine_time.cpp lib/chess-engine/chess_engine_book.cpp lib/chess-engine/chess_engine_syzygy.cpp lib/chess-engine/chess_engine_bitbase.cpp lib/chess-engine/chess_engine_kpk.cpp lib/chess-engine/chess_engine_endgame.cpp lib/chess-engine/chess_engine_pawns.cpp lib/chess-engine/chess_engine_nnue.cpp lib/chess-engine/chess_engine_puzzles.cpp lib/chess-engine/chess_engine_review.cpp"
+
+mkdir -p tools/bin
+
+build()
+{
+  echo "Building $1..."
+  $CXX $CXXFLAGS -o tools/bin/$1 $2 -lpthread -lrt
+
+  if [ $? -ne 0 ]
+  then
+    echo "Build error for $1!"
+    exit 1
+  fi
+}
+
+build trace_decoder "tools/trace_decoder.cpp"
+build chess_uci     "$ENGINE tools/chess_uci.cpp"
+build epd_runner    "$ENGINE tools/epd_runner.cpp"
+build match_runner  "$ENGINE tools/match_runner.cpp"
+build book_builder  "$ENGINE tools/book_builder.cpp"
+build bitbase_gen   "$ENGINE tools/bitbase_gen.cpp"
+build puzzle_builder "$ENGINE tools/puzzle_builder.cpp"
+build game_review    "$ENGINE tools/game_review.cpp"
+
+echo "Completed."
@@ -0,0 +1,557 @@
+// Opening book builder
+//
+// Guy Turcotte
+// for inclusion in the Chess-InkPlate project
+//
+// (c) January 2021 - GPL-3.0
+//
+// Builds a Polyglot opening book (see lib/chess-engine/chess_engine_book.hpp)
+// from PGN game collections. The games are replayed with the engine move
+// generator. The position keys are the standard Polyglot keys (see
+// lib/chess-engine/chess_engine_zobrist.hpp), so the book can be read by any
+// Polyglot book reader, and books made by other tools by the engine.
+//
+// The PGN files are streamed: the main process reads them and sends each
+// game, as a single line, to one of the worker processes (the chess engine is
+// a single instance per process). Each worker accumulates the statistics of
+// the moves it sees in a hash table. When the table is full, it is written,
+// sorted, in a run file next to the output file (a shard). At the end, all
+// runs are merged by the main process: the statistics of a move are summed,
+// the moves are filtered, weighted (2 x wins + draws, from the side to move
+// point of view) and written in key order. Memory usage only depends on the
+// size of the hash tables, not on the number of games.
+//
+// Usage: book_builder [-o book.bin] [-p plies] [-f min_games] [-s min_score]
+//                     [-j workers] [-m max_entries] file.pgn...
+//
+// A file named - is the standard input.
+
+#include "chess_engine.hpp"
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <queue>
+#include <unordered_map>
+#include <algorithm>
+#include <thread>
+#include <cstdio>
+#include <cstring>
+#include <csignal>
+
+#include <unistd.h>
+#include <sys/wait.h>
+
+static const char * START_FEN = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq -";
+static const uint64_t START_KEY = 0x463B96181691FC9CULL; // Polyglot key of the start position
+
+#pragma pack(push, 1)
+struct MoveStats {              // Record of a run file
+  uint64_t key;
+  uint16_t move;
+  uint32_t games;
+  uint32_t wins;                // For the side to move
+  uint32_t draws;
+};
+#pragma pack(pop)
+
+struct StatsKey {
+  uint64_t key;
+  uint16_t move;
+  bool operator==(const StatsKey & other) const { return (key == other.key) && (move == other.move); }
+};
+
+struct StatsKeyHash {
+  size_t operator()(const StatsKey & k) const { return k.key ^ (k.move * 0x9E3779B97F4A7C15ULL); }
+};
+
+struct Counts {
+  uint32_t games, wins, draws;
+};
+
+typedef std::unordered_map<StatsKey, Counts, StatsKeyHash> StatsTable;
+
+static int         max_plies   = 20;
+static size_t      max_entries = 1000000;
+static std::string output      = "book.bin";
+
+static std::string
+run_name(int worker, int run)
+{
+  return output + ".w" + std::to_string(worker) + ".r" + std::to_string(run);
+}
+
+// Polyglot coding of a step. Castling is the king taking its own rook.
+static uint16_t
+polyglot_move(const Step & step)
+{
+  int from = step.c1 ^ 56;
+  int to   = step.c2 ^ 56;
+
+  if      (step.type == MoveType::CASTLE_KINGSIDE ) to = (step.c1 + 3) ^ 56;
+  else if (step.type == MoveType::CASTLE_QUEENSIDE) to = (step.c1 - 4) ^ 56;
+
+  int promo = (step.type > MoveType::CASTLE_QUEENSIDE) ? ((int) step.type - (int) MoveType::CASTLE_QUEENSIDE) : 0;
+
+  return to | (from << 6) | (promo << 12);
+}
+
+// ----- Worker -----
+
+static bool
+write_run(StatsTable & table, int worker, int run)
+{
+  std::vector<MoveStats> records;
+  records.reserve(table.size());
+
+  for (auto & e : table) {
+    records.push_back({ e.first.key, e.first.move, e.second.games, e.second.wins, e.second.draws });
+  }
+  std::sort(records.begin(), records.end(), [](const MoveStats & a, const MoveStats & b) {
+    return (a.key < b.key) || ((a.key == b.key) && (a.move < b.move));
+  });
+
+  FILE * f = fopen(run_name(worker, run).c_str(), "wb");
+  if (f == nullptr) return false;
+
+  bool ok = fwrite(records.data(), sizeof(MoveStats), records.size(), f) == records.size();
+  ok = (fclose(f) == 0) && ok;
+
+  table.clear();
+  return ok;
+}
+
+// A game line is the result (1: white wins, 0: black wins, =: draw) followed
+// by the movetext, comments removed. Returns false if a move is not legal.
+static bool
+replay(const std::string & line, StatsTable & table)
+{
+  std::istringstream stream(line);
+  std::string        token;
+  char               result;
+  int                ply   = 0;
+  int                depth = 0; // Variations
+
+  stream >> result;
+
+  Position * pos = chess_engine.get_pos(0);
+
+  chess_engine.new_game();
+  chess_engine.load_board_from_fen(START_FEN);
+
+  while ((ply < max_plies) && (stream >> token)) {
+    // Variations are skipped
+    for (char ch : token) if (ch == '(') depth++;
+    bool closing = false;
+    for (char ch : token) if (ch == ')') { depth--; closing = true; }
+    if ((depth > 0) || closing) continue;
+
+    if (token[0] == '$') continue;
+
+    // Move numbers (12. 12... 12.e4)
+    size_t i = 0;
+    while ((i < token.length()) && isdigit(token[i])) i++;
+    if ((i < token.length()) && (token[i] == '.')) {
+      while ((i < token.length()) && (token[i] == '.')) i++;
+      token = token.substr(i);
+      if (token.empty()) continue;
+    }
+
+    if ((token == "1-0") || (token == "0-1") || (token == "1/2-1/2") || (token == "*")) break;
+
+    Step step;
+    if (!chess_engine.san_to_step(token, step)) return false;
+
+    Counts & c = table[{ pos[0].key, polyglot_move(step) }];
+    c.games++;
+    if      (result == '=') c.draws++;
+    else if ((result == '1') == pos[0].white_move) c.wins++;
+
+    if (!chess_engine.play_step(chess_engine.step_to_uci(step))) return false;
+    ply++;
+  }
+
+  return true;
+}
+
+static void
+worker(int worker_idx, int fd)
+{
+  std::cout.rdbuf(nullptr); // Engine console output is not needed
+
+  chess_engine.setup(1);
+  chess_engine.set_deterministic(true); // Move generation without the task queue
+
+  // A book with keys other than the Polyglot ones would never be matched
+  chess_engine.new_game();
+  chess_engine.load_board_from_fen(START_FEN);
+  if (chess_engine.get_pos(0)->key != START_KEY) {
+    std::cerr << "The engine position keys are not the Polyglot keys, the book is not built." << std::endl;
+    _exit(1);
+  }
+
+  FILE     * input = fdopen(fd, "r");
+  char     * line  = nullptr;
+  size_t     size  = 0;
+  int        run   = 0;
+  long       bad   = 0;
+  StatsTable table;
+
+  table.reserve(max_entries);
+
+  while (getline(&line, &size, input) > 0) {
+    if (!replay(line, table)) bad++;
+    if (table.size() >= max_entries) {
+      if (!write_run(table, worker_idx, run++)) _exit(1);
+    }
+  }
+  if (!table.empty() && !write_run(table, worker_idx, run++)) _exit(1);
+
+  free(line);
+  fclose(input);
+
+  _exit((bad > 0) ? 2 : 0);
+}
+
+// ----- PGN reader -----
+
+class PGNReader
+{
+  public:
+    PGNReader(std::istream & in) : input(in), comment(false) { }
+
+    // Next game as a single line. Games without a result or not starting
+    // from the initial position are skipped.
+    bool next(std::string & game);
+
+    long skipped = 0;
+
+  private:
+    std::istream & input;
+    std::string    pending;     // Tag line read ahead
+    bool           comment;     // Inside a { } comment
+
+    bool    read_game(std::string & moves, char & result, bool & setup);
+    void append_moves(const std::string & line, std::string & moves);
+};
+
+void
+PGNReader::append_moves(const std::string & line, std::string & moves)
+{
+  moves += ' ';
+  for (char ch : line) {
+    if (comment) {
+      if (ch == '}') comment = false;
+    }
+    else if (ch == '{') comment = true;
+    else if (ch == ';') break;
+    else moves += (ch == '\r') ? ' ' : ch;
+  }
+}
+
+bool
+PGNReader::read_game(std::string & moves, char & result, bool & setup)
+{
+  std::string line;
+  bool        tags = false;
+
+  moves.clear();
+  result = 0;
+  setup  = false;
+
+  while (true) {
+    if (!pending.empty()) { line = pending; pending.clear(); }
+    else if (!std::getline(input, line)) break;
+
+    if (!comment && (line[0] == '[')) {
+      if (!moves.empty()) { pending = line; break; }  // Next game
+      tags = true;
+      if      (line.compare(0, 5, "[FEN ") == 0) setup = true;
+      else if (line.compare(0, 8, "[Result ") == 0) {
+        if      (line.find("\"1-0\""    ) != std::string::npos) result = '1';
+        else if (line.find("\"0-1\""    ) != std::string::npos) result = '0';
+        else if (line.find("\"1/2-1/2\"") != std::string::npos) result = '=';
+      }
+    }
+    else if (tags) append_moves(line, moves);
+  }
+
+  comment = false;
+
+  return tags;
+}
+
+bool
+PGNReader::next(std::string & game)
+{
+  std::string moves;
+  char        result;
+  bool        setup;
+
+  while (read_game(moves, result, setup)) {
+    if ((result != 0) && !setup && (moves.find_first_not_of(' ') != std::string::npos)) {
+      game = std::string(1, result) + moves + '\n';
+      return true;
+    }
+    skipped++;
+  }
+
+  return false;
+}
+
+// ----- Merge -----
+
+struct RunReader {
+  FILE    * file;
+  MoveStats current;
+  bool read() { return fread(&current, sizeof(MoveStats), 1, file) == 1; }
+};
+
+struct BookMove {
+  uint16_t move;
+  uint32_t games, wins, draws;
+};
+
+static void
+put_be(FILE * f, uint64_t value, int len)
+{
+  for (int i = len - 1; i >= 0; i--) fputc((value >> (8 * i)) & 0xFF, f);
+}
+
+// Filters and weights the moves of a position, then writes them in the book.
+static long
+write_position(FILE * book, uint64_t key, std::vector<BookMove> & moves, uint32_t min_games, int min_score)
+{
+  std::vector<std::pair<uint32_t, uint16_t>> entries;
+  uint32_t max_weight = 0;
+
+  for (auto & m : moves) {
+    if (m.games < min_games) continue;
+    if ((200 * m.wins + 100 * m.draws) < (uint64_t) 2 * min_score * m.games) continue;
+
+    uint32_t weight = 2 * m.wins + m.draws;
+    entries.push_back({ weight, m.move });
+    max_weight = std::max(max_weight, weight);
+  }
+
+  // Weights are 16 bits
+  if (max_weight > 0xFFFF) {
+    for (auto & e : entries) e.first = (uint64_t) e.first * 0xFFFF / max_weight;
+  }
+
+  std::sort(entries.begin(), entries.end(), [](auto & a, auto & b) { return a.first > b.first; });
+
+  for (auto & e : entries) {
+    put_be(book, key,     8);
+    put_be(book, e.second, 2);
+    put_be(book, e.first,  2);
+    put_be(book, 0,        4);
+  }
+
+  return entries.size();
+}
+
+static bool
+merge(int workers, uint32_t min_games, int min_score, long & positions, long & entries)
+{
+  std::vector<RunReader> runs;
+
+  for (int w = 0; w < workers; w++) {
+    for (int r = 0; ; r++) {
+      FILE * f = fopen(run_name(w, r).c_str(), "rb");
+      if (f == nullptr) break;
+      RunReader reader = { f, {} };
+      if (reader.read()) runs.push_back(reader);
+      else fclose(f);
+    }
+  }
+
+  FILE * book = fopen(output.c_str(), "wb");
+  if (book == nullptr) return false;
+
+  auto later = [&runs](int a, int b) {
+    const MoveStats & x = runs[a].current;
+    const MoveStats & y = runs[b].current;
+    return (x.key > y.key) || ((x.key == y.key) && (x.move > y.move));
+  };
+  std::priority_queue<int, std::vector<int>, decltype(later)> heap(later);
+
+  for (int i = 0; i < (int) runs.size(); i++) heap.push(i);
+
+  std::vector<BookMove> moves;
+  uint64_t              key = 0;
+
+  positions = entries = 0;
+
+  while (!heap.empty()) {
+    int         i = heap.top(); heap.pop();
+    MoveStats & s = runs[i].current;
+
+    if (!moves.empty() && (s.key != key)) {
+      long count = write_position(book, key, moves, min_games, min_score);
+      if (count > 0) { positions++; entries += count; }
+      moves.clear();
+    }
+    key = s.key;
+
+    if (!moves.empty() && (moves.back().move == s.move)) {
+      moves.back().games += s.games;
+      moves.back().wins  += s.wins;
+      moves.back().draws += s.draws;
+    }
+    else moves.push_back({ s.move, s.games, s.wins, s.draws });
+
+    if (runs[i].read()) heap.push(i);
+  }
+  if (!moves.empty()) {
+    long count = write_position(book, key, moves, min_games, min_score);
+    if (count > 0) { positions++; entries += count; }
+  }
+
+  for (auto & r : runs) fclose(r.file);
+
+  for (int w = 0; w < workers; w++) {
+    for (int r = 0; unlink(run_name(w, r).c_str()) == 0; r++);
+  }
+
+  return fclose(book) == 0;
+}
+
+static void
+usage(const char * name)
+{
+  std::cerr << "Usage: " << name << " [-o book.bin] [-p plies] [-f min_games] [-s min_score] [-j workers] [-m max_entries] file.pgn..." << std::endl
+            << "  -o file      Book file to create (default book.bin)"                        << std::endl
+            << "  -p plies     Number of plies of each game put in the book (default 20)"     << std::endl
+            << "  -f games     Minimum number of games a move must be played in (default 3)"  << std::endl
+            << "  -s score     Minimum score of a move, in percent (default 0)"               << std::endl
+            << "  -j workers   Number of worker processes (default: all cores)"               << std::endl
+            << "  -m entries   Moves kept in memory by a worker before a run is written (default 1000000)" << std::endl;
+}
+
+int
+main(int argc, char ** argv)
+{
+  uint32_t min_games = 3;
+  int      min_score = 0;
+  int      workers   = std::thread::hardware_concurrency();
+  int      opt;
+
+  while ((opt = getopt(argc, argv, "o:p:f:s:j:m:")) != -1) {
+    switch (opt) {
+      case 'o': output      = optarg;       break;
+      case 'p': max_plies   = atoi(optarg); break;
+      case 'f': min_games   = atoi(optarg); break;
+      case 's': min_score   = atoi(optarg); break;
+      case 'j': workers     = atoi(optarg); break;
+      case 'm': max_entries = atol(optarg); break;
+      default: usage(argv[0]); return 1;
+    }
+  }
+
+  if (optind >= argc) { usage(argv[0]); return 1; }
+  if (workers     < 1) workers     = 1;
+  if (max_entries < 1) max_entries = 1;
+
+  signal(SIGPIPE, SIG_IGN);
+
+  auto start = std::chrono::steady_clock::now();
+
+  // Games are sent to the workers through pipes
+  std::vector<int> fds(workers);
+  std::vector<int> read_fds(workers);
+
+  for (int w = 0; w < workers; w++) {
+    int p[2];
+    if (pipe(p) != 0) {
+      std::cerr << "Unable to create pipe." << std::endl;
+      return 1;
+    }
+    read_fds[w] = p[0];
+    fds[w]      = p[1];
+  }
+
+  for (int w = 0; w < workers; w++) {
+    pid_t pid = fork();
+    if (pid < 0) {
+      std::cerr << "Unable to start worker." << std::endl;
+      return 1;
+    }
+    if (pid == 0) {
+      for (int i = 0; i < workers; i++) {
+        close(fds[i]);
+        if (i != w) close(read_fds[i]);
+      }
+      worker(w, read_fds[w]);
+    }
+  }
+
+  std::vector<FILE *> pipes(workers);
+  for (int w = 0; w < workers; w++) {
+    close(read_fds[w]);
+    pipes[w] = fdopen(fds[w], "w");
+  }
+
+  long games = 0, skipped = 0;
+  int  next  = 0;
+
+  for (int i = optind; i < argc; i++) {
+    std::ifstream file;
+    if (strcmp(argv[i], "-") != 0) {
+      file.open(argv[i]);
+      if (!file.is_open()) {
+        std::cerr << "Unable to open " << argv[i] << std::endl;
+        continue;
+      }
+    }
+
+    PGNReader   reader(file.is_open() ? file : std::cin);
+    std::string game;
+
+    while (reader.next(game)) {
+      fputs(game.c_str(), pipes[next]);
+      next = (next + 1) % workers;
+      games++;
+    }
+    skipped += reader.skipped;
+  }
+
+  for (auto f : pipes) fclose(f);
+
+  bool ok  = true;
+  int  bad = 0, status;
+  while (wait(&status) > 0) {
+    if (!WIFEXITED(status) || (WEXITSTATUS(status) == 1)) ok = false;
+    else if (WEXITSTATUS(status) == 2) bad++;
+  }
+
+  if (!ok) {
+    std::cerr << "A worker failed, the book is not built." << std::endl;
+    for (int w = 0; w < workers; w++) {
+      for (int r = 0; unlink(run_name(w, r).c_str()) == 0; r++);
+    }
+    return 1;
+  }
+
+  long positions, entries;
+  if (!merge(workers, min_games, min_score, positions, entries)) {
+    std::cerr << "Unable to write " << output << std::endl;
+    return 1;
+  }
+
+  auto          end  = std::chrono::steady_clock::now();
+  unsigned long wall = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+
+  std::cout << "Games:      " << games << " read, " << skipped << " skipped (no result or not from the initial position)" << std::endl;
+  if (bad > 0) {
+    std::cout << "Warning:    " << bad << " worker(s) found games with illegal moves, replayed up to the illegal move" << std::endl;
+  }
+  std::cout << "Book:       " << output << ", " << positions << " positions, " << entries << " moves, "
+                              << (entries * OpeningBook::ENTRY_SIZE) << " bytes" << std::endl
+            << "Wall clock: " << wall << " ms, " << workers << " worker(s)" << std::endl;
+
+  return 0;
+}
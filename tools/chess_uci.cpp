@@ -0,0 +1,435 @@
+// UCI front-end for the chess engine
+//
+// Guy Turcotte
+// for inclusion in the Chess-InkPlate project
+//
+// (c) January 2021 - GPL-3.0
+//
+// Speaks the Universal Chess Interface protocol on stdin/stdout, so that the
+// engine can be run by chess GUIs and tournament managers (cutechess-cli,
+// fastchess, ...). The engine own console output is redirected to stderr.
+//
+// Supported commands: uci, isready, ucinewgame, setoption, position,
+// go (wtime btime winc binc movestogo movetime depth nodes mate infinite
+// ponder), ponderhit, stop and quit. With go mate, the mate solver looks for
+// a forced mate in the given number of moves (within the nodes limit, if
+// any). A normal search is done when there is none. With go ponder, the
+// search has no time limit until ponderhit, the time limits then applying
+// from the go command.
+//
+// The non-UCI command "bench [nodes]" (also usable as "chess_uci bench
+// [nodes]") searches a fixed set of positions in deterministic mode and
+// prints a signature of the results. The signature changes only when the
+// search itself changes: it is used for bisecting and golden tests. The hit
+// rate of the evaluation cache is also given.
+
+#include "chess_engine.hpp"
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <chrono>
+#include <mutex>
+#include <atomic>
+#include <algorithm>
+
+static const char * START_FEN = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq -";
+
+static std::ostream      uci_out(std::cout.rdbuf());
+static std::mutex        uci_out_mutex;
+
+static std::thread       search_thread;
+static std::atomic<bool> searching(false);
+static std::atomic<bool> stop_requested(false);
+static bool              infinite_search = false;
+static std::atomic<bool> ponder_search(false);
+static int               mate_moves      = 0;
+static unsigned long     mate_nodes      = 0;
+
+static constexpr unsigned long BENCH_NODES = 100000;
+
+static const char *      engine_options[] = { "null_move", "futility", "lazy_eval", "stats", "nnue", "deterministic" };
+
+static const char *      bench_fens[] = {
+  "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq -",
+  "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq -",
+  "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - -",
+  "r1bq1rk1/pp2bppp/2n2n2/3p4/3P4/2NBPN2/PP3PPP/R2QK2R w KQ -",
+  "2rr3k/pp3pp1/1nnqbN1p/3pN3/2pP4/2P3Q1/PPB4P/R4RK1 w - -",
+  "r1b2rk1/2q1b1pp/p2ppn2/1p6/3QP3/1BN1B3/PPP3PP/R4RK1 w - -",
+  "4rrk1/pp1n3p/3q2pQ/2p1pb2/2PP4/2P3N1/P2B2PP/4RRK1 b - -",
+  "8/8/4k3/3p4/3P4/4K3/8/8 w - -",
+  "6k1/5p2/6p1/8/7p/8/6PP/6K1 b - -",
+  "r3r1k1/2p2ppp/p1p1bn2/8/1q2P3/2NPQN2/PPP3PP/R4RK1 b - -"
+};
+
+static void
+send(const std::string & line)
+{
+  std::lock_guard<std::mutex> guard(uci_out_mutex);
+  uci_out << line << std::endl;
+}
+
+static std::string
+score_to_uci(int score)
+{
+  if (score >  9000) return "mate "  + std::to_string((10001 - score) / 2);
+  if (score < -9000) return "mate -" + std::to_string((10000 + score) / 2);
+  return "cp " + std::to_string(score);
+}
+
+static void
+info_handler(const SearchInfo & info)
+{
+  std::ostringstream stream;
+
+  stream << "info depth " << info.depth
+         << " seldepth "  << info.sel_depth
+         << " score "     << score_to_uci(info.score)
+         << " nodes "     << info.nodes
+         << " nps "       << ((info.time_ms > 0) ? (info.nodes * 1000 / info.time_ms) : info.nodes)
+         << " time "      << info.time_ms;
+
+  if (chess_engine.get_tb_hits() > 0) stream << " tbhits " << chess_engine.get_tb_hits();
+
+  if (info.pv_count > 0) {
+    stream << " pv";
+    for (int i = 0; i < info.pv_count; i++) stream << ' ' << chess_engine.step_to_uci(info.pv[i]);
+  }
+
+  send(stream.str());
+}
+
+static void
+stop_search()
+{
+  stop_requested = true;
+  while (searching) {
+    chess_engine.stop();
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  if (search_thread.joinable()) search_thread.join();
+}
+
+static void
+search()
+{
+  Position * pos = chess_engine.get_pos(0);
+
+  pos[0].best.f1 = NO_FIG;
+  pos[0].best.c1 = -1;
+
+  Step book_step;
+  bool mate_found = false;
+  bool searched   = false;
+
+  if (mate_moves > 0) {
+    auto start = std::chrono::steady_clock::now();
+    Step line[MAXDEPTH];
+    int  count;
+
+    ChessEngine::MateResult result = chess_engine.solve_mate(mate_moves, mate_nodes, line, count);
+
+    if (result == ChessEngine::MateResult::MATE) {
+      SearchInfo info;
+      info.depth     = count;
+      info.sel_depth = count;
+      info.score     = 10000 - count;
+      info.nodes     = chess_engine.get_node_count();
+      info.time_ms   = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+      info.pv        = line;
+      info.pv_count  = count;
+      info_handler(info);
+      pos[0].best = line[0];
+      mate_found  = true;
+    }
+    else if (result == ChessEngine::MateResult::NO_MATE) {
+      send("info string no mate in " + std::to_string(mate_moves));
+    }
+    else send("info string mate search stopped");
+  }
+
+  if (!mate_found) {
+    if (!infinite_search && chess_engine.book_step(book_step)) pos[0].best = book_step;
+    else {
+      chess_engine.solve_step();
+      searched = true;
+    }
+  }
+
+  // With go infinite or go ponder, the best move is sent only when asked
+  // for (ponderhit for the latter).
+  while ((infinite_search || ponder_search) && !stop_requested) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+
+  Step        ponder_step;
+  std::string ponder;
+
+  if (searched && chess_engine.get_ponder_step(ponder_step)) {
+    ponder = " ponder " + chess_engine.step_to_uci(ponder_step);
+  }
+
+  send("bestmove " + ((pos[0].best.c1 == -1) ? std::string("0000") : chess_engine.step_to_uci(pos[0].best) + ponder));
+
+  searching = false;
+}
+
+static void
+position(std::istringstream & stream)
+{
+  std::string token, fen;
+
+  stream >> token;
+  if (token == "startpos") {
+    fen = START_FEN;
+    stream >> token;
+  }
+  else if (token == "fen") {
+    while ((stream >> token) && (token != "moves")) fen += token + ' ';
+  }
+  else return;
+
+  chess_engine.load_board_from_fen(fen);
+
+  if (token == "moves") {
+    while (stream >> token) {
+      if (!chess_engine.play_step(token)) {
+        std::cerr << "Illegal move: " << token << std::endl;
+        break;
+      }
+    }
+  }
+}
+
+static void
+go(std::istringstream & stream)
+{
+  std::string   token;
+  unsigned long wtime = 0, btime = 0, winc = 0, binc = 0, movetime = 0, nodes = 0;
+  int           movestogo = 0, depth = 0, mate = 0;
+  bool          infinite  = false;
+  bool          ponder    = false;
+
+  while (stream >> token) {
+    if      (token == "wtime"    ) stream >> wtime;
+    else if (token == "btime"    ) stream >> btime;
+    else if (token == "winc"     ) stream >> winc;
+    else if (token == "binc"     ) stream >> binc;
+    else if (token == "movestogo") stream >> movestogo;
+    else if (token == "movetime" ) stream >> movetime;
+    else if (token == "depth"    ) stream >> depth;
+    else if (token == "nodes"    ) stream >> nodes;
+    else if (token == "mate"     ) stream >> mate;
+    else if (token == "infinite" ) infinite = true;
+    else if (token == "ponder"   ) ponder   = true;
+  }
+
+  bool white = chess_engine.get_pos(0)->white_move;
+
+  chess_engine.set_search_limits(infinite ? 0 : movetime, depth, nodes);
+
+  if (!infinite && (movetime == 0)) {
+    unsigned long time = white ? wtime : btime;
+    unsigned long inc  = white ? winc  : binc;
+    if (time > 0) chess_engine.set_clock(time, inc, movestogo);
+  }
+
+  chess_engine.set_pondering(ponder);
+
+  infinite_search = infinite;
+  ponder_search   = ponder;
+  mate_moves      = std::min(mate, (int) ChessEngine::MATE_MAX_MOVES);
+  mate_nodes      = nodes;
+  stop_requested  = false;
+  searching       = true;
+  search_thread = std::thread(search);
+}
+
+static void
+bench(unsigned long nodes)
+{
+  Position    * pos = chess_engine.get_pos(0);
+  unsigned long total_nodes = 0;
+  unsigned long cache_hits  = 0;
+  unsigned long cache_total = 0;
+  uint32_t      signature   = 2166136261U;
+
+  chess_engine.set_deterministic(true);
+  chess_engine.set_search_limits(0, 0, nodes);
+
+  auto start = std::chrono::steady_clock::now();
+
+  for (auto fen : bench_fens) {
+    chess_engine.new_game();
+    chess_engine.load_board_from_fen(fen);
+
+    pos[0].best.f1 = NO_FIG;
+    pos[0].best.c1 = -1;
+
+    chess_engine.solve_step();
+
+    std::string move  = (pos[0].best.c1 == -1) ? std::string("0000") : chess_engine.step_to_uci(pos[0].best);
+    int         score = pos[0].best.weight;
+
+    total_nodes += chess_engine.get_node_count();
+    cache_hits  += eval_cache.get_hits();
+    cache_total += eval_cache.get_hits() + eval_cache.get_misses();
+
+    // FNV-1a hash of move, score and node count of each position
+    std::string result = move + ' ' + std::to_string(score) + ' ' + std::to_string(chess_engine.get_node_count());
+    for (char ch : result) signature = (signature ^ (uint8_t) ch) * 16777619U;
+
+    send(std::string(fen) + " : " + result);
+  }
+
+  auto          end  = std::chrono::steady_clock::now();
+  unsigned long time = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+
+  char sig[9];
+  snprintf(sig, sizeof(sig), "%08x", signature);
+
+  send("Nodes searched  : " + std::to_string(total_nodes));
+  send("Time (ms)       : " + std::to_string(time));
+  send("Nodes/second    : " + std::to_string((time > 0) ? (total_nodes * 1000 / time) : total_nodes));
+  send("Signature       : " + std::string(sig));
+  send("Eval cache hits : " + std::to_string(cache_hits) + " of " + std::to_string(cache_total) + " (" +
+       std::to_string((cache_total > 0) ? (cache_hits * 100 / cache_total) : 0) + "%)");
+
+  chess_engine.set_deterministic(false);
+  chess_engine.new_game();
+  chess_engine.load_board_from_fen(START_FEN);
+}
+
+static void
+setoption(std::istringstream & stream)
+{
+  std::string token, name, value;
+
+  stream >> token; // name
+  while ((stream >> token) && (token != "value")) name += (name.empty() ? "" : " ") + token;
+  stream >> value;
+
+  // The engine has no transposition table and a single search thread:
+  // these options are only there for the GUIs that always send them.
+
+  if ((name == "Hash") || (name == "Threads") || (name == "Ponder")) return;
+  else if (name == "BookFile") {
+    if (value.empty() || (value == "<empty>")) opening_book.close();
+    else if (!opening_book.open(value)) std::cerr << "Unable to open book: " << value << std::endl;
+  }
+  else if (name == "SyzygyPath") {
+    if (value.empty() || (value == "<empty>")) syzygy.clear();
+    else std::cerr << "Syzygy tables found: " << chess_engine.set_tablebase_path(value) << std::endl;
+  }
+  else if (name == "BitbasePath") {
+    if (value.empty() || (value == "<empty>")) bitbases.clear();
+    else std::cerr << "Bitbases found: " << chess_engine.set_bitbase_path(value) << std::endl;
+  }
+  else if (name == "EvalFile") {
+    if (value.empty() || (value == "<empty>")) nnue.unload();
+    else if (!chess_engine.load_network(value)) std::cerr << "Unable to load network: " << value << std::endl;
+    else std::cerr << "Network loaded (" << Nnue::kernels() << " kernels)" << std::endl;
+  }
+  else if (name == "SyzygyProbeLimit") chess_engine.set_option("syzygy_pieces", atoi(value.c_str()));
+  else if (name == "PawnHash") {
+    if (!chess_engine.set_option("pawn_hash", atoi(value.c_str()))) std::cerr << "Unable to resize the pawn hash table." << std::endl;
+  }
+  else if (!chess_engine.set_option(name, (value == "true") ? 1 : (value == "false") ? 0 : atoi(value.c_str()))) {
+    std::cerr << "Unknown option: " << name << std::endl;
+  }
+}
+
+int
+main(int argc, char ** argv)
+{
+  // The engine reports its progress on std::cout. Only the UCI protocol must
+  // appear on stdout.
+  std::cout.rdbuf(std::cerr.rdbuf());
+
+  chess_engine.setup(15);
+  chess_engine.set_info_handler(info_handler);
+  chess_engine.load_board_from_fen(START_FEN);
+
+  if ((argc > 1) && (std::string(argv[1]) == "bench")) {
+    bench((argc > 2) ? atol(argv[2]) : BENCH_NODES);
+    _Exit(0);
+  }
+
+  std::string line;
+
+  while (std::getline(std::cin, line)) {
+    std::istringstream stream(line);
+    std::string        cmd;
+
+    stream >> cmd;
+
+    if (cmd == "uci") {
+      send("id name Chess-InkPlate");
+      send("id author Sergey Urusov, Guy Turcotte");
+      send("option name Hash type spin default 1 min 1 max 1024");
+      send("option name Threads type spin default 1 min 1 max 1");
+      send("option name Ponder type check default false");
+      send("option name BookFile type string default <empty>");
+      send("option name SyzygyPath type string default <empty>");
+      send("option name BitbasePath type string default <empty>");
+      send("option name EvalFile type string default <empty>");
+      send("option name SyzygyProbeLimit type spin default " + std::to_string(SyzygyTB::MAX_PIECES) +
+           " min 0 max " + std::to_string(SyzygyTB::MAX_PIECES));
+      send("option name PawnHash type spin default " + std::to_string(CHESS_PAWN_HASH_KB) +
+           " min 1 max " + std::to_string(PawnTable::MAX_KB));
+      for (auto name : engine_options) {
+        int32_t value;
+        chess_engine.get_option(name, value);
+        // Without a network (EvalFile), the nnue toggle has no effect
+        if (std::string(name) == "nnue") value = value && nnue.is_ready();
+        send(std::string("option name ") + name + " type check default " + (value ? "true" : "false"));
+      }
+      send("option name skill type spin default " + std::to_string(ChessEngine::SKILL_LEVEL_COUNT - 1) +
+           " min 0 max " + std::to_string(ChessEngine::SKILL_LEVEL_COUNT - 1));
+      send("uciok");
+    }
+    else if (cmd == "isready") {
+      send("readyok");
+    }
+    else if (cmd == "ucinewgame") {
+      stop_search();
+      chess_engine.new_game();
+      chess_engine.load_board_from_fen(START_FEN);
+    }
+    else if (cmd == "setoption") {
+      setoption(stream);
+    }
+    else if (cmd == "position") {
+      stop_search();
+      position(stream);
+    }
+    else if (cmd == "go") {
+      stop_search();
+      go(stream);
+    }
+    else if (cmd == "ponderhit") {
+      // The search goes on, now under the time limits
+      chess_engine.ponder_hit();
+      ponder_search = false;
+    }
+    else if (cmd == "stop") {
+      stop_search();
+    }
+    else if (cmd == "bench") {
+      unsigned long nodes = BENCH_NODES;
+      stream >> nodes;
+      stop_search();
+      bench(nodes);
+    }
+    else if (cmd == "quit") {
+      break;
+    }
+  }
+
+  stop_search();
+
+  // The engine helper task never ends.
+  _Exit(0);
+}
@@ -0,0 +1,328 @@
+// EPD test-suite runner
+//
+// Guy Turcotte
+// for inclusion in the Chess-InkPlate project
+//
+// (c) January 2021 - GPL-3.0
+//
+// Solves every position of an EPD file (WAC, ECM, STS, ...) under a time,
+// depth or node limit and reports the solve rate, the time-to-solution and
+// the nodes-to-solution. The bm (best move) and am (avoid move) operations
+// are used to decide if a position is solved.
+//
+// The chess engine is a single instance per process. Positions are then
+// distributed to worker processes, each one having its own engine.
+//
+// Usage: epd_runner [-t ms] [-n nodes] [-d depth] [-j workers] [-v] file.epd
+
+#include "chess_engine.hpp"
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <cstring>
+
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+struct EPDEntry {
+  std::string              fen;
+  std::string              id;
+  std::vector<std::string> bm;
+  std::vector<std::string> am;
+};
+
+struct EPDResult {
+  bool          done;
+  bool          solved;
+  char          move[8];      // Move found, coordinate notation
+  unsigned long time_ms;      // Search duration
+  unsigned long nodes;        // Nodes searched
+  unsigned long found_ms;     // Time when the right move was found for good
+  unsigned long found_nodes;  // Nodes when the right move was found for good
+};
+
+struct SharedData {
+  std::atomic<int> next;      // Next position to be solved
+  EPDResult        results[1];
+};
+
+static std::vector<Step> bm_steps;
+static std::vector<Step> am_steps;
+static EPDResult       * current;
+static bool              found;
+
+static bool
+same_step(const Step & s1, const Step & s2)
+{
+  return (s1.c1 == s2.c1) && (s1.c2 == s2.c2) && (s1.type == s2.type);
+}
+
+static bool
+is_right_move(const Step & step)
+{
+  for (auto & s : am_steps) if (same_step(s, step)) return false;
+  if (bm_steps.empty()) return !am_steps.empty();
+  for (auto & s : bm_steps) if (same_step(s, step)) return true;
+  return false;
+}
+
+// Keeps track of the moment the engine switched to the right move without
+// changing its mind afterward.
+static void
+info_handler(const SearchInfo & info)
+{
+  if (info.pv_count == 0) return;
+
+  if (is_right_move(info.pv[0])) {
+    if (!found) {
+      found                = true;
+      current->found_ms    = info.time_ms;
+      current->found_nodes = info.nodes;
+    }
+  }
+  else found = false;
+}
+
+static bool
+parse_epd(const std::string & line, EPDEntry & entry)
+{
+  std::istringstream stream(line);
+  std::string        token;
+
+  for (int i = 0; i < 4; i++) {
+    if (!(stream >> token)) return false;
+    entry.fen += token + ' ';
+  }
+
+  std::string ops;
+  std::getline(stream, ops);
+
+  std::istringstream op_stream(ops);
+  std::string        op;
+
+  while (std::getline(op_stream, op, ';')) {
+    std::istringstream tokens(op);
+    std::string        opcode, operand;
+
+    tokens >> opcode;
+    while (tokens >> operand) {
+      if (operand.front() == '"') operand = operand.substr(1);
+      if (!operand.empty() && (operand.back() == '"')) operand.pop_back();
+
+      if      (opcode == "bm") entry.bm.push_back(operand);
+      else if (opcode == "am") entry.am.push_back(operand);
+      else if (opcode == "id") entry.id += (entry.id.empty() ? "" : " ") + operand;
+    }
+  }
+
+  return !entry.bm.empty() || !entry.am.empty();
+}
+
+static void
+solve(const EPDEntry & entry, EPDResult & result)
+{
+  Position * pos       = chess_engine.get_pos(0);
+  Step     * best_move = chess_engine.get_best_move(0);
+
+  current = &result;
+  found   = false;
+
+  chess_engine.new_game();
+  chess_engine.load_board_from_fen(entry.fen);
+
+  for (int i = 0; i < MAXEPD; i++) best_move[i].c1 = -1;
+
+  bm_steps.clear();
+  am_steps.clear();
+
+  int idx = 0;
+  for (auto & san : entry.bm) {
+    Step step;
+    if (chess_engine.san_to_step(san, step)) {
+      bm_steps.push_back(step);
+      if (idx < MAXEPD) chess_engine.getbm(idx++, san);
+    }
+    else std::cerr << "Unknown bm move " << san << " in " << entry.id << std::endl;
+  }
+  for (auto & san : entry.am) {
+    Step step;
+    if (chess_engine.san_to_step(san, step)) am_steps.push_back(step);
+    else std::cerr << "Unknown am move " << san << " in " << entry.id << std::endl;
+  }
+
+  pos[0].best.f1 = NO_FIG;
+  pos[0].best.c1 = -1;
+
+  auto start = std::chrono::steady_clock::now();
+  chess_engine.solve_step();
+  auto end   = std::chrono::steady_clock::now();
+
+  result.time_ms = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+  result.nodes   = chess_engine.get_node_count();
+  result.solved  = (pos[0].best.c1 != -1) && is_right_move(pos[0].best);
+
+  std::string move = (pos[0].best.c1 == -1) ? "none" : chess_engine.step_to_str(pos[0].best);
+  strncpy(result.move, move.c_str(), sizeof(result.move) - 1);
+  result.move[sizeof(result.move) - 1] = 0;
+
+  if (!result.solved) {
+    result.found_ms    = result.time_ms;
+    result.found_nodes = result.nodes;
+  }
+
+  result.done = true;
+}
+
+static void
+usage(const char * name)
+{
+  std::cerr << "Usage: " << name << " [-t ms] [-n nodes] [-d depth] [-j workers] [-v] file.epd" << std::endl
+            << "  -t ms      Time limit per position (default 5000)"       << std::endl
+            << "  -n nodes   Node limit per position"                      << std::endl
+            << "  -d depth   Depth limit per position"                     << std::endl
+            << "  -j workers Number of worker processes (default: all cores)" << std::endl
+            << "  -v         Show the result of each position"             << std::endl;
+}
+
+int
+main(int argc, char ** argv)
+{
+  unsigned long time_ms = 5000, nodes = 0;
+  int           depth   = 0;
+  int           workers = std::thread::hardware_concurrency();
+  bool          verbose = false;
+  int           opt;
+
+  while ((opt = getopt(argc, argv, "t:n:d:j:v")) != -1) {
+    switch (opt) {
+      case 't': time_ms = atol(optarg); break;
+      case 'n': nodes   = atol(optarg); break;
+      case 'd': depth   = atoi(optarg); break;
+      case 'j': workers = atoi(optarg); break;
+      case 'v': verbose = true;         break;
+      default: usage(argv[0]); return 1;
+    }
+  }
+
+  if (optind >= argc) { usage(argv[0]); return 1; }
+  if (workers < 1) workers = 1;
+
+  std::ifstream file(argv[optind]);
+  if (!file.is_open()) {
+    std::cerr << "Unable to open " << argv[optind] << std::endl;
+    return 1;
+  }
+
+  std::vector<EPDEntry> entries;
+  std::string           line;
+
+  while (std::getline(file, line)) {
+    EPDEntry entry;
+    if (parse_epd(line, entry)) {
+      if (entry.id.empty()) entry.id = "#" + std::to_string(entries.size() + 1);
+      entries.push_back(entry);
+    }
+  }
+
+  if (entries.empty()) {
+    std::cerr << "No position found." << std::endl;
+    return 1;
+  }
+
+  int count = entries.size();
+  if (workers > count) workers = count;
+
+  // Results are written by the workers in shared memory
+  size_t       size   = sizeof(SharedData) + sizeof(EPDResult) * (count - 1);
+  SharedData * shared = (SharedData *) mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (shared == MAP_FAILED) {
+    std::cerr << "Unable to allocate shared memory." << std::endl;
+    return 1;
+  }
+  new (&shared->next) std::atomic<int>(0);
+
+  auto start = std::chrono::steady_clock::now();
+
+  for (int w = 0; w < workers; w++) {
+    pid_t pid = fork();
+    if (pid < 0) {
+      std::cerr << "Unable to start worker." << std::endl;
+      return 1;
+    }
+    if (pid == 0) {
+      std::cout.rdbuf(nullptr); // Engine console output is not needed
+
+      chess_engine.setup(5);
+      chess_engine.set_info_handler(info_handler);
+      chess_engine.set_search_limits(time_ms, depth, nodes);
+
+      int idx;
+      while ((idx = shared->next++) < count) solve(entries[idx], shared->results[idx]);
+
+      _exit(0);
+    }
+  }
+
+  while (wait(nullptr) > 0);
+
+  auto          end  = std::chrono::steady_clock::now();
+  unsigned long wall = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+
+  int           solved      = 0;
+  unsigned long found_ms    = 0, found_nodes = 0;
+  unsigned long total_ms    = 0, total_nodes = 0;
+
+  for (int i = 0; i < count; i++) {
+    EPDResult & r = shared->results[i];
+
+    if (!r.done) {
+      std::cerr << "No result for " << entries[i].id << std::endl;
+      continue;
+    }
+
+    total_ms    += r.time_ms;
+    total_nodes += r.nodes;
+
+    if (r.solved) {
+      solved++;
+      found_ms    += r.found_ms;
+      found_nodes += r.found_nodes;
+    }
+
+    if (verbose || !r.solved) {
+      std::cout << std::left << std::setw(12) << entries[i].id
+                << (r.solved ? " OK     " : " FAILED ")
+                << std::setw(8) << r.move;
+      if (!entries[i].bm.empty()) {
+        std::cout << " bm";
+        for (auto & m : entries[i].bm) std::cout << ' ' << m;
+      }
+      if (!entries[i].am.empty()) {
+        std::cout << " am";
+        for (auto & m : entries[i].am) std::cout << ' ' << m;
+      }
+      std::cout << std::right << "  " << r.found_ms << " ms " << r.found_nodes << " nodes" << std::endl;
+    }
+  }
+
+  std::cout << std::endl
+            << "Solved:              " << solved << '/' << count
+            << std::fixed << std::setprecision(1) << " (" << (100.0 * solved / count) << "%)" << std::endl;
+  if (solved > 0) {
+    std::cout << "Time to solution:    " << found_ms    << " ms total, " << (found_ms    / solved) << " ms average" << std::endl
+              << "Nodes to solution:   " << found_nodes << " total, "    << (found_nodes / solved) << " average"    << std::endl;
+  }
+  std::cout << "Search time:         " << total_ms    << " ms, " << total_nodes << " nodes" << std::endl
+            << "Wall clock:          " << wall        << " ms, " << workers << " worker(s)" << std::endl;
+
+  munmap(shared, size);
+
+  return (solved == count) ? 0 : 2;
+}
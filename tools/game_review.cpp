@@ -0,0 +1,297 @@
+// Batch game review
+//
+// Guy Turcotte
+// for inclusion in the Chess-InkPlate project
+//
+// (c) January 2021 - GPL-3.0
+//
+// Reviews games with a fixed node budget per position and writes the move
+// annotations (best, inaccuracy, mistake, blunder) in a sidecar file next
+// to each game (see lib/chess-engine/chess_engine_review.hpp). The moves
+// already reviewed in an existing sidecar file are not searched again.
+//
+// A game file is either a saved game of the device (.save, as
+// current_game.save) or a text file with the moves of a single game from the
+// start position, in SAN or coordinate notation (PGN tags, comments, move
+// numbers and results are skipped).
+//
+// The chess engine is a single instance per process. Games are then
+// distributed to worker processes, each one having its own engine. The
+// searches are done as on the device (normal search mode, node limit only):
+// with no time limit, a game gets the same review on every run.
+//
+// Usage: game_review [-n nodes] [-j workers] [-f] [-v] game...
+
+#include "chess_engine.hpp"
+#include "chess_engine_review.hpp"
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <thread>
+
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+static constexpr int     MAX_STEPS               = 1000;    // As the device
+static constexpr uint8_t SAVED_GAME_FILE_VERSION =    1;
+
+static const char * START_FEN = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq -";
+
+struct GameResult {
+  bool          done;
+  bool          ok;
+  int           plies;
+  int           reused;        // Plies taken from the sidecar file
+  int           counts[2][GameReview::CLASS_COUNT]; // White and black moves of each class
+  unsigned long time_ms;
+};
+
+struct SharedData {
+  std::atomic<int> next;       // Next game to be reviewed
+  GameResult       results[1];
+};
+
+static Step                 steps[MAX_STEPS];
+static GameReview::Entry  entries[MAX_STEPS];
+
+static bool
+read_saved_game(const std::string & filename, int & count)
+{
+  std::ifstream file(filename, std::ios::in | std::ios::binary);
+  uint8_t       version;
+  bool          play_white;
+  int16_t       step_count;
+
+  if (!file.is_open() ||
+      file.read(reinterpret_cast<char *>(&version   ), 1                 ).fail() ||
+      (version != SAVED_GAME_FILE_VERSION) ||
+      file.read(reinterpret_cast<char *>(&play_white), sizeof(play_white)).fail() ||
+      file.read(reinterpret_cast<char *>(&step_count), sizeof(step_count)).fail() ||
+      (step_count < 0) || (step_count > MAX_STEPS)) return false;
+
+  count = step_count;
+
+  return !file.read(reinterpret_cast<char *>(steps), count * sizeof(Step)).fail();
+}
+
+// The moves are played from the start position to get their steps.
+static bool
+read_text_game(const std::string & filename, int & count)
+{
+  std::ifstream file(filename);
+  std::string   line, token, moves;
+  bool          comment = false;
+
+  if (!file.is_open()) return false;
+
+  while (std::getline(file, line)) {
+    if (!comment && !line.empty() && (line[0] == '[')) continue;
+    moves += ' ';
+    for (char ch : line) {
+      if (comment) {
+        if (ch == '}') comment = false;
+      }
+      else if (ch == '{') comment = true;
+      else if (ch == ';') break;
+      else moves += (ch == '\r') ? ' ' : ch;
+    }
+  }
+
+  Board            * board = chess_engine.get_board();
+  std::istringstream stream(moves);
+
+  chess_engine.new_game();
+  chess_engine.load_board_from_fen(START_FEN);
+
+  count = 0;
+  while (stream >> token) {
+    // Move numbers (12. 12... 12.e4)
+    size_t i = 0;
+    while ((i < token.length()) && isdigit(token[i])) i++;
+    if ((i < token.length()) && (token[i] == '.')) {
+      while ((i < token.length()) && (token[i] == '.')) i++;
+      token = token.substr(i);
+      if (token.empty()) continue;
+    }
+
+    if ((token == "1-0") || (token == "0-1") || (token == "1/2-1/2") || (token == "*")) break;
+    if (count >= MAX_STEPS) return false;
+
+    Step & step = steps[count];
+
+    if (!chess_engine.san_to_step(token, step)) {
+      // Coordinate notation: only the squares and the promotion are used
+      if ((token.length() < 4) ||
+          (token[0] < 'a') || (token[0] > 'h') || (token[1] < '1') || (token[1] > '8') ||
+          (token[2] < 'a') || (token[2] > 'h') || (token[3] < '1') || (token[3] > '8')) return false;
+      step      = {};
+      step.c1   = (token[0] - 'a') + 8 * ('8' - token[1]);
+      step.c2   = (token[2] - 'a') + 8 * ('8' - token[3]);
+      step.f1   = (*board)[step.c1];
+      step.f2   = (*board)[step.c2];
+      step.type = MoveType::SIMPLE;
+      if (token.length() > 4) {
+        switch (token[4]) {
+          case 'n': step.type = MoveType::PROMOTE_TO_KNIGHT; break;
+          case 'b': step.type = MoveType::PROMOTE_TO_BISHOP; break;
+          case 'r': step.type = MoveType::PROMOTE_TO_ROOK;   break;
+          default:  step.type = MoveType::PROMOTE_TO_QUEEN;  break;
+        }
+      }
+    }
+
+    if (!chess_engine.play_step(chess_engine.step_to_uci(step))) return false;
+    count++;
+  }
+
+  return true;
+}
+
+static void
+review(const std::string & filename, unsigned long nodes, bool force, GameResult & result)
+{
+  auto start = std::chrono::steady_clock::now();
+  int  count = 0;
+
+  bool is_save = (filename.length() > 5) && (filename.substr(filename.length() - 5) == ".save");
+
+  result.ok = is_save ? read_saved_game(filename, count) : read_text_game(filename, count);
+
+  if (result.ok) {
+    std::string sidecar = GameReview::sidecar_name(filename);
+
+    result.plies  = count;
+    result.reused = force ? 0 : GameReview::load(sidecar, steps, count, entries);
+
+    if (result.reused < count) {
+      result.ok = GameReview::review(steps, count, nodes, entries, result.reused) &&
+                  GameReview::save(sidecar, steps, entries, count);
+    }
+
+    for (int i = 0; i < count; i++) result.counts[i & 1][(int) entries[i].cls]++;
+  }
+
+  auto end = std::chrono::steady_clock::now();
+  result.time_ms = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+  result.done    = true;
+}
+
+static void
+usage(const char * name)
+{
+  std::cerr << "Usage: " << name << " [-n nodes] [-j workers] [-f] [-v] game..."   << std::endl
+            << "  -n nodes   Node budget per position (default 200000)"           << std::endl
+            << "  -j workers Number of worker processes (default: all cores)"     << std::endl
+            << "  -f         Review again the moves of existing sidecar files"    << std::endl
+            << "  -v         Show the class counts of each game"                  << std::endl
+            << "Files ending with .save are saved games of the device, the others" << std::endl
+            << "hold the moves of a game in SAN or coordinate notation."          << std::endl;
+}
+
+int
+main(int argc, char ** argv)
+{
+  unsigned long nodes   = 200000;
+  int           workers = std::thread::hardware_concurrency();
+  bool          force   = false;
+  bool          verbose = false;
+  int           opt;
+
+  while ((opt = getopt(argc, argv, "n:j:fv")) != -1) {
+    switch (opt) {
+      case 'n': nodes   = atol(optarg); break;
+      case 'j': workers = atoi(optarg); break;
+      case 'f': force   = true;         break;
+      case 'v': verbose = true;         break;
+      default: usage(argv[0]); return 1;
+    }
+  }
+
+  if ((optind >= argc) || (nodes == 0)) { usage(argv[0]); return 1; }
+
+  int count = argc - optind;
+  if (workers < 1) workers = 1;
+  if (workers > count) workers = count;
+
+  // Results are written by the workers in shared memory
+  size_t       size   = sizeof(SharedData) + sizeof(GameResult) * (count - 1);
+  SharedData * shared = (SharedData *) mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (shared == MAP_FAILED) {
+    std::cerr << "Unable to allocate shared memory." << std::endl;
+    return 1;
+  }
+  new (&shared->next) std::atomic<int>(0);
+
+  auto start = std::chrono::steady_clock::now();
+
+  for (int w = 0; w < workers; w++) {
+    pid_t pid = fork();
+    if (pid < 0) {
+      std::cerr << "Unable to start worker." << std::endl;
+      return 1;
+    }
+    if (pid == 0) {
+      std::cout.rdbuf(nullptr); // Engine console output is not needed
+
+      chess_engine.setup(1);
+
+      int idx;
+      while ((idx = shared->next++) < count) review(argv[optind + idx], nodes, force, shared->results[idx]);
+
+      _exit(0);
+    }
+  }
+
+  while (wait(nullptr) > 0);
+
+  auto          end    = std::chrono::steady_clock::now();
+  unsigned long wall   = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+  int           failed = 0;
+  long          plies  = 0, reused = 0;
+  long          totals[GameReview::CLASS_COUNT] = { 0 };
+
+  for (int i = 0; i < count; i++) {
+    GameResult & r = shared->results[i];
+
+    if (!r.done || !r.ok) {
+      std::cerr << "Unable to review " << argv[optind + i] << std::endl;
+      failed++;
+      continue;
+    }
+
+    plies  += r.plies;
+    reused += r.reused;
+    for (int c = 0; c < GameReview::CLASS_COUNT; c++) totals[c] += r.counts[0][c] + r.counts[1][c];
+
+    if (verbose) {
+      std::cout << argv[optind + i] << ": " << r.plies << " plies, " << r.time_ms << " ms" << std::endl;
+      for (int side = 0; side < 2; side++) {
+        std::cout << (side == 0 ? "  White:" : "  Black:");
+        for (int c = 1; c < GameReview::CLASS_COUNT; c++) {
+          std::cout << ' ' << r.counts[side][c] << ' ' << GameReview::name((GameReview::Class) c)
+                    << ((c < GameReview::CLASS_COUNT - 1) ? "," : "");
+        }
+        std::cout << std::endl;
+      }
+    }
+  }
+
+  std::cout << "Games:        " << (count - failed) << '/' << count << " reviewed" << std::endl
+            << "Moves:        " << plies << " plies, " << reused << " from sidecar files" << std::endl
+            << "Annotations: ";
+  for (int c = 0; c < GameReview::CLASS_COUNT; c++) {
+    std::cout << ' ' << totals[c] << ' ' << GameReview::name((GameReview::Class) c) << ((c < GameReview::CLASS_COUNT - 1) ? "," : "");
+  }
+  std::cout << std::endl
+            << "Wall clock:   " << wall << " ms, " << workers << " worker(s), " << nodes << " nodes per position" << std::endl;
+
+  munmap(shared, size);
+
+  return (failed == 0) ? 0 : 2;
+}
@@ -0,0 +1,420 @@
+// Engine versus engine match runner
+//
+// Guy Turcotte
+// for inclusion in the Chess-InkPlate project
+//
+// (c) January 2021 - GPL-3.0
+//
+// Plays headless games between two configurations (A and B) of the chess
+// engine, to check if a change is really gaining strength. Each opening of the
+// list is played twice, colors reversed. Each configuration gets its own
+// search limits (time, nodes, depth) and its own feature toggles (any option
+// known by ChessEngine::set_option()). A game where an engine gives no move
+// or an illegal one is an error, reported and left out of the score.
+//
+// The chess engine is a single instance per process. Games are then
+// distributed to worker processes, each one having its own engine.
+//
+// Usage: match_runner [-o openings] [-g games] [-j workers] [-p max_plies] [-v]
+//                     [-a option=value]... [-b option=value]...
+//
+// Search limit options are time (ms per move), nodes and depth, or clock and
+// inc (ms for the game and increment per move) to use the time manager.
+
+#include "chess_engine.hpp"
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <atomic>
+#include <thread>
+#include <cmath>
+#include <cstring>
+
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+static const char * START_FEN = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq -";
+
+enum class GameEnd : uint8_t { NONE, CHECKMATE, STALEMATE, REPETITION, FIFTY_MOVES, MATERIAL, MAX_PLIES, TIME_FORFEIT, ERROR };
+
+static const char * game_end_names[] = {
+  "none", "checkmate", "stalemate", "repetition", "fifty moves", "material", "max plies", "time forfeit", "error"
+};
+
+static constexpr int GAME_END_COUNT = 9;
+
+struct SideConfig {
+  unsigned long                  time_ms;
+  unsigned long                  clock_ms;  // Time for the whole game, 0 if not used
+  unsigned long                  inc_ms;
+  unsigned long                  nodes;
+  int                            depth;
+  std::map<std::string, int32_t> options;
+};
+
+struct SideStats {
+  unsigned long moves;
+  unsigned long depth_sum;
+  unsigned long nodes;
+  unsigned long time_ms;
+};
+
+struct GameResult {
+  bool      done;
+  int8_t    score;    // From A point of view: 2 win, 1 draw, 0 loss
+  GameEnd   end;
+  uint16_t  plies;
+  SideStats stats[2]; // A, B
+};
+
+struct SharedData {
+  std::atomic<int> next;      // Next game to be played
+  GameResult       results[1];
+};
+
+static SideConfig config[2];
+static int        last_depth;
+
+static void
+info_handler(const SearchInfo & info)
+{
+  last_depth = info.depth;
+}
+
+static bool
+parse_option(const char * arg, SideConfig & side)
+{
+  const char * eq = strchr(arg, '=');
+  if (eq == nullptr) return false;
+
+  std::string name(arg, eq - arg);
+  long        value = atol(eq + 1);
+
+  if      (name == "time" ) side.time_ms  = value;
+  else if (name == "clock") side.clock_ms = value;
+  else if (name == "inc"  ) side.inc_ms   = value;
+  else if (name == "nodes") side.nodes   = value;
+  else if (name == "depth") side.depth   = value;
+  else {
+    int32_t dummy;
+    if (!chess_engine.get_option(name, dummy)) return false;
+    side.options[name] = value;
+  }
+
+  return true;
+}
+
+static void
+apply_config(const SideConfig & side, long remaining_ms)
+{
+  if (side.clock_ms > 0) {
+    chess_engine.set_search_limits(0, side.depth, side.nodes);
+    chess_engine.set_clock(remaining_ms, side.inc_ms, 0);
+  }
+  else chess_engine.set_search_limits(side.time_ms, side.depth, side.nodes);
+  for (auto & opt : side.options) chess_engine.set_option(opt.first, opt.second);
+}
+
+static bool
+insufficient_material()
+{
+  Board & board  = *chess_engine.get_board();
+  int     minors = 0;
+
+  for (int i = 0; i < 64; i++) {
+    int f = abs(board[i]);
+    if ((f == PAWN) || (f == ROOK) || (f == QUEEN)) return false;
+    if ((f == KNIGHT) || (f == BISHOP)) minors++;
+  }
+  return minors <= 1;
+}
+
+static void
+play_game(const std::string & fen, bool a_is_white, int max_plies, GameResult & result)
+{
+  Position * pos = chess_engine.get_pos(0);
+
+  long remaining[2] = { (long) config[0].clock_ms, (long) config[1].clock_ms };
+
+  chess_engine.new_game();
+  chess_engine.load_board_from_fen(fen);
+
+  result.end   = GameEnd::NONE;
+  result.plies = 0;
+
+  while (result.end == GameEnd::NONE) {
+    bool white = pos[0].white_move;
+    int  side  = (white == a_is_white) ? 0 : 1;
+
+    apply_config(config[side], remaining[side]);
+
+    pos[0].best.f1 = NO_FIG;
+    pos[0].best.c1 = -1;
+    last_depth     = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    chess_engine.solve_step();
+    auto end   = std::chrono::steady_clock::now();
+
+    if (chess_engine.get_end_of_game_type() == EndOfGameType::CHECKMATE) {
+      result.end   = GameEnd::CHECKMATE;
+      result.score = (side == 0) ? 0 : 2;
+      break;
+    }
+    if (chess_engine.get_end_of_game_type() == EndOfGameType::PAT) {
+      result.end = GameEnd::STALEMATE;
+      break;
+    }
+
+    // The engine always gives a move when there is one: a game where it does
+    // not is an error, not counted in the match score.
+    if (pos[0].best.c1 == -1) {
+      std::cerr << "No move found in " << chess_engine.export_pos_to_fen(0) << " (game from " << fen << ")" << std::endl;
+      result.end = GameEnd::ERROR;
+      break;
+    }
+    Step step = pos[0].best;
+
+    unsigned long duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+
+    SideStats & stats = result.stats[side];
+    stats.moves++;
+    stats.depth_sum += last_depth;
+    stats.nodes     += chess_engine.get_node_count();
+    stats.time_ms   += duration;
+
+    if (config[side].clock_ms > 0) {
+      remaining[side] -= duration;
+      if (remaining[side] < 0) {
+        result.end   = GameEnd::TIME_FORFEIT;
+        result.score = (side == 0) ? 0 : 2;
+        break;
+      }
+      remaining[side] += config[side].inc_ms;
+    }
+
+    if (!chess_engine.play_step(chess_engine.step_to_uci(step))) {
+      std::cerr << "Illegal move " << chess_engine.step_to_uci(step) << " in " << chess_engine.export_pos_to_fen(0)
+                << " (game from " << fen << ")" << std::endl;
+      result.end = GameEnd::ERROR;
+      break;
+    }
+    result.plies++;
+
+    if      (chess_engine.is_draw_by_rule()) result.end = (pos[0].halfmove >= 100) ? GameEnd::FIFTY_MOVES : GameEnd::REPETITION;
+    else if (insufficient_material())        result.end = GameEnd::MATERIAL;
+    else if (result.plies >= max_plies)      result.end = GameEnd::MAX_PLIES;
+  }
+}
+
+static void
+read_openings(const char * filename, std::vector<std::string> & openings)
+{
+  std::ifstream file(filename);
+  if (!file.is_open()) {
+    std::cerr << "Unable to open " << filename << std::endl;
+    return;
+  }
+
+  std::string line;
+  while (std::getline(file, line)) {
+    std::istringstream stream(line);
+    std::string        token, fen;
+
+    for (int i = 0; i < 4; i++) {
+      if (!(stream >> token)) break;
+      fen += token + ' ';
+    }
+    if (!fen.empty() && (fen[0] != '#')) openings.push_back(fen);
+  }
+}
+
+// Elo difference for a score ratio, bounded to avoid infinite values.
+static double
+elo(double score)
+{
+  score = std::min(std::max(score, 0.001), 0.999);
+  return -400.0 * std::log10(1.0 / score - 1.0);
+}
+
+static void
+usage(const char * name)
+{
+  std::cerr << "Usage: " << name << " [-o openings] [-g games] [-j workers] [-p max_plies] [-v]" << std::endl
+            << "       [-a option=value]... [-b option=value]..." << std::endl
+            << "  -o openings     File of FEN/EPD positions (default: start position)" << std::endl
+            << "  -g games        Number of games (default: 2 per opening)"            << std::endl
+            << "  -j workers      Number of worker processes (default: all cores)"     << std::endl
+            << "  -p max_plies    Game adjudicated as a draw after that (default 400)" << std::endl
+            << "  -v              Show the result of each game"                        << std::endl
+            << "  -a / -b         Configuration of engine A / B: time (ms per move),"  << std::endl
+            << "                  clock, inc (ms per game, increment), nodes, depth,"  << std::endl
+            << "                  null_move, futility, lazy_eval, stats, skill"        << std::endl;
+}
+
+int
+main(int argc, char ** argv)
+{
+  std::vector<std::string> openings;
+  int                      games     = 0;
+  int                      workers   = std::thread::hardware_concurrency();
+  int                      max_plies = 400;
+  bool                     verbose   = false;
+  int                      opt;
+
+  config[0].time_ms = config[1].time_ms = 100;
+  config[0].nodes   = config[1].nodes   = 0;
+  config[0].depth   = config[1].depth   = 0;
+
+  while ((opt = getopt(argc, argv, "o:g:j:p:va:b:")) != -1) {
+    switch (opt) {
+      case 'o': read_openings(optarg, openings); break;
+      case 'g': games     = atoi(optarg);        break;
+      case 'j': workers   = atoi(optarg);        break;
+      case 'p': max_plies = atoi(optarg);        break;
+      case 'v': verbose   = true;                break;
+      case 'a':
+      case 'b':
+        if (!parse_option(optarg, config[(opt == 'a') ? 0 : 1])) {
+          std::cerr << "Unknown option: " << optarg << std::endl;
+          return 1;
+        }
+        break;
+      default: usage(argv[0]); return 1;
+    }
+  }
+
+  if (openings.empty()) openings.push_back(START_FEN);
+  if (games   <= 0) games   = 2 * openings.size();
+  if (workers <  1) workers = 1;
+  if (workers > games) workers = games;
+
+  // An option set for one side only keeps the engine default for the other.
+  for (int side = 0; side < 2; side++) {
+    for (auto & opt : config[side].options) {
+      int32_t value;
+      chess_engine.get_option(opt.first, value);
+      config[1 - side].options.insert(std::make_pair(opt.first, value));
+    }
+  }
+
+  size_t       size   = sizeof(SharedData) + sizeof(GameResult) * (games - 1);
+  SharedData * shared = (SharedData *) mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (shared == MAP_FAILED) {
+    std::cerr << "Unable to allocate shared memory." << std::endl;
+    return 1;
+  }
+  new (&shared->next) std::atomic<int>(0);
+
+  auto start = std::chrono::steady_clock::now();
+
+  for (int w = 0; w < workers; w++) {
+    pid_t pid = fork();
+    if (pid < 0) {
+      std::cerr << "Unable to start worker." << std::endl;
+      return 1;
+    }
+    if (pid == 0) {
+      std::cout.rdbuf(nullptr); // Engine console output is not needed
+
+      chess_engine.setup(15);
+      chess_engine.set_info_handler(info_handler);
+
+      int idx;
+      while ((idx = shared->next++) < games) {
+        GameResult & result = shared->results[idx];
+        result.score = 1;
+        play_game(openings[(idx / 2) % openings.size()], (idx & 1) == 0, max_plies, result);
+        result.done = true;
+      }
+
+      _exit(0);
+    }
+  }
+
+  while (wait(nullptr) > 0);
+
+  auto          end  = std::chrono::steady_clock::now();
+  unsigned long wall = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+
+  int       wins = 0, draws = 0, losses = 0, errors = 0;
+  int       ends[GAME_END_COUNT] = { 0 };
+  SideStats totals[2];
+
+  memset(totals, 0, sizeof(totals));
+
+  for (int i = 0; i < games; i++) {
+    GameResult & r = shared->results[i];
+    if (!r.done) continue;
+
+    if      (r.end == GameEnd::ERROR) errors++;
+    else if (r.score == 2) wins++;
+    else if (r.score == 1) draws++;
+    else                   losses++;
+
+    ends[(int) r.end]++;
+
+    for (int side = 0; side < 2; side++) {
+      totals[side].moves     += r.stats[side].moves;
+      totals[side].depth_sum += r.stats[side].depth_sum;
+      totals[side].nodes     += r.stats[side].nodes;
+      totals[side].time_ms   += r.stats[side].time_ms;
+    }
+
+    if (verbose) {
+      std::cout << "Game " << std::setw(4) << (i + 1)
+                << ((i & 1) ? " B-A " : " A-B ")
+                << ((r.end == GameEnd::ERROR) ? "error  " :
+                    (r.score == 2) ? "A wins " : (r.score == 1) ? "draw   " : "B wins ")
+                << std::setw(4) << r.plies << " plies, " << game_end_names[(int) r.end] << std::endl;
+    }
+  }
+
+  int played = wins + draws + losses;
+  if (played == 0) {
+    std::cerr << "No game played" << ((errors > 0) ? ", all games in error." : ".") << std::endl;
+    return 1;
+  }
+
+  // Elo difference with a 95% confidence interval, from the standard
+  // deviation of the per game score.
+  double n     = played;
+  double score = (wins + 0.5 * draws) / n;
+  double var   = (wins   * std::pow(1.0 - score, 2) +
+                  draws  * std::pow(0.5 - score, 2) +
+                  losses * std::pow(0.0 - score, 2)) / n;
+  double dev   = 1.96 * std::sqrt(var / n);
+  double diff  = elo(score) + 0.0; // No negative zero
+  double error = (elo(score + dev) - elo(score - dev)) / 2.0;
+
+  std::cout << std::fixed << std::setprecision(1)
+            << std::endl
+            << "Games:     " << played << " (W " << wins << ", D " << draws << ", L " << losses << ") for A";
+  if (errors > 0) std::cout << ", " << errors << " game(s) in error not counted";
+  std::cout << std::endl
+            << "Score:     " << (100.0 * score) << "%" << std::endl
+            << "Elo:       " << diff << " +/- " << error << " (95%)" << std::endl
+            << "Endings:  ";
+  for (int i = 1; i < GAME_END_COUNT; i++) if (ends[i] > 0) std::cout << ' ' << game_end_names[i] << ' ' << ends[i];
+  std::cout << std::endl;
+
+  for (int side = 0; side < 2; side++) {
+    SideStats & t = totals[side];
+    std::cout << "Engine " << (char)('A' + side) << ":  "
+              << "depth " << ((t.moves > 0) ? (double) t.depth_sum / t.moves : 0.0)
+              << ", nps " << (unsigned long)((t.time_ms > 0) ? (t.nodes * 1000.0 / t.time_ms) : 0.0)
+              << ", "     << ((t.moves > 0) ? (double) t.time_ms / t.moves : 0.0) << " ms/move" << std::endl;
+  }
+
+  std::cout << "Wall clock: " << wall << " ms, " << workers << " worker(s)" << std::endl;
+
+  munmap(shared, size);
+
+  return 0;
+}
@@ -0,0 +1,310 @@
+// Puzzles file builder
+//
+// Guy Turcotte
+// for inclusion in the Chess-InkPlate project
+//
+// (c) January 2021 - GPL-3.0
+//
+// Builds the puzzles file of the device (see
+// lib/chess-engine/chess_engine_puzzles.hpp) from:
+//
+// - Lichess puzzle CSV files (.csv): PuzzleId,FEN,Moves,Rating,... The
+//   first move of the line is the opponent move leading to the puzzle
+//   position, the following ones are the solution.
+//
+// - EPD files (any other name): the solution is the best move (bm), or the
+//   whole mating line with a direct mate (dm) opcode, found with the mate
+//   solver. A "rating" opcode gives the rating, if present.
+//
+// Every move is checked with the engine move generator. Puzzles with illegal
+// moves or more than 16 moves of solution are skipped.
+//
+// Usage: puzzle_builder [-o puzzles.bin] [-r rating] [-n nodes] file...
+
+#include "chess_engine.hpp"
+#include "chess_engine_puzzles.hpp"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include <unistd.h>
+
+struct Record {
+  uint16_t rating;
+  uint8_t  data[Puzzles::RECORD_SIZE];
+};
+
+static std::string output         = "puzzles.bin";
+static int         default_rating = 1500;
+static long        mate_nodes     = 2000000;
+
+static std::vector<Record> records;
+static long                skipped = 0;
+
+// The puzzle position, from the engine root position.
+static void
+set_position(Puzzle & puzzle)
+{
+  Position * pos = chess_engine.get_pos(0);
+
+  memcpy(puzzle.board, *chess_engine.get_board(), sizeof(Board));
+  puzzle.white_move = pos->white_move;
+  puzzle.castling   = (pos->white_castle_kingside_ok  ? 1 : 0) |
+                      (pos->white_castle_queenside_ok ? 2 : 0) |
+                      (pos->black_castle_kingside_ok  ? 4 : 0) |
+                      (pos->black_castle_queenside_ok ? 8 : 0);
+  puzzle.en_passant = pos->en_passant_pp;
+  puzzle.move_count = 0;
+}
+
+static MoveType
+uci_promotion(const std::string & move)
+{
+  if (move.length() < 5) return MoveType::UNKNOWN;
+  switch (tolower(move[4])) {
+    case 'n': return MoveType::PROMOTE_TO_KNIGHT;
+    case 'b': return MoveType::PROMOTE_TO_BISHOP;
+    case 'r': return MoveType::PROMOTE_TO_ROOK;
+    case 'q': return MoveType::PROMOTE_TO_QUEEN;
+    default:  return MoveType::UNKNOWN;
+  }
+}
+
+// Plays the move (e2e4, e7e8q) on the root position and adds it to the
+// solution. Returns false if the move is illegal or the solution too long.
+static bool
+add_move(Puzzle & puzzle, const std::string & move)
+{
+  if ((move.length() < 4) || (puzzle.move_count >= Puzzles::MAX_MOVES)) return false;
+
+  int c1 = (move[0] - 'a') + 8 * ('8' - move[1]);
+  int c2 = (move[2] - 'a') + 8 * ('8' - move[3]);
+  if ((c1 < 0) || (c1 > 63) || (c2 < 0) || (c2 > 63)) return false;
+
+  if (!chess_engine.play_step(move)) return false;
+
+  puzzle.moves[puzzle.move_count++] = Puzzles::encode_move(c1, c2, uci_promotion(move));
+  return true;
+}
+
+static void
+add_record(Puzzle & puzzle, int rating)
+{
+  if (puzzle.move_count == 0) {
+    skipped++;
+    return;
+  }
+
+  Record record;
+  puzzle.rating = record.rating = std::max(0, std::min(rating, 65535));
+  Puzzles::pack(puzzle, record.data);
+  records.push_back(record);
+}
+
+static std::vector<std::string>
+split(const std::string & line, char separator)
+{
+  std::vector<std::string> fields;
+  std::string              field;
+  std::istringstream       stream(line);
+
+  while (std::getline(stream, field, separator)) fields.push_back(field);
+  return fields;
+}
+
+static void
+csv_line(const std::string & line)
+{
+  std::vector<std::string> fields = split(line, ',');
+
+  if ((fields.size() < 4) || (fields[0] == "PuzzleId")) return;
+
+  Puzzle puzzle;
+
+  if (!chess_engine.load_board_from_fen(fields[1])) {
+    skipped++;
+    return;
+  }
+
+  std::istringstream moves(fields[2]);
+  std::string        move;
+  bool               first = true;
+
+  while (moves >> move) {
+    if (first) {
+      // The opponent move leads to the puzzle position
+      if (!chess_engine.play_step(move)) break;
+      set_position(puzzle);
+      first = false;
+    }
+    else if (!add_move(puzzle, move)) {
+      puzzle.move_count = 0;
+      break;
+    }
+  }
+
+  if (first) puzzle.move_count = 0;
+
+  add_record(puzzle, atoi(fields[3].c_str()));
+}
+
+static void
+epd_line(const std::string & line)
+{
+  std::istringstream stream(line);
+  std::string        fen, field, opcodes;
+
+  for (int i = 0; (i < 4) && (stream >> field); i++) fen += field + ' ';
+  std::getline(stream, opcodes);
+
+  if (fen.empty()) return;
+
+  Puzzle puzzle;
+
+  if (!chess_engine.load_board_from_fen(fen)) {
+    skipped++;
+    return;
+  }
+  set_position(puzzle);
+
+  int         rating = default_rating;
+  int         mate   = 0;
+  std::string best;
+
+  for (auto & opcode : split(opcodes, ';')) {
+    std::istringstream op(opcode);
+    std::string        name, value;
+    op >> name >> value;
+    if      (name == "bm"    ) best   = value;
+    else if (name == "dm"    ) mate   = atoi(value.c_str());
+    else if (name == "rating") rating = atoi(value.c_str());
+  }
+
+  if ((mate > 0) && (mate <= ChessEngine::MATE_MAX_MOVES)) {
+    Step line[MAXDEPTH];
+    int  count;
+
+    chess_engine.get_pos(0)->best.c1 = -1;
+    if ((chess_engine.solve_mate(mate, mate_nodes, line, count) == ChessEngine::MateResult::MATE) &&
+        (count <= Puzzles::MAX_MOVES)) {
+      for (int i = 0; i < count; i++) {
+        puzzle.moves[puzzle.move_count++] = Puzzles::encode_move(line[i].c1, line[i].c2, line[i].type);
+      }
+    }
+  }
+  else if (!best.empty()) {
+    Step step;
+    if (chess_engine.san_to_step(best, step) && !add_move(puzzle, chess_engine.step_to_uci(step))) {
+      puzzle.move_count = 0;
+    }
+  }
+
+  add_record(puzzle, rating);
+}
+
+static bool
+read_file(const std::string & name)
+{
+  std::ifstream file(name);
+
+  if (!file.is_open()) {
+    std::cerr << "Unable to open " << name << std::endl;
+    return false;
+  }
+
+  bool        csv = (name.length() > 4) && (name.substr(name.length() - 4) == ".csv");
+  std::string line;
+
+  while (std::getline(file, line)) {
+    if (!line.empty() && (line.back() == '\r')) line.pop_back();
+    if (line.empty() || (line[0] == '#')) continue;
+
+    if (csv) csv_line(line);
+    else     epd_line(line);
+  }
+
+  return true;
+}
+
+static bool
+write_file()
+{
+  std::stable_sort(records.begin(), records.end(),
+                   [](const Record & a, const Record & b) { return a.rating < b.rating; });
+
+  uint32_t first[Puzzles::BUCKET_COUNT + 1];
+  uint32_t idx = 0;
+
+  for (int b = 0; b < Puzzles::BUCKET_COUNT; b++) {
+    first[b] = idx;
+    while ((idx < records.size()) && (Puzzles::bucket_of(records[idx].rating) == b)) idx++;
+  }
+  first[Puzzles::BUCKET_COUNT] = idx;
+
+  uint8_t header[Puzzles::HEADER_SIZE];
+  Puzzles::write_header(first, header);
+
+  FILE * file = fopen(output.c_str(), "wb");
+  bool   ok   = (file != nullptr) && (fwrite(header, 1, sizeof(header), file) == sizeof(header));
+
+  for (auto & record : records) {
+    if (!ok) break;
+    ok = fwrite(record.data, 1, Puzzles::RECORD_SIZE, file) == Puzzles::RECORD_SIZE;
+  }
+  if (file != nullptr) ok = (fclose(file) == 0) && ok;
+
+  if (!ok) {
+    std::cerr << "Unable to write " << output << std::endl;
+    unlink(output.c_str());
+  }
+
+  return ok;
+}
+
+static void
+usage(const char * name)
+{
+  std::cerr << "Usage: " << name << " [-o puzzles.bin] [-r rating] [-n nodes] file..." << std::endl
+            << "  -o file    Puzzles file to build (default puzzles.bin)"                   << std::endl
+            << "  -r rating  Rating of the EPD puzzles without rating opcode (default 1500)" << std::endl
+            << "  -n nodes   Node limit of the mate solver for dm opcodes (default 2000000)" << std::endl
+            << "Files ending with .csv are Lichess puzzle files, the others EPD files."     << std::endl;
+}
+
+int
+main(int argc, char ** argv)
+{
+  int opt;
+
+  while ((opt = getopt(argc, argv, "o:r:n:")) != -1) {
+    switch (opt) {
+      case 'o': output         = optarg;       break;
+      case 'r': default_rating = atoi(optarg); break;
+      case 'n': mate_nodes     = atol(optarg); break;
+      default: usage(argv[0]); return 1;
+    }
+  }
+
+  if (optind >= argc) { usage(argv[0]); return 1; }
+
+  std::cout.rdbuf(nullptr); // Engine console output is not needed
+
+  // No engine task: the steps are generated in the calling thread.
+  chess_engine.set_deterministic(true);
+
+  for (int i = optind; i < argc; i++) {
+    if (!read_file(argv[i])) return 1;
+  }
+
+  if (!write_file()) return 1;
+
+  std::cerr << records.size() << " puzzles written to " << output << ", " << skipped << " skipped." << std::endl;
+
+  return 0;
+}
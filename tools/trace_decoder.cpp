@@ -0,0 +1,111 @@
+// Search trace decoder
+//
+// Guy Turcotte
+// for inclusion in the Chess-InkPlate project
+//
+// (c) January 2021 - GPL-3.0
+//
+// Decodes a search trace dumped by ChessEngine::dump_trace() (file
+// search_trace.bin on the SD card when the application is built with
+// CHESS_TRACE=1) and prints one line per event, indented by ply.
+//
+// Usage: trace_decoder trace_file [max_ply]
+
+#include "chess_engine_trace.hpp"
+
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <cstring>
+#include <string>
+
+static const char * kind_names[] = {
+  "ITERATION", "ENTER", "MOVE", "SCORE", "CUTOFF", "PRUNE", "RESULT"
+};
+
+static const char * reason_names[] = {
+  "", "null-move", "futility", "lazy-eval", "repetition", "time"
+};
+
+static std::string
+square(int8_t board_idx)
+{
+  if ((board_idx < 0) || (board_idx > 63)) return "--";
+  char buf[2];
+  buf[0] = 'a' + (board_idx % 8);
+  buf[1] = '1' + (7 - (board_idx / 8));
+  return std::string(buf, 2);
+}
+
+int
+main(int argc, char ** argv)
+{
+  if (argc < 2) {
+    std::cerr << "Usage: " << argv[0] << " trace_file [max_ply]" << std::endl;
+    return 1;
+  }
+
+  int max_ply = (argc > 2) ? atoi(argv[2]) : 255;
+
+  std::ifstream file(argv[1], std::ios::in | std::ios::binary);
+  if (!file.is_open()) {
+    std::cerr << "Unable to open " << argv[1] << std::endl;
+    return 1;
+  }
+
+  TraceFileHeader header;
+  if (file.read(reinterpret_cast<char *>(&header), sizeof(header)).fail() ||
+      (std::memcmp(header.magic, "CTRC", 4) != 0)) {
+    std::cerr << "Not a search trace file." << std::endl;
+    return 1;
+  }
+
+  if ((header.version != SearchTrace::TRACE_FILE_VERSION) || (header.event_size != sizeof(TraceEvent))) {
+    std::cerr << "Unsupported trace file version " << +header.version << std::endl;
+    return 1;
+  }
+
+  std::cout << header.count << " events";
+  if (header.lost > 0) std::cout << " (" << header.lost << " older events lost)";
+  std::cout << std::endl;
+
+  TraceEvent e;
+  for (uint32_t i = 0; i < header.count; i++) {
+    if (file.read(reinterpret_cast<char *>(&e), sizeof(e)).fail()) {
+      std::cerr << "Truncated trace file." << std::endl;
+      return 1;
+    }
+    if (e.ply > max_ply) continue;
+
+    std::cout << std::setw(10) << e.node << ' ';
+    for (int j = 0; j < e.ply; j++) std::cout << "  ";
+
+    int kind = (int) e.kind;
+    std::cout << ((kind < 7) ? kind_names[kind] : "?");
+
+    switch (e.kind) {
+      case TraceKind::ITERATION:
+        std::cout << " level=" << +e.depth << " alpha=" << e.score;
+        break;
+      case TraceKind::ENTER:
+        std::cout << " ply=" << +e.ply << " depth=" << +e.depth << " alpha=" << e.score;
+        break;
+      case TraceKind::MOVE:
+        std::cout << ' ' << square(e.c1) << square(e.c2) << " #" << e.score + 1 << " depth=" << +e.depth;
+        break;
+      case TraceKind::SCORE:
+      case TraceKind::CUTOFF:
+      case TraceKind::RESULT:
+        std::cout << ' ' << square(e.c1) << square(e.c2) << " score=" << e.score;
+        break;
+      case TraceKind::PRUNE:
+        std::cout << ' ' << (((int) e.reason < 6) ? reason_names[(int) e.reason] : "?");
+        if (e.c1 >= 0) std::cout << ' ' << square(e.c1) << square(e.c2);
+        std::cout << " score=" << e.score << " depth=" << +e.depth;
+        break;
+    }
+    std::cout << std::endl;
+  }
+
+  return 0;
+}